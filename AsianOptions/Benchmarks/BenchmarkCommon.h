@@ -0,0 +1,58 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/processes/blackscholesprocess.hpp>
+#include <ql/termstructures/volatility/equityfx/blackconstantvol.hpp>
+#include <ql/termstructures/yield/flatforward.hpp>
+#include <ql/time/calendars/target.hpp>
+#include <ql/time/daycounters/actual365fixed.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Command Line
+//===================
+
+inline std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+inline std::vector<Size> sizes(const std::string& list) {
+    std::vector<Size> values;
+    std::vector<std::string> items = split(list);
+    for (Size i = 0; i < items.size(); i++)
+        values.push_back((Size)std::stoul(items[i]));
+    return values;
+}
+
+//===================
+// Market
+//===================
+
+const Real riskFreeRate = 0.027, dividendYield = 0.01, volatility = 0.30;
+
+// Each thread builds its own process: the Black-Scholes process
+// caches its local vol lazily and is not safe to share.
+inline ext::shared_ptr<GeneralizedBlackScholesProcess> makeProcess() {
+    Date today = Settings::instance().evaluationDate();
+    DayCounter dayCounter = Actual365Fixed();
+    Handle<Quote> spot(ext::shared_ptr<Quote>(new SimpleQuote(1.0)));
+    Handle<YieldTermStructure> rates(ext::shared_ptr<YieldTermStructure>(
+        new FlatForward(today, riskFreeRate, dayCounter)));
+    Handle<YieldTermStructure> dividends(ext::shared_ptr<YieldTermStructure>(
+        new FlatForward(today, dividendYield, dayCounter)));
+    Handle<BlackVolTermStructure> vol(ext::shared_ptr<BlackVolTermStructure>(
+        new BlackConstantVol(today, TARGET(), volatility, dayCounter)));
+    return ext::shared_ptr<GeneralizedBlackScholesProcess>(
+        new BlackScholesMertonProcess(spot, dividends, rates, vol));
+}
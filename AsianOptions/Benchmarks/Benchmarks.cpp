@@ -0,0 +1,462 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <ql/qldefines.hpp>
+#ifdef BOOST_MSVC
+#  include <ql/auto_link.hpp>
+#endif
+#include <ql/instruments/asianoption.hpp>
+#include <ql/methods/montecarlo/pathgenerator.hpp>
+#include <ql/pricingengines/asian/mc_discr_geom_av_strike.hpp>
+#include <MyPathGenerator.h>
+#include <PhiloxRsg.h>
+#include <StridedArray.h>
+#include "BenchmarkCommon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace QuantLib;
+
+typedef StridedArray<double, 2> array2d_double;
+
+#if defined(QL_ENABLE_SESSIONS)
+namespace QuantLib {
+    Integer sessionId() { return 0; }
+}
+#endif
+
+namespace {
+
+    //===================
+    // Options
+    //===================
+
+    struct Options {
+        std::vector<Size> steps, threads;
+        Size paths, repeats;
+        std::vector<std::string> rngs;
+        std::string filter, csv, baseline;
+        Real tolerance;
+    };
+
+    Options parse(int argc, char* argv[]) {
+        Options options;
+        options.steps = sizes("64,252,1024");
+        Size hardware = std::max<Size>(1, std::thread::hardware_concurrency());
+        options.threads.push_back(1);
+        if (hardware > 1)
+            options.threads.push_back(hardware);
+        options.paths = 20000;
+        options.repeats = 3;
+        options.rngs = split("sobol,philox");
+        options.tolerance = 0.1;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            QL_REQUIRE(i + 1 < argc, "missing value for " << arg);
+            std::string value = argv[++i];
+            if (arg == "--steps")
+                options.steps = sizes(value);
+            else if (arg == "--threads")
+                options.threads = sizes(value);
+            else if (arg == "--paths")
+                options.paths = (Size)std::stoul(value);
+            else if (arg == "--repeats")
+                options.repeats = std::max<Size>(1, (Size)std::stoul(value));
+            else if (arg == "--rng")
+                options.rngs = split(value);
+            else if (arg == "--filter")
+                options.filter = value;
+            else if (arg == "--csv")
+                options.csv = value;
+            else if (arg == "--baseline")
+                options.baseline = value;
+            else if (arg == "--tolerance")
+                options.tolerance = std::stod(value);
+            else
+                QL_FAIL("unknown option " << arg);
+        }
+        return options;
+    }
+
+    //===================
+    // Results
+    //===================
+
+    struct Result {
+        std::string benchmark, rng, barrier;
+        Size steps, paths, threads;
+        Real seconds;
+        Real pathsPerSecond() const { return paths / seconds; }
+        Real nsPerStep() const { return seconds * 1.0e9 / (Real(paths) * steps); }
+        std::string key() const {
+            std::ostringstream out;
+            out << benchmark << "," << rng << "," << barrier << ","
+                << steps << "," << paths << "," << threads;
+            return out.str();
+        }
+    };
+
+    const char* csvHeader = "benchmark,rng,barrier,steps,paths,threads,seconds,paths_per_sec,ns_per_step";
+
+    std::string csvRow(const Result& r) {
+        std::ostringstream out;
+        out.precision(9);
+        out << r.key() << "," << r.seconds << "," << r.pathsPerSecond() << "," << r.nsPerStep();
+        return out.str();
+    }
+
+    void printRow(const Result& r) {
+        std::printf("%-18s %-7s %-7s %6lu %9lu %7lu %13.0f %10.2f\n",
+            r.benchmark.c_str(), r.rng.c_str(), r.barrier.c_str(),
+            (unsigned long)r.steps, (unsigned long)r.paths, (unsigned long)r.threads,
+            r.pathsPerSecond(), r.nsPerStep());
+        std::fflush(stdout);
+    }
+
+    // paths/sec of a previous --csv output, by key
+    std::map<std::string, Real> readBaseline(const std::string& file) {
+        std::ifstream in(file.c_str());
+        QL_REQUIRE(in, "cannot open baseline " << file);
+        std::map<std::string, Real> baseline;
+        std::string line;
+        std::getline(in, line);
+        QL_REQUIRE(line == csvHeader, file << " is not a benchmark csv");
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields = split(line);
+            if (fields.size() != 9)
+                continue;
+            std::string key = fields[0];
+            for (Size i = 1; i < 6; i++)
+                key += "," + fields[i];
+            baseline[key] = std::stod(fields[7]);
+        }
+        return baseline;
+    }
+
+    //! observation flags and levels with steps+1 entries, as GeneratePath takes them
+    struct Barriers {
+        explicit Barriers(Size steps)
+            : upOb(steps + 1, 0), downOb(steps + 1, 1), upLevel(steps + 1, 0.0) {
+            downOb[0] = 0;
+            for (Size i = 21; i <= steps; i += 21) {
+                upOb[i] = 1;
+                upLevel[i] = 1.05 - 0.002 * (i / 21);
+            }
+        }
+        std::vector<char> upOb, downOb;
+        std::vector<Real> upLevel;
+    };
+
+    const Real upBarrier = 1.05, downBarrier = 0.75;
+
+    //===================
+    // Runner
+    //===================
+
+    // Runs work(first, count) on threads disjoint ranges of [0, paths)
+    // and returns the wall time.
+    template <class Work>
+    Real timeThreads(Size threads, Size paths, Work work) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<std::thread> pool;
+        for (Size t = 0; t < threads; t++) {
+            Size first = t * paths / threads, last = (t + 1) * paths / threads;
+            pool.push_back(std::thread(work, first, last - first));
+        }
+        for (Size t = 0; t < threads; t++)
+            pool[t].join();
+        return std::chrono::duration<Real>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Calls f(rsg) with a sequence generator whose next draw is sequence first.
+    template <class F>
+    void withSequenceGenerator(const std::string& rng, Size dimension, Size first, F f) {
+        if (rng == "sobol") {
+            SobolRsg sobol(dimension, 42);
+            if (first > 0)
+                sobol.skipTo((std::uint32_t)first);
+            LowDiscrepancy::rsg_type rsg(sobol);
+            f(rsg);
+        }
+        else if (rng == "philox") {
+            PhiloxRsg rsg(dimension, 42);
+            rsg.skipTo(first);
+            f(rsg);
+        }
+        else {
+            QL_FAIL("unknown rng " << rng);
+        }
+    }
+
+    class Suite {
+    public:
+        explicit Suite(const Options& options) : options_(options) {}
+        void add(const std::string& benchmark, const std::string& rng, const std::string& barrier,
+                 Size steps, Size threads, Real seconds) {
+            Result r = { benchmark, rng, barrier, steps, options_.paths, threads, seconds };
+            results_.push_back(r);
+            printRow(r);
+        }
+        // best of the repeats, after one warm-up run
+        template <class Run>
+        Real best(Run run) const {
+            run();
+            Real seconds = QL_MAX_REAL;
+            for (Size k = 0; k < options_.repeats; k++)
+                seconds = std::min(seconds, run());
+            return seconds;
+        }
+        bool selected(const std::string& benchmark) const {
+            return options_.filter.empty() || benchmark.find(options_.filter) != std::string::npos;
+        }
+        const std::vector<Result>& results() const { return results_; }
+    private:
+        const Options& options_;
+        std::vector<Result> results_;
+    };
+
+    //===================
+    // Benchmarks
+    //===================
+
+    // MyRandomSequenceGenerator::copy_bm, the GenerateRS loop
+    void benchCopyBm(Suite& suite, const Options& o, Size steps, const array2d_double& arr) {
+        Time tenor = steps / 252.0;
+        for (Size r = 0; r < o.rngs.size(); r++)
+            for (Size t = 0; t < o.threads.size(); t++) {
+                const std::string& rng = o.rngs[r];
+                Real seconds = suite.best([&]() {
+                    return timeThreads(o.threads[t], o.paths, [&](Size first, Size count) {
+                        withSequenceGenerator(rng, steps, first, [&](auto& rsg) {
+                            MyRandomSequenceGenerator<typename std::decay<decltype(rsg)>::type>
+                                generator(tenor, steps, rsg, true);
+                            array2d_double out = arr;
+                            for (ssize_t row = first; row < (ssize_t)(first + count); row++)
+                                generator.copy_bm(out, row);
+                        });
+                    });
+                });
+                suite.add("copy_bm", rng, "none", steps, o.threads[t], seconds);
+            }
+    }
+
+    // BrownianBridge::transform alone, on one fixed draw
+    void benchBridge(Suite& suite, const Options& o, Size steps) {
+        for (Size t = 0; t < o.threads.size(); t++) {
+            Real seconds = suite.best([&]() {
+                return timeThreads(o.threads[t], o.paths, [&](Size first, Size count) {
+                    BrownianBridge bridge(steps);
+                    PhiloxRsg rsg(steps, 42);
+                    std::vector<Real> z = rsg.nextSequence().value, w(steps);
+                    for (Size p = 0; p < count; p++) {
+                        z[p % steps] = -z[p % steps];
+                        bridge.transform(z.begin(), z.end(), w.begin());
+                    }
+                });
+            });
+            suite.add("bridge", "-", "none", steps, o.threads[t], seconds);
+        }
+    }
+
+    // PcaConstruction::transform alone on a calendar clock, with 64 nodes and the full PCA
+    void benchPca(Suite& suite, const Options& o, Size steps) {
+        const char* names[] = { "pca", "pca_full" };
+        Size nodes[] = { 64, steps };
+        PcaConstruction pcas[] = { PcaConstruction(std::vector<Real>(steps, 1.0 / steps), nodes[0]),
+                                   PcaConstruction(std::vector<Real>(steps, 1.0 / steps), nodes[1]) };
+        for (int c = 0; c < 2; c++)
+            for (Size t = 0; t < o.threads.size(); t++) {
+                Real seconds = suite.best([&]() {
+                    return timeThreads(o.threads[t], o.paths, [&](Size first, Size count) {
+                        PhiloxRsg rsg(steps, 42);
+                        std::vector<Real> z = rsg.nextSequence().value, w(steps);
+                        for (Size p = 0; p < count; p++) {
+                            z[p % steps] = -z[p % steps];
+                            pcas[c].transform(z.begin(), z.end(), w.begin());
+                        }
+                    });
+                });
+                suite.add(names[c], "-", "none", steps, o.threads[t], seconds);
+            }
+    }
+
+    // gen_bm() and copy_next(), the GeneratePath loop, without and with barriers
+    void benchCopyNext(Suite& suite, const Options& o, Size steps, const array2d_double& arr) {
+        Time tenor = steps / 252.0;
+        Barriers barriers(steps);
+        const char* names[] = { "none", "const", "step" };
+        for (Size r = 0; r < o.rngs.size(); r++)
+            for (int barrier = 0; barrier < 3; barrier++)
+                for (Size t = 0; t < o.threads.size(); t++) {
+                    const std::string& rng = o.rngs[r];
+                    Real seconds = suite.best([&]() {
+                        return timeThreads(o.threads[t], o.paths, [&](Size first, Size count) {
+                            ext::shared_ptr<GeneralizedBlackScholesProcess> process = makeProcess();
+                            withSequenceGenerator(rng, steps, first, [&](auto& rsg) {
+                                MyPathGenerator<typename std::decay<decltype(rsg)>::type>
+                                    generator(process, tenor, steps, rsg, true);
+                                KnockOut<ConstLevel<DownSide> > down(ConstLevel<DownSide>(&barriers.downOb[0], downBarrier));
+                                auto constant = both(KnockOut<ConstLevel<UpSide> >(ConstLevel<UpSide>(&barriers.upOb[0], upBarrier)), down);
+                                auto stepped = both(KnockOut<StepLevel<UpSide> >(StepLevel<UpSide>(&barriers.upOb[0], &barriers.upLevel[0])), down);
+                                array2d_double out = arr;
+                                for (ssize_t row = first; row < (ssize_t)(first + count); row++) {
+                                    generator.gen_bm();
+                                    if (barrier == 0)
+                                        generator.copy_next(out, row);
+                                    else if (barrier == 1)
+                                        generator.copy_next(out, row, constant);
+                                    else
+                                        generator.copy_next(out, row, stepped);
+                                }
+                            });
+                        });
+                    });
+                    suite.add("copy_next", rng, names[barrier], steps, o.threads[t], seconds);
+                }
+    }
+
+    // write_next() through the TileWriter of layout=1, into a (steps+1, paths) matrix
+    void benchTileWriter(Suite& suite, const Options& o, Size steps, const array2d_double& arr) {
+        Time tenor = steps / 252.0;
+        for (Size t = 0; t < o.threads.size(); t++) {
+            Real seconds = suite.best([&]() {
+                return timeThreads(o.threads[t], o.paths, [&](Size first, Size count) {
+                    ext::shared_ptr<GeneralizedBlackScholesProcess> process = makeProcess();
+                    PhiloxRsg rsg(steps, 42);
+                    rsg.skipTo(first);
+                    MyPathGenerator<PhiloxRsg> generator(process, tenor, steps, rsg, true);
+                    array2d_double out = arr;
+                    TileWriter<array2d_double, true> writer(out, steps, false);
+                    NoObserver observer;
+                    for (Size row = first; row < first + count; row++) {
+                        generator.gen_bm();
+                        writer.row(row);
+                        generator.write_next(writer, observer);
+                    }
+                    writer.flush();
+                });
+            });
+            suite.add("write_next_tile", "philox", "none", steps, o.threads[t], seconds);
+        }
+    }
+
+    // GeometricASOPathPricer on a pool of QuantLib paths
+    void benchPathPricer(Suite& suite, const Options& o, Size steps) {
+        ext::shared_ptr<GeneralizedBlackScholesProcess> process = makeProcess();
+        PathGenerator<PhiloxRsg> paths(process, TimeGrid(steps / 252.0, steps), PhiloxRsg(steps, 42), true);
+        std::vector<Path> pool;
+        for (Size p = 0; p < std::min<Size>(o.paths, 256); p++)
+            pool.push_back(paths.next().value);
+        GeometricASOPathPricer pricer(Option::Call, 0.97);
+        Real sum = 0.0;
+        Real seconds = suite.best([&]() {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (Size p = 0; p < o.paths; p++)
+                sum += pricer(pool[p % pool.size()]);
+            return std::chrono::duration<Real>(std::chrono::steady_clock::now() - start).count();
+        });
+        QL_ENSURE(sum == sum, "path pricer returned NaN");
+        suite.add("aso_path_pricer", "-", "none", steps, 1, seconds);
+    }
+
+    // MCDiscreteGeometricASEngine end to end, steps daily fixings
+    void benchEngine(Suite& suite, const Options& o, Size steps) {
+        Date today = Settings::instance().evaluationDate();
+        std::vector<Date> fixingDates;
+        for (Size i = 1; i <= steps; i++)
+            fixingDates.push_back(today + Integer(i) * Days);
+        ext::shared_ptr<StrikedTypePayoff> payoff(new PlainVanillaPayoff(Option::Call, 1.0));
+        ext::shared_ptr<Exercise> exercise(new EuropeanExercise(fixingDates.back()));
+        DiscreteAveragingAsianOption option(Average::Geometric, 1.0, 0, fixingDates, payoff, exercise);
+        ext::shared_ptr<GeneralizedBlackScholesProcess> process = makeProcess();
+        Real seconds = suite.best([&]() {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            option.setPricingEngine(MakeMCDiscreteGeometricASEngine<LowDiscrepancy>(process)
+                .withSamples(o.paths)
+                .withBrownianBridge(true)
+                .withSeed(42));
+            option.NPV();
+            return std::chrono::duration<Real>(std::chrono::steady_clock::now() - start).count();
+        });
+        suite.add("aso_engine", "sobol", "none", steps, 1, seconds);
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+
+    try {
+        Options options = parse(argc, argv);
+        Settings::instance().evaluationDate() = Date(24, Feb, 2020);
+        Suite suite(options);
+        std::printf("%-18s %-7s %-7s %6s %9s %7s %13s %10s\n",
+            "benchmark", "rng", "barrier", "steps", "paths", "threads", "paths/sec", "ns/step");
+        for (Size s = 0; s < options.steps.size(); s++) {
+            Size steps = options.steps[s];
+            // a C-order buffer of all paths, the layout GeneratePath fills
+            std::vector<double> buffer(options.paths * (steps + 1));
+            if (suite.selected("copy_bm") || suite.selected("copy_next")) {
+                array2d_double matrix = array2d_double::rowMajor(&buffer[0], (ssize_t)options.paths, (ssize_t)steps + 1);
+                if (suite.selected("copy_bm"))
+                    benchCopyBm(suite, options, steps, matrix);
+                if (suite.selected("copy_next"))
+                    benchCopyNext(suite, options, steps, matrix);
+            }
+            if (suite.selected("write_next_tile")) {
+                array2d_double matrix = array2d_double::rowMajor(&buffer[0], (ssize_t)steps + 1, (ssize_t)options.paths);
+                benchTileWriter(suite, options, steps, matrix);
+            }
+            if (suite.selected("bridge"))
+                benchBridge(suite, options, steps);
+            if (suite.selected("pca"))
+                benchPca(suite, options, steps);
+            if (suite.selected("aso_path_pricer"))
+                benchPathPricer(suite, options, steps);
+            if (suite.selected("aso_engine"))
+                benchEngine(suite, options, steps);
+        }
+
+        if (!options.csv.empty()) {
+            std::ofstream out(options.csv.c_str());
+            QL_REQUIRE(out, "cannot open " << options.csv);
+            out << csvHeader << "\n";
+            for (Size i = 0; i < suite.results().size(); i++)
+                out << csvRow(suite.results()[i]) << "\n";
+        }
+
+        // paths/sec below baseline*(1-tolerance) is a regression
+        int regressions = 0;
+        if (!options.baseline.empty()) {
+            std::map<std::string, Real> baseline = readBaseline(options.baseline);
+            std::cout << std::endl << "against " << options.baseline << ":" << std::endl;
+            for (Size i = 0; i < suite.results().size(); i++) {
+                const Result& r = suite.results()[i];
+                std::map<std::string, Real>::const_iterator old = baseline.find(r.key());
+                if (old == baseline.end())
+                    continue;
+                Real ratio = r.pathsPerSecond() / old->second;
+                bool slower = ratio < 1.0 - options.tolerance;
+                regressions += slower;
+                std::printf("%-48s %6.3fx%s\n", r.key().c_str(), ratio, slower ? "  REGRESSION" : "");
+            }
+        }
+        return regressions > 0 ? 2 : 0;
+
+    }
+    catch (std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,376 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <ql/qldefines.hpp>
+#ifdef BOOST_MSVC
+#  include <ql/auto_link.hpp>
+#endif
+#include <ql/instruments/asianoption.hpp>
+#include <ql/instruments/barrieroption.hpp>
+#include <ql/math/randomnumbers/randomizedlds.hpp>
+#include <ql/math/randomnumbers/rngtraits.hpp>
+#include <ql/pricingengines/asian/all.hpp>
+#include <ql/pricingengines/asian/mc_discr_geom_av_strike.hpp>
+#include <ql/pricingengines/barrier/analyticbarrierengine.hpp>
+#include <ql/pricingengines/barrier/mcbarrierengine.hpp>
+#include <MyPathGenerator.h>
+#include <PathEngine.h>
+#include "BenchmarkCommon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace QuantLib;
+
+#if defined(QL_ENABLE_SESSIONS)
+namespace QuantLib {
+    Integer sessionId() { return 0; }
+}
+#endif
+
+namespace {
+
+    //===================
+    // Randomized Sobol
+    //===================
+
+    //! Sobol points with a random shift modulo 1 drawn from the seed
+    /*! LowDiscrepancy gives the same points for every seed, so repeated
+        runs would all share one error. The Cranley-Patterson shift keeps
+        the points' spacing and makes each seed an independent unbiased
+        estimate, which is what an RMSE over repeats needs.
+    */
+    struct ShiftedSobol {
+        typedef RandomizedLDS<SobolRsg> ursg_type;
+        typedef InverseCumulativeRsg<ursg_type, InverseCumulativeNormal> rsg_type;
+        enum { allowsErrorEstimate = 0 };
+        static rsg_type make_sequence_generator(Size dimension, BigNatural seed) {
+            return rsg_type(ursg_type(SobolRsg(dimension, 42), PseudoRandom::ursg_type(dimension, seed)));
+        }
+    };
+
+    //===================
+    // Options
+    //===================
+
+    struct Options {
+        std::vector<std::string> products, rngs, constructions;
+        std::vector<Size> samples, steps, bridges, antithetics;
+        Size fixings, repeats, pcaNodes;
+        Real target;
+        std::string csv;
+    };
+
+    Options parse(int argc, char* argv[]) {
+        Options options;
+        options.products = split("ap_geometric,as_geometric,do_call_bridge,do_call_discrete");
+        options.rngs = split("pseudo,sobol");
+        options.samples = sizes("1024,4096,16384,65536");
+        options.steps = sizes("16,64,252");
+        options.bridges = sizes("0,1");
+        options.antithetics = sizes("0,1");
+        options.constructions = split("engine");
+        options.fixings = 64;
+        options.pcaNodes = 64;
+        options.repeats = 16;
+        options.target = 1.0e-3;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            QL_REQUIRE(i + 1 < argc, "missing value for " << arg);
+            std::string value = argv[++i];
+            if (arg == "--products")
+                options.products = split(value);
+            else if (arg == "--rng")
+                options.rngs = split(value);
+            else if (arg == "--samples")
+                options.samples = sizes(value);
+            else if (arg == "--steps")
+                options.steps = sizes(value);
+            else if (arg == "--bb")
+                options.bridges = sizes(value);
+            else if (arg == "--antithetic")
+                options.antithetics = sizes(value);
+            else if (arg == "--construction")
+                options.constructions = split(value);
+            else if (arg == "--pca-nodes")
+                options.pcaNodes = (Size)std::stoul(value);
+            else if (arg == "--fixings")
+                options.fixings = (Size)std::stoul(value);
+            else if (arg == "--repeats")
+                options.repeats = std::max<Size>(2, (Size)std::stoul(value));
+            else if (arg == "--target")
+                options.target = std::stod(value);
+            else if (arg == "--csv")
+                options.csv = value;
+            else
+                QL_FAIL("unknown option " << arg);
+        }
+        return options;
+    }
+
+    //===================
+    // Products
+    //===================
+
+    const Real strike = 1.0, downBarrier = 0.8;
+
+    // An instrument with its analytic reference and a Monte Carlo engine
+    // for any RNG policy. Asian options are priced on fixings daily dates,
+    // so their time steps are the fixings; the barrier is continuous and
+    // takes its steps from the sweep.
+    class Product {
+    public:
+        Product(const std::string& name, Size fixings, Size pcaNodes)
+        : name_(name), fixings_(fixings), maturity_(0.0) {
+            Date today = Settings::instance().evaluationDate();
+            process_ = makeProcess();
+            ext::shared_ptr<StrikedTypePayoff> payoff(new PlainVanillaPayoff(Option::Call, strike));
+            if (isBarrier()) {
+                ext::shared_ptr<Exercise> exercise(new EuropeanExercise(today + 1 * Years));
+                instrument_ = ext::shared_ptr<Instrument>(
+                    new BarrierOption(Barrier::DownOut, downBarrier, 0.0, payoff, exercise));
+                instrument_->setPricingEngine(ext::shared_ptr<PricingEngine>(
+                    new AnalyticBarrierEngine(process_)));
+            }
+            else {
+                QL_REQUIRE(name_ == "ap_geometric" || name_ == "as_geometric", "unknown product " << name_);
+                std::vector<Date> fixingDates;
+                for (Size i = 1; i <= fixings; i++)
+                    fixingDates.push_back(today + Integer(i) * Days);
+                ext::shared_ptr<Exercise> exercise(new EuropeanExercise(fixingDates.back()));
+                // daily fixings are an even grid, the one GeneratePath builds its PCA on
+                maturity_ = process_->time(fixingDates.back());
+                pca_ = _MakePca(process_, maturity_, (int)fixings, (int)pcaNodes);
+                instrument_ = ext::shared_ptr<Instrument>(
+                    new DiscreteAveragingAsianOption(Average::Geometric, 1.0, 0, fixingDates, payoff, exercise));
+                if (name_ == "ap_geometric")
+                    instrument_->setPricingEngine(ext::shared_ptr<PricingEngine>(
+                        new AnalyticDiscreteGeometricAveragePriceAsianEngine(process_)));
+                else
+                    instrument_->setPricingEngine(ext::shared_ptr<PricingEngine>(
+                        new AnalyticDiscreteGeometricAverageStrikeAsianEngine(process_)));
+            }
+            reference_ = instrument_->NPV();
+        }
+        const std::string& name() const { return name_; }
+        bool isBarrier() const { return name_.compare(0, 8, "do_call_") == 0; }
+        Real reference() const { return reference_; }
+
+        //! Monte Carlo NPV with the given configuration and seed
+        template <class RNG>
+        Real price(Size steps, Size samples, bool brownianBridge, bool antithetic, BigNatural seed) const {
+            ext::shared_ptr<PricingEngine> engine;
+            if (name_ == "ap_geometric")
+                engine = MakeMCDiscreteGeometricAPEngine<RNG>(process_)
+                    .withSamples(samples)
+                    .withBrownianBridge(brownianBridge)
+                    .withAntitheticVariate(antithetic)
+                    .withSeed(seed);
+            else if (name_ == "as_geometric")
+                engine = MakeMCDiscreteGeometricASEngine<RNG>(process_)
+                    .withSamples(samples)
+                    .withBrownianBridge(brownianBridge)
+                    .withAntitheticVariate(antithetic)
+                    .withSeed(seed);
+            else
+                // bridge: crossing probabilities between steps, discrete: steps only
+                engine = MakeMCBarrierEngine<RNG>(process_)
+                    .withSteps(steps)
+                    .withSamples(samples)
+                    .withBrownianBridge(brownianBridge)
+                    .withAntitheticVariate(antithetic)
+                    .withBias(name_ == "do_call_discrete")
+                    .withSeed(seed);
+            instrument_->setPricingEngine(engine);
+            return instrument_->NPV();
+        }
+
+        //! Monte Carlo NPV of the Asian on MyPathGenerator, the GeneratePath loop
+        /*! construction is incremental, bridge or pca; antithetic samples
+            average a path and its mirror, as the engines do. */
+        template <class RNG>
+        Real pricePaths(const std::string& construction, Size samples, bool antithetic, BigNatural seed) const {
+            QL_REQUIRE(!isBarrier(), "path constructions are only run for the Asian products");
+            QL_REQUIRE(construction == "incremental" || construction == "bridge" || construction == "pca",
+                "unknown construction " << construction);
+            MyPathGenerator<typename RNG::rsg_type> generator(process_, maturity_, fixings_,
+                RNG::make_sequence_generator(fixings_, seed), construction == "bridge");
+            if (construction == "pca")
+                generator.set_construction(pca_);
+            Real sum = 0.0;
+            for (Size i = 0; i < samples; i++) {
+                Real value = payoff(generator.next().value);
+                if (antithetic)
+                    value = 0.5 * (value + payoff(generator.antithetic().value));
+                sum += value;
+            }
+            return sum / samples * process_->riskFreeRate()->discount(maturity_);
+        }
+    private:
+        //! geometric average of the fixings, path[1] to path[fixings]
+        Real payoff(const Path& path) const {
+            Real logSum = 0.0;
+            for (Size i = 1; i < path.length(); i++)
+                logSum += std::log(path[i]);
+            Real average = std::exp(logSum / fixings_);
+            return name_ == "ap_geometric" ? std::max(average - strike, 0.0) : std::max(path.back() - average, 0.0);
+        }
+        std::string name_;
+        Size fixings_;
+        Time maturity_;
+        ext::shared_ptr<GeneralizedBlackScholesProcess> process_;
+        ext::shared_ptr<PcaConstruction> pca_;
+        ext::shared_ptr<Instrument> instrument_;
+        Real reference_;
+    };
+
+    //===================
+    // Results
+    //===================
+
+    struct Result {
+        std::string product, rng, construction;
+        bool brownianBridge, antithetic;
+        Size steps, samples, repeats;
+        Real reference, bias, rmse, seconds;
+        Real ratio;     // efficiency over plain pseudo-random, Null if not run
+        //! inverse of the work to reach a fixed error: 1 / (rmse^2 * seconds)
+        Real efficiency() const { return 1.0 / (rmse * rmse * seconds); }
+    };
+
+    const char* csvHeader = "product,rng,construction,bb,antithetic,steps,samples,repeats,reference,bias,rmse,seconds,efficiency,ratio";
+
+    // Prices repeats times with seeds 1..repeats and measures the error
+    // against the reference and the mean wall time of one pricing.
+    // construction "engine" is the QuantLib engine, with brownianBridge
+    // as given; the others price on the path generator of MCPath.
+    template <class RNG>
+    Result measure(const Product& product, const std::string& rng, const std::string& construction,
+                   Size steps, Size samples, bool brownianBridge, bool antithetic, Size repeats) {
+        Real sum = 0.0, squares = 0.0, seconds = 0.0;
+        for (Size k = 1; k <= repeats; k++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            Real npv = construction == "engine"
+                ? product.price<RNG>(steps, samples, brownianBridge, antithetic, k)
+                : product.pricePaths<RNG>(construction, samples, antithetic, k);
+            Real error = npv - product.reference();
+            seconds += std::chrono::duration<Real>(std::chrono::steady_clock::now() - start).count();
+            sum += error;
+            squares += error * error;
+        }
+        Result r = { product.name(), rng, construction, brownianBridge, antithetic, steps, samples, repeats,
+                     product.reference(), sum / repeats, std::sqrt(squares / repeats), seconds / repeats,
+                     Null<Real>() };
+        return r;
+    }
+
+}
+
+int main(int argc, char* argv[]) {
+
+    try {
+        Options options = parse(argc, argv);
+        Settings::instance().evaluationDate() = Date(24, Feb, 2020);
+
+        std::vector<Result> results;
+        std::printf("%-17s %-6s %-11s %2s %4s %5s %7s %11s %11s %11s %9s %10s %7s\n",
+            "product", "rng", "construction", "bb", "anti", "steps", "samples", "reference", "bias", "rmse", "seconds",
+            "efficiency", "ratio");
+        for (Size p = 0; p < options.products.size(); p++) {
+            Product product(options.products[p], options.fixings, options.pcaNodes);
+            // the sweep over steps only applies to the barrier
+            std::vector<Size> steps = product.isBarrier() ? options.steps : std::vector<Size>(1, options.fixings);
+            for (Size s = 0; s < steps.size(); s++)
+                for (Size n = 0; n < options.samples.size(); n++) {
+                    std::vector<Result> group;
+                    for (Size g = 0; g < options.rngs.size(); g++)
+                        for (Size c = 0; c < options.constructions.size(); c++) {
+                            const std::string& construction = options.constructions[c];
+                            // the path constructions are Asian only and ignore --bb
+                            bool engine = construction == "engine";
+                            if (!engine && product.isBarrier())
+                                continue;
+                            Size bridges = engine ? options.bridges.size() : 1;
+                            for (Size b = 0; b < bridges; b++)
+                                for (Size a = 0; a < options.antithetics.size(); a++) {
+                                    const std::string& rng = options.rngs[g];
+                                    bool bb = engine ? options.bridges[b] != 0 : construction != "incremental";
+                                    bool anti = options.antithetics[a] != 0;
+                                    if (rng == "pseudo")
+                                        group.push_back(measure<PseudoRandom>(product, rng, construction, steps[s], options.samples[n], bb, anti, options.repeats));
+                                    else if (rng == "sobol")
+                                        group.push_back(measure<ShiftedSobol>(product, rng, construction, steps[s], options.samples[n], bb, anti, options.repeats));
+                                    else
+                                        QL_FAIL("unknown rng " << rng);
+                                }
+                        }
+                    // ratios are against plain pseudo-random draws at the same steps and samples
+                    Real plain = Null<Real>();
+                    for (Size i = 0; i < group.size(); i++)
+                        if (group[i].rng == "pseudo" && group[i].construction == "engine"
+                            && !group[i].brownianBridge && !group[i].antithetic)
+                            plain = group[i].efficiency();
+                    for (Size i = 0; i < group.size(); i++) {
+                        Result& r = group[i];
+                        r.ratio = plain == Null<Real>() ? Null<Real>() : r.efficiency() / plain;
+                        std::printf("%-17s %-6s %-11s %2d %4d %5lu %7lu %11.6f %11.2e %11.2e %9.4f %10.4g %7.2f\n",
+                            r.product.c_str(), r.rng.c_str(), r.construction.c_str(), (int)r.brownianBridge, (int)r.antithetic,
+                            (unsigned long)r.steps, (unsigned long)r.samples, r.reference, r.bias, r.rmse,
+                            r.seconds, r.efficiency(), r.ratio == Null<Real>() ? 0.0 : r.ratio);
+                        results.push_back(r);
+                    }
+                    std::fflush(stdout);
+                }
+        }
+
+        // the cheapest configuration of each product that meets the target
+        std::cout << std::endl << "cheapest with rmse <= " << options.target << ":" << std::endl;
+        for (Size p = 0; p < options.products.size(); p++) {
+            const Result* best = 0;
+            for (Size i = 0; i < results.size(); i++) {
+                const Result& r = results[i];
+                if (r.product == options.products[p] && r.rmse <= options.target
+                    && (!best || r.seconds < best->seconds))
+                    best = &r;
+            }
+            if (best)
+                std::printf("%-17s rng=%s construction=%s bb=%d antithetic=%d steps=%lu samples=%lu: rmse %.2e in %.4f s\n",
+                    best->product.c_str(), best->rng.c_str(), best->construction.c_str(), (int)best->brownianBridge, (int)best->antithetic,
+                    (unsigned long)best->steps, (unsigned long)best->samples, best->rmse, best->seconds);
+            else
+                std::printf("%-17s none, add samples or steps\n", options.products[p].c_str());
+        }
+
+        if (!options.csv.empty()) {
+            std::ofstream out(options.csv.c_str());
+            QL_REQUIRE(out, "cannot open " << options.csv);
+            out.precision(9);
+            out << csvHeader << "\n";
+            for (Size i = 0; i < results.size(); i++) {
+                const Result& r = results[i];
+                out << r.product << "," << r.rng << "," << r.construction << "," << r.brownianBridge << "," << r.antithetic << ","
+                    << r.steps << "," << r.samples << "," << r.repeats << "," << r.reference << ","
+                    << r.bias << "," << r.rmse << "," << r.seconds << "," << r.efficiency() << ",";
+                if (r.ratio != Null<Real>())
+                    out << r.ratio;
+                out << "\n";
+            }
+        }
+        return 0;
+
+    }
+    catch (std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,168 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/errors.hpp>
+#include <ql/types.hpp>
+#include <ShardStatistics.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+using namespace QuantLib;
+
+//===================
+// Checkpoints
+//===================
+
+//! where a run stopped, enough to resume it bit for bit
+/*! The sequence generators are addressed by index: SobolRsg::skipTo
+    rebuilds the direction-number state of any index directly and the
+    counter of PhiloxRsg is the index, so the state of the sequence is
+    the index of the next draw. The payload carries whatever partial
+    results the run keeps, e.g. serialized ShardStatistics.
+*/
+struct Checkpoint {
+    Checkpoint() : fingerprint(0), rng(0), seed(0), next(0), rows(0) {}
+    std::uint64_t fingerprint;  // of the run configuration, see Fingerprint
+    std::uint32_t rng;
+    std::uint64_t seed;
+    std::uint64_t next;         // sequence index of the next path
+    std::uint64_t rows;         // rows of the run done
+    std::string payload;
+
+    std::string serialize() const;
+    //! false if bytes are not a whole checkpoint
+    static bool deserialize(const std::string& bytes, Checkpoint& result);
+};
+
+namespace checkpoint_detail {
+
+    const char magic[4] = { 'M', 'C', 'C', 'K' };
+    const std::uint32_t version = 1;
+
+    template <class T>
+    inline void put(std::string& out, const T& value) {
+        out.append((const char*)&value, sizeof(T));
+    }
+    template <class T>
+    inline bool get(const std::string& in, Size& pos, T& value) {
+        if (pos + sizeof(T) > in.size())
+            return false;
+        std::memcpy(&value, in.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    inline bool readFile(const std::string& file, std::string& bytes) {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        if (!in)
+            return false;
+        std::ostringstream buffer;
+        buffer << in.rdbuf();
+        bytes = buffer.str();
+        return true;
+    }
+
+}
+
+inline std::string Checkpoint::serialize() const
+{
+    using namespace checkpoint_detail;
+    std::string out(magic, 4);
+    put(out, version);
+    put(out, fingerprint);
+    put(out, rng);
+    put(out, seed);
+    put(out, next);
+    put(out, rows);
+    put(out, (std::uint64_t)payload.size());
+    out += payload;
+    // a torn write fails the checksum
+    Fingerprint checksum;
+    checksum.add(out.data(), out.size());
+    put(out, checksum.value());
+    return out;
+}
+
+inline bool Checkpoint::deserialize(const std::string& bytes, Checkpoint& result)
+{
+    using namespace checkpoint_detail;
+    if (bytes.size() < 4 + sizeof(std::uint64_t) || std::memcmp(bytes.data(), magic, 4) != 0)
+        return false;
+    Fingerprint checksum;
+    checksum.add(bytes.data(), bytes.size() - sizeof(std::uint64_t));
+    std::uint64_t stored;
+    std::memcpy(&stored, bytes.data() + bytes.size() - sizeof(std::uint64_t), sizeof(std::uint64_t));
+    if (stored != checksum.value())
+        return false;
+    Size pos = 4;
+    std::uint32_t v;
+    std::uint64_t size;
+    Checkpoint cp;
+    if (!get(bytes, pos, v) || v != version)
+        return false;
+    if (!get(bytes, pos, cp.fingerprint) || !get(bytes, pos, cp.rng) || !get(bytes, pos, cp.seed)
+        || !get(bytes, pos, cp.next) || !get(bytes, pos, cp.rows) || !get(bytes, pos, size)
+        || pos + size + sizeof(std::uint64_t) != bytes.size())
+        return false;
+    cp.payload = bytes.substr(pos, (Size)size);
+    result = cp;
+    return true;
+}
+
+//! replaces file with the checkpoint
+/*! The checkpoint goes to file.tmp first and is then renamed over file,
+    so a kill at any point leaves a whole checkpoint in one of the two.
+*/
+inline void WriteCheckpoint(const std::string& file, const Checkpoint& cp)
+{
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        QL_REQUIRE(out, "cannot open checkpoint file " << tmp);
+        std::string bytes = cp.serialize();
+        out.write(bytes.data(), bytes.size());
+        out.close();
+        QL_REQUIRE(!out.fail(), "cannot write checkpoint file " << tmp);
+    }
+#if defined(_WIN32)
+    QL_REQUIRE(MoveFileExA(tmp.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH),
+               "cannot replace checkpoint file " << file);
+#else
+    QL_REQUIRE(std::rename(tmp.c_str(), file.c_str()) == 0, "cannot replace checkpoint file " << file);
+#endif
+}
+
+//! the latest whole checkpoint in file or file.tmp, false if there is none
+inline bool ReadCheckpoint(const std::string& file, Checkpoint& result)
+{
+    std::string bytes;
+    Checkpoint saved, pending;
+    bool has_saved = checkpoint_detail::readFile(file, bytes) && Checkpoint::deserialize(bytes, saved);
+    bool has_pending = checkpoint_detail::readFile(file + ".tmp", bytes) && Checkpoint::deserialize(bytes, pending);
+    if (has_pending && (!has_saved || pending.rows > saved.rows))
+        result = pending;
+    else if (has_saved)
+        result = saved;
+    return has_saved || has_pending;
+}
+
+//! removes a checkpoint once its run has completed
+inline void RemoveCheckpoint(const std::string& file)
+{
+    std::remove(file.c_str());
+    std::remove((file + ".tmp").c_str());
+}
@@ -13,27 +13,30 @@
 #include <ql/processes/all.hpp>
 #include <ql/time/all.hpp>
 
+#include <Checkpoint.h>
+#include <GeometricAsian.h>
+#include <JumpDiffusion.h>
+#include <LongstaffSchwartz.h>
+#include <MarketData.h>
+#include <MultilevelMC.h>
 #include <MyPathGenerator.h>
+#include <PathArchive.h>
+#include <PathEngine.h>
+#include <PathJob.h>
+#include <PathProfiler.h>
+#include <PathWriters.h>
+#include <PayoffScript.h>
+#include <PhiloxRsg.h>
+#include <ShardStatistics.h>
+#include <SnowballPricer.h>
+#include <SnowballFD.h>
+#include <SnowballSummary.h>
+#include <ScenarioGrid.h>
+#include <StridedArray.h>
 
 namespace py = pybind11;
 using namespace QuantLib;
 
-typedef enum IRType {
-    FlatRateCurve, SpotRateCurve, ForwardRateCurve, DiscountFactorCurve
-};
-typedef enum VolType{
-    FlatVolCurve, SpotVolCurve
-};
-typedef enum ProcType{
-    BS, BSM
-};
-typedef enum DCType {
-    A365, AA, A360, F360
-};
-typedef enum BarType {
-    NoBarrier,ConstBarrier,NonConstBarrier
-};
-
 Date _ParseDate(py::tuple date) 
 {
     return(Date((Day)date[0].cast<int>(),
@@ -42,116 +45,399 @@ Date _ParseDate(py::tuple date)
         );
 }
 
-DayCounter _MakeDC(int dc_enum)
-{
-    switch (dc_enum) {
-    case A365:
-        return(Actual365Fixed());
-    case AA:
-        return(ActualActual());
-    case A360:
-        return(Actual360());
-    case F360:
-        return(Thirty360());
-    default:
-        throw std::invalid_argument("DayCounter type is not surppoted.");
-    }
-}
-
-std::vector<Date> _Date2Vec(Date today, py::array_t<int>& input) 
+template<class OutType>
+std::vector<OutType> _Data2Vec(py::array_t<double>& input) 
 {
     auto r = input.unchecked<1>();
-    std::vector<Date> result;
+    std::vector<OutType> result;
     for (int i = 0; i < r.shape(0); i++)
-        result.push_back(today + r(i) * Days);
+        result.push_back((OutType)r(i));
     return(result);
 }
 
-template<class OutType>
-std::vector<OutType> _Data2Vec(py::array_t<double>& input) 
+std::vector<char> _Flag2Vec(py::array_t<bool>& input)
 {
     auto r = input.unchecked<1>();
-    std::vector<OutType> result;
+    std::vector<char> result;
     for (int i = 0; i < r.shape(0); i++)
-        result.push_back((OutType)r(i));
+        result.push_back(r(i) ? 1 : 0);
     return(result);
 }
 
-Handle<YieldTermStructure> _MakeIRCurve(Date today, int ir_type, py::array_t<int>& ir_term, py::array_t<double>& ir_data, int ir_dc)
-{
-    std::vector<Date> ir_term_vec(_Date2Vec(today, ir_term));
-    std::vector<double> ir_data_vec(_Data2Vec<double>(ir_data));
-    DayCounter dc = _MakeDC(ir_dc);
-
-    Handle<YieldTermStructure> ir_curve;
-    auto ir_arr = ir_data.unchecked<1>();
-    switch (ir_type) {
-    case FlatRateCurve:
-        //std::cout << "Making FlatForward "<< (Rate)ir_arr(0) <<" at "<< today << std::endl;
-        ir_curve = Handle<YieldTermStructure>(
-            ext::shared_ptr<YieldTermStructure>(
-                new FlatForward(today, (Rate)ir_arr(0), dc)
-                )
-            );
-        break;
-    case SpotRateCurve:
-        //std::cout << "Making SpotCurve " << (Rate)ir_arr(0) << " at " << today << std::endl;
-        ir_curve = Handle<YieldTermStructure>(
-            ext::shared_ptr<YieldTermStructure>(
-                new InterpolatedZeroCurve<Linear>(ir_term_vec, ir_data_vec, dc, Linear())
-                )
-            );
-        break;
-    case ForwardRateCurve:
-        //std::cout << "Making ForwardCurve " << (Rate)ir_arr(0) << " at " << today << std::endl;
-        ir_curve = Handle<YieldTermStructure>(
-            ext::shared_ptr<YieldTermStructure>(
-                new InterpolatedForwardCurve<Linear>(ir_term_vec, ir_data_vec, dc, Linear())
-                )
-            );
-        break;
-    case DiscountFactorCurve:
-        //std::cout << "Making DiscountCurve " << (Rate)ir_arr(0) << " at " << today << std::endl;
-        ir_curve = Handle<YieldTermStructure>(
-            ext::shared_ptr<YieldTermStructure>(
-                new InterpolatedDiscountCurve<Linear>(ir_term_vec, ir_data_vec, dc, Linear())
-                )
-            );
-        break;
-    default:
-        throw std::invalid_argument("IR curve type is not surppoted.");
+template<class T>
+void _HashArray(Fingerprint& fp, py::array_t<T>& input)
+{
+    auto r = input.template unchecked<1>();
+    fp.add((std::uint64_t)r.shape(0));
+    for (ssize_t i = 0; i < r.shape(0); i++)
+        fp.add((T)r(i));
+}
+
+// the first rows of a per-path array as raw bytes, for checkpoint payloads
+template <class T>
+void _PutRows(std::string& out, const py::array_t<T>& input, ssize_t rows)
+{
+    out.append(reinterpret_cast<const char*>(input.data()), (Size)rows * sizeof(T));
+}
+
+template <class T>
+void _GetRows(const std::string& in, Size& pos, py::array_t<T>& output, ssize_t rows)
+{
+    std::memcpy(output.mutable_data(), in.data() + pos, (Size)rows * sizeof(T));
+    pos += (Size)rows * sizeof(T);
+}
+
+template <class T>
+void _HashVector(Fingerprint& fp, const std::vector<T>& input)
+{
+    fp.add((std::uint64_t)input.size());
+    for (Size i = 0; i < input.size(); i++)
+        fp.add(input[i]);
+}
+
+CurveData _CurveData(int type, py::array_t<int>& term, py::array_t<double>& data, int dc)
+{
+    auto r = term.unchecked<1>();
+    std::vector<int> days;
+    for (ssize_t i = 0; i < r.shape(0); i++)
+        days.push_back(r(i));
+    return CurveData(type, days, _Data2Vec<Real>(data), dc);
+}
+
+// A view of a 2-d numpy array for the core, strides in elements.
+template <class T, class U>
+StridedArray<T, 2> _View2d(py::array_t<U>& input, T* data)
+{
+    QL_REQUIRE(input.ndim() == 2, "array must be 2-d");
+    return StridedArray<T, 2>(data, input.shape(0), input.shape(1),
+        input.strides(0) / (ssize_t)sizeof(U), input.strides(1) / (ssize_t)sizeof(U));
+}
+
+// Merton takes jumps = [intensity, mean, std] of the log jump, Bates also
+// heston = [v0, kappa, theta, sigma, rho].
+void _MakeJumpModel(int proc_type, py::object& jumps, py::object& heston,
+    MertonJumps& jump_model, HestonVariance& heston_model)
+{
+    QL_REQUIRE(!jumps.is_none(), "jumps = [intensity, mean, std] is needed for jump processes");
+    py::array_t<double> jump_arr(jumps.cast<py::array_t<double>>());
+    std::vector<Real> j(_Data2Vec<Real>(jump_arr));
+    QL_REQUIRE(j.size() == 3, "jumps must be [intensity, mean, std]");
+    jump_model.intensity = j[0];
+    jump_model.mean = j[1];
+    jump_model.stdDev = j[2];
+    if (proc_type == Bates)
+    {
+        QL_REQUIRE(!heston.is_none(), "heston = [v0, kappa, theta, sigma, rho] is needed for Bates");
+        py::array_t<double> heston_arr(heston.cast<py::array_t<double>>());
+        std::vector<Real> h(_Data2Vec<Real>(heston_arr));
+        QL_REQUIRE(h.size() == 5, "heston must be [v0, kappa, theta, sigma, rho]");
+        HestonVariance v = { h[0], h[1], h[2], h[3], h[4] };
+        heston_model = v;
     }
-    return(ir_curve);
-}
-
-Handle<BlackVolTermStructure> _MakeVolCurve(Date today, int vol_type, py::array_t<int>& vol_term, py::array_t<double>& vol_data, int vol_dc) {
-    std::vector<Date> vol_term_vec(_Date2Vec(today, vol_term));
-    std::vector<double> vol_data_vec(_Data2Vec<double>(vol_data));
-    DayCounter dc = _MakeDC(vol_dc);
-
-    Handle<BlackVolTermStructure> vol_curve;
-    auto vol_arr = vol_data.unchecked<1>();
-    switch (vol_type) {
-    case FlatVolCurve:
-        //std::cout << "Making FlatVol " << (Volatility)vol_arr(0) << " at " << today << std::endl;
-        vol_curve = Handle<BlackVolTermStructure>(
-            ext::shared_ptr<BlackVolTermStructure>(
-                new BlackConstantVol(today, NullCalendar(), (Volatility)vol_arr(0), dc)
-                )
-            );
-        break;
-    case SpotVolCurve:
-        //std::cout << "Making VolCurve " << (Volatility)vol_arr(0) << " at " << today << std::endl;
-        vol_curve = Handle<BlackVolTermStructure>(
-            ext::shared_ptr<BlackVolTermStructure>(
-                new BlackVarianceCurve(today,vol_term_vec, vol_data_vec, dc)
-                )
-            );
-        break;
-    default:
-        throw std::invalid_argument("Vol curve type is not surppoted.");
+}
+
+// HullWhite takes hull_white = [a, sigma, rho] of the short rate.
+HullWhiteRates _MakeHullWhite(py::object& hull_white)
+{
+    QL_REQUIRE(!hull_white.is_none(), "hull_white = [a, sigma, rho] is needed for proc_type=HullWhite");
+    py::array_t<double> hw_arr(hull_white.cast<py::array_t<double>>());
+    std::vector<Real> p(_Data2Vec<Real>(hw_arr));
+    QL_REQUIRE(p.size() == 3, "hull_white must be [a, sigma, rho]");
+    HullWhiteRates rates = { p[0], p[1], p[2] };
+    return rates;
+}
+
+void _ProfileDict(const PathProfiler& profiler, py::dict result)
+{
+    py::dict seconds;
+    for (Size k = 0; k < PhaseCount; k++)
+        seconds[ProfilePhaseName(k)] = profiler.seconds(k);
+    const std::vector<std::uint64_t>& up = profiler.upOutHistogram();
+    const std::vector<std::uint64_t>& down = profiler.downOutHistogram();
+    const std::vector<std::uint64_t>& ki = profiler.knockInHistogram();
+    py::array_t<long long> up_out((ssize_t)up.size()), down_out((ssize_t)up.size()), knock_in((ssize_t)up.size());
+    auto up_arr = up_out.mutable_unchecked<1>();
+    auto down_arr = down_out.mutable_unchecked<1>();
+    auto ki_arr = knock_in.mutable_unchecked<1>();
+    for (size_t i = 0; i < up.size(); i++) {
+        up_arr(i) = (long long)up[i];
+        down_arr(i) = (long long)down[i];
+        ki_arr(i) = (long long)ki[i];
+    }
+    result["clock"] = std::string(profiler.clock());
+    result["seconds"] = seconds;
+    result["paths"] = profiler.paths();
+    result["steps"] = profiler.steps();
+    result["up_out"] = up_out;
+    result["down_out"] = down_out;
+    result["knock_in"] = knock_in;
+}
+
+ext::shared_ptr<GeneralizedBlackScholesProcess> _MakeProcess(Date today,
+        int ir_type,  py::array_t<int>& ir_term,  py::array_t<double>& ir_data,  int ir_dc,
+        int d_type,   py::array_t<int>& d_term,   py::array_t<double>& d_data,   int d_dc,
+        int vol_type, py::array_t<int>& vol_term, py::array_t<double>& vol_data, int vol_dc,
+        int proc_type, double spot = 1.0, double rate_shift = 0.0, double vol_shift = 0.0)
+{
+    CurveData d;
+    if (proc_type == BSM)
+        d = _CurveData(d_type, d_term, d_data, d_dc);
+    return _MakeProcess(today, _CurveData(ir_type, ir_term, ir_data, ir_dc), d,
+                        _CurveData(vol_type, vol_term, vol_data, vol_dc),
+                        proc_type, spot, rate_shift, vol_shift);
+}
+
+// Ctrl-C raises the KeyboardInterrupt PyErr_CheckSignals has set
+#define CHECK_INTERRUPT(row)                                                                    \
+    if (row % 10000 == 0 && PyErr_CheckSignals() != 0)                                          \
+        throw py::error_already_set();
+
+//===================
+// Path Generation
+//===================
+
+// The arguments of GeneratePath, checked and converted once into a
+// PathRun over the numpy buffers, see PathEngine.h. The task keeps the
+// numpy arrays alive; run() never calls into Python.
+class PathTask {
+public:
+    PathTask(py::tuple today, int num, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int upout_type,   py::array_t<bool> upout_ob,   py::array_t<double> upout_barrier,
+        int downout_type, py::array_t<bool> downout_ob, py::array_t<double> downout_barrier,
+        int proc_type,  py::array_t<double> output_matrix,
+        bool bb, int skip, int seed, int rng,
+        py::object normals, int row_mode,
+        int ki_type, py::object ki_ob, py::object ki_barrier,
+        py::object events, int layout,
+        double is_shift, int strata, py::object weights,
+        py::object jumps, py::object heston,
+        py::object hull_white, py::object discounts,
+        py::object profile, std::string trace_file,
+        int construction, int pca_nodes);
+
+    //! generates rows [first, first+count) until stop(row), returns the rows done
+    template <class Stop>
+    Size run(ssize_t first, ssize_t count, PathProfiler& path_profiler, Stop stop) {
+        return run_->run(first, count, path_profiler, stop);
+    }
+    //! fills events, profile and trace_file, with the profilers of all runs merged into profiler()
+    void finish();
+    //! events of rows [0, rows) as a checkpoint payload, empty without events
+    std::string saveEvents(ssize_t rows) const;
+    //! restores the events of rows [0, rows) from saveEvents
+    void loadEvents(const std::string& payload, ssize_t rows);
+
+    int num() const { return num_; }
+    int steps() const { return steps_; }
+    //! of everything that decides the rows, for checkpoints
+    std::uint64_t fingerprint() const { return fingerprint_; }
+    bool profiled() const { return want_profile_; }
+    PathProfiler& profiler() { return profiler_; }
+    py::array_t<double>& output() { return output_matrix_; }
+private:
+    int num_, steps_;
+    bool want_events_, want_profile_;
+    py::array_t<double> output_matrix_, normals_matrix_, weight_vector_, discount_matrix_;
+    py::array_t<long long> ko_step_, ki_step_;
+    py::array_t<double> ko_level_;
+    py::array_t<bool> ki_flag_;
+    py::object events_, profile_;
+    std::string trace_file_;
+    PathProfiler profiler_;
+    std::uint64_t fingerprint_;
+    std::unique_ptr<PathRun> run_;
+};
+
+PathTask::PathTask(py::tuple today, int num, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int upout_type,   py::array_t<bool> upout_ob,   py::array_t<double> upout_barrier,
+        int downout_type, py::array_t<bool> downout_ob, py::array_t<double> downout_barrier,
+        int proc_type,  py::array_t<double> output_matrix,
+        bool bb, int skip, int seed, int rng,
+        py::object normals, int row_mode,
+        int ki_type, py::object ki_ob, py::object ki_barrier,
+        py::object events, int layout,
+        double is_shift, int strata, py::object weights,
+        py::object jumps, py::object heston,
+        py::object hull_white, py::object discounts,
+        py::object profile, std::string trace_file,
+        int construction, int pca_nodes)
+    : num_(num), steps_(steps), output_matrix_(output_matrix), events_(events), profile_(profile),
+    trace_file_(trace_file), profiler_((Size)steps)
+{
+    // instrumentation: a dict as profile gets the stats, trace_file a JSON copy
+    want_profile_ = !profile.is_none() || !trace_file.empty();
+    std::uint64_t market_start = profiler_.start();
+
+    PathSpec spec;
+    spec.steps = steps;
+    spec.tenor = tenor;
+    spec.proc_type = proc_type;
+    spec.bb = bb;
+    spec.skip = skip;
+    spec.seed = seed;
+    spec.rng = rng;
+    spec.row_mode = row_mode;
+    spec.layout = layout;
+    spec.is_shift = is_shift;
+    spec.strata = strata;
+    spec.profile = want_profile_;
+    spec.construction = construction;
+    spec.pca_nodes = pca_nodes;
+
+    // jump and hybrid processes take rates, dividends and the diffusion vol from a BSM process
+    if (_IsJumpProcess(proc_type))
+        _MakeJumpModel(proc_type, jumps, heston, spec.jumps, spec.heston);
+    if (proc_type == HullWhite)
+        spec.hull_white = _MakeHullWhite(hull_white);
+    Date todayDate(_ParseDate(today));
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process =
+        _MakeProcess(todayDate, ir_type, ir_term, ir_data, ir_dc,
+                     d_type, d_term, d_data, d_dc,
+                     vol_type, vol_term, vol_data, vol_dc, _BaseProcess(proc_type));
+
+    spec.upout_type = upout_type;
+    spec.downout_type = downout_type;
+    spec.upout_ob = _Flag2Vec(upout_ob);
+    spec.downout_ob = _Flag2Vec(downout_ob);
+    spec.upout_barrier = _Data2Vec<Real>(upout_barrier);
+    spec.downout_barrier = _Data2Vec<Real>(downout_barrier);
+
+    // knock-in (down-in, S < barrier) is only tracked for the event arrays
+    spec.ki_type = ki_type;
+    if (ki_type != NoBarrier)
+    {
+        QL_REQUIRE(!ki_ob.is_none() && !ki_barrier.is_none(), "ki_ob and ki_barrier are needed for ki_type");
+        py::array_t<bool> ki_ob_arr(ki_ob.cast<py::array_t<bool>>());
+        py::array_t<double> ki_barrier_arr(ki_barrier.cast<py::array_t<double>>());
+        spec.ki_ob = _Flag2Vec(ki_ob_arr);
+        spec.ki_barrier = _Data2Vec<Real>(ki_barrier_arr);
+    }
+
+    PathOutputs outputs;
+    if (row_mode != NoRow)
+        outputs.paths = _View2d(output_matrix_, output_matrix_.mutable_data());
+
+    // cached normals: rows [skip, skip+num) of a GenerateRS output replace the RNG and bridge
+    bool use_normals = !normals.is_none();
+    if (use_normals)
+    {
+        normals_matrix_ = normals.cast<py::array_t<double>>();
+        outputs.normals = _View2d(normals_matrix_, normals_matrix_.data());
+    }
+
+    // importance sampling and terminal stratification; weights gets the likelihood ratios
+    if (!weights.is_none())
+    {
+        weight_vector_ = weights.cast<py::array_t<double>>();
+        QL_REQUIRE(weight_vector_.ndim() == 1 && weight_vector_.shape(0) >= num,
+            "weights must have shape (num,)");
+        outputs.weights = weight_vector_.mutable_data();
+    }
+
+    // per-path events: knock-out step (0 = none) and level, knock-in flag and first step
+    want_events_ = !events.is_none();
+    ssize_t n_events = want_events_ ? num : 0;
+    ko_step_ = py::array_t<long long>(n_events);
+    ki_step_ = py::array_t<long long>(n_events);
+    ko_level_ = py::array_t<double>(n_events);
+    ki_flag_ = py::array_t<bool>(n_events);
+    if (want_events_)
+    {
+        // rows an interrupt leaves out read as never knocked out or in
+        outputs.koStep = ko_step_.mutable_data();
+        outputs.koLevel = ko_level_.mutable_data();
+        outputs.kiFlag = ki_flag_.mutable_data();
+        outputs.kiStep = ki_step_.mutable_data();
+        std::fill(outputs.koStep, outputs.koStep + num, 0LL);
+        std::fill(outputs.koLevel, outputs.koLevel + num, std::numeric_limits<double>::quiet_NaN());
+        std::fill(outputs.kiFlag, outputs.kiFlag + num, false);
+        std::fill(outputs.kiStep, outputs.kiStep + num, 0LL);
+    }
+
+    // discount factors of each path along its row, the curve's unless rates are stochastic
+    if (!discounts.is_none())
+    {
+        discount_matrix_ = discounts.cast<py::array_t<double>>();
+        outputs.discounts = _View2d(discount_matrix_, discount_matrix_.mutable_data());
+    }
+
+    run_.reset(new PathRun(process, spec, num, outputs));
+    profiler_.lap(MarketPhase, market_start);
+
+    Fingerprint fp;
+    fp.add(todayDate.serialNumber());
+    fp.add(num); fp.add(steps); fp.add(tenor); fp.add(proc_type);
+    fp.add(bb); fp.add(skip); fp.add(seed); fp.add(rng); fp.add(use_normals);
+    fp.add(row_mode); fp.add(layout); fp.add(is_shift); fp.add(strata);
+    fp.add(ir_type); fp.add(ir_dc); _HashArray(fp, ir_term); _HashArray(fp, ir_data);
+    fp.add(d_type);  fp.add(d_dc);  _HashArray(fp, d_term);  _HashArray(fp, d_data);
+    fp.add(vol_type); fp.add(vol_dc); _HashArray(fp, vol_term); _HashArray(fp, vol_data);
+    fp.add(upout_type); _HashArray(fp, upout_ob); _HashArray(fp, upout_barrier);
+    fp.add(downout_type); _HashArray(fp, downout_ob); _HashArray(fp, downout_barrier);
+    fp.add(ki_type); _HashVector(fp, spec.ki_ob); _HashVector(fp, spec.ki_barrier);
+    fp.add(spec.jumps); fp.add(spec.heston);
+    if (proc_type == HullWhite)
+        fp.add(spec.hull_white);
+    if (construction != FromBbFlag)
+    {
+        fp.add(construction);
+        fp.add(pca_nodes);
+    }
+    if (want_events_)
+        fp.add(want_events_);
+    fingerprint_ = fp.value();
+}
+
+std::string PathTask::saveEvents(ssize_t rows) const
+{
+    std::string out;
+    if (want_events_)
+    {
+        _PutRows(out, ko_step_, rows);
+        _PutRows(out, ko_level_, rows);
+        _PutRows(out, ki_flag_, rows);
+        _PutRows(out, ki_step_, rows);
+    }
+    return out;
+}
+
+void PathTask::loadEvents(const std::string& payload, ssize_t rows)
+{
+    Size row_bytes = want_events_ ? 2 * sizeof(long long) + sizeof(double) + sizeof(bool) : 0;
+    QL_REQUIRE(payload.size() == (Size)rows * row_bytes, "checkpoint events do not match its rows");
+    Size pos = 0;
+    if (want_events_)
+    {
+        _GetRows(payload, pos, ko_step_, rows);
+        _GetRows(payload, pos, ko_level_, rows);
+        _GetRows(payload, pos, ki_flag_, rows);
+        _GetRows(payload, pos, ki_step_, rows);
+    }
+}
+
+void PathTask::finish()
+{
+    if (want_profile_)
+    {
+        if (!trace_file_.empty())
+            profiler_.writeJson(trace_file_);
+        if (!profile_.is_none())
+            _ProfileDict(profiler_, profile_.cast<py::dict>());
+    }
+    if (want_events_)
+    {
+        py::dict event_dict(events_.cast<py::dict>());
+        event_dict["ko_step"] = ko_step_;
+        event_dict["ko_level"] = ko_level_;
+        event_dict["ki_flag"] = ki_flag_;
+        event_dict["ki_step"] = ki_step_;
     }
-    return(vol_curve);
 }
 
 py::array_t<double> GeneratePath(py::tuple today, int num, int steps, double tenor,
@@ -161,116 +447,1100 @@ py::array_t<double> GeneratePath(py::tuple today, int num, int steps, double ten
         int upout_type,   py::array_t<bool> upout_ob,   py::array_t<double> upout_barrier,
         int downout_type, py::array_t<bool> downout_ob, py::array_t<double> downout_barrier,
         int proc_type,  py::array_t<double> output_matrix,
-        bool bb = true, int skip = 0, int seed = 42)      
+        bool bb = true, int skip = 0, int seed = 42, int rng = SobolRng,
+        py::object normals = py::none(), int row_mode = FullRow,
+        int ki_type = NoBarrier, py::object ki_ob = py::none(), py::object ki_barrier = py::none(),
+        py::object events = py::none(), int layout = PathMajor,
+        double is_shift = 0.0, int strata = 1, py::object weights = py::none(),
+        py::object jumps = py::none(), py::object heston = py::none(),
+        py::object profile = py::none(), std::string trace_file = "",
+        std::string checkpoint = "", int checkpoint_every = 0,
+        py::object hull_white = py::none(), py::object discounts = py::none(),
+        int construction = FromBbFlag, int pca_nodes = 64)
+{
+    PathTask task(today, num, steps, tenor,
+        ir_type, ir_term, ir_data, ir_dc, d_type, d_term, d_data, d_dc,
+        vol_type, vol_term, vol_data, vol_dc,
+        upout_type, upout_ob, upout_barrier, downout_type, downout_ob, downout_barrier,
+        proc_type, output_matrix, bb, skip, seed, rng, normals, row_mode,
+        ki_type, ki_ob, ki_barrier, events, layout, is_shift, strata, weights,
+        jumps, heston, hull_white, discounts, profile, trace_file, construction, pca_nodes);
+
+    // with a checkpoint, rows [0, cp.rows) are already in output_matrix, which
+    // must outlive the process (np.memmap), and their events in the payload;
+    // progress is saved every checkpoint_every rows and when interrupted
+    QL_REQUIRE(checkpoint.empty() || (profile.is_none() && trace_file.empty() && weights.is_none() && discounts.is_none()),
+        "checkpoint does not keep profile, trace_file, weights or discounts");
+    ssize_t first = 0;
+    Checkpoint cp;
+    if (!checkpoint.empty() && ReadCheckpoint(checkpoint, cp))
+    {
+        QL_REQUIRE(cp.fingerprint == task.fingerprint(), "checkpoint " << checkpoint << " is of a different run");
+        first = (ssize_t)cp.rows;
+        task.loadEvents(cp.payload, first);
+    }
+    cp.fingerprint = task.fingerprint();
+    cp.rng = (std::uint32_t)rng;
+    cp.seed = (std::uint64_t)seed;
+    ssize_t every = checkpoint.empty() ? (ssize_t)num : (checkpoint_every > 0 ? checkpoint_every : 100000);
+    while (first < num)
+    {
+        ssize_t count = std::min<ssize_t>(every, num - first);
+        ssize_t done = (ssize_t)task.run(first, count, task.profiler(), [](ssize_t row) {
+            return row % 10000 == 0 && PyErr_CheckSignals() != 0;
+        });
+        first += done;
+        if (!checkpoint.empty())
+        {
+            cp.rows = (std::uint64_t)first;
+            cp.next = (std::uint64_t)(skip + first);
+            cp.payload = task.saveEvents(first);
+            WriteCheckpoint(checkpoint, cp);
+        }
+        // interrupted: the rows done are saved, raise the KeyboardInterrupt
+        if (done < count)
+            throw py::error_already_set();
+    }
+    if (!checkpoint.empty() && first == num)
+        RemoveCheckpoint(checkpoint);
+    task.finish();
+    return(output_matrix);
+}
+
+//===================
+// Asynchronous Paths
+//===================
+
+// Waits for job up to timeout seconds (forever if negative) with the GIL
+// released, checking for Ctrl-C every 100ms, which cancels the job.
+bool _WaitJob(ChunkedJob& job, double timeout = -1.0)
 {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (;;) {
+        double slice = 0.1;
+        if (timeout >= 0.0)
+            slice = std::min(slice, std::max(timeout - std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count(), 0.0));
+        bool finished;
+        {
+            py::gil_scoped_release release;
+            finished = job.wait(slice);
+        }
+        if (finished)
+            return true;
+        if (PyErr_CheckSignals() != 0) {
+            job.cancel();
+            {
+                py::gil_scoped_release release;
+                job.join();
+            }
+            throw py::error_already_set();
+        }
+        if (timeout >= 0.0 && std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count() >= timeout)
+            return false;
+    }
+}
+
+//! GeneratePath on background threads, returned to Python as a handle
+/*! ChunkedJob workers run the task's rows in chunks, each worker with its
+    own profiler, so the rows are those GeneratePath would write. Python
+    calls only read counters, or wait with the GIL released and check for
+    Ctrl-C every 100ms, which cancels the job.
+*/
+class PathJob {
+public:
+    PathJob(std::unique_ptr<PathTask> task, int threads, int chunk);
+    void cancel() { job_->cancel(); }
+    bool done() const { return job_->finished(); }
+    //! waits up to timeout seconds (forever if negative), true if done
+    bool wait(double timeout = -1.0);
+    py::dict progress() const;
+    //! waits, then the output with the rows completed and whether it was cancelled
+    py::dict result();
+private:
+    std::unique_ptr<PathTask> task_;
+    std::vector<PathProfiler> profilers_;
+    std::unique_ptr<ChunkedJob> job_;   // last, so it is joined before the rest goes
+    std::chrono::steady_clock::time_point start_;
+    bool finished_;
+};
+
+PathJob::PathJob(std::unique_ptr<PathTask> task, int threads, int chunk)
+    : task_(std::move(task)), start_(std::chrono::steady_clock::now()), finished_(false)
+{
+    QL_REQUIRE(threads >= 0 && chunk >= 0, "threads and chunk must be non-negative");
+    if (threads == 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    // chunks small enough to balance threads, large enough to amortize the generator setup
+    if (chunk == 0)
+        chunk = std::min(std::max(task_->num() / (threads * 8), 256), 65536);
+    profilers_.assign((Size)threads, PathProfiler((Size)task_->steps()));
+    PathTask* path_task = task_.get();
+    std::vector<PathProfiler>* profilers = &profilers_;
+    job_.reset(new ChunkedJob((Size)task_->num(), (Size)threads, (Size)chunk,
+        [path_task, profilers](Size first, Size count, Size worker, const std::atomic<bool>& cancel) {
+            return path_task->run((ssize_t)first, (ssize_t)count, (*profilers)[worker],
+                [&cancel](ssize_t) { return cancel.load(std::memory_order_relaxed); });
+        }));
+}
+
+bool PathJob::wait(double timeout)
+{
+    return(_WaitJob(*job_, timeout));
+}
+
+py::dict PathJob::progress() const
+{
+    Size rows = job_->completed();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    py::dict result;
+    result["rows"] = rows;
+    result["total"] = task_->num();
+    result["fraction"] = task_->num() > 0 ? (double)rows / task_->num() : 1.0;
+    result["seconds"] = seconds;
+    result["rows_per_sec"] = seconds > 0.0 ? rows / seconds : 0.0;
+    result["threads"] = job_->threads();
+    result["cancelled"] = job_->cancelled();
+    result["done"] = job_->finished();
+    return result;
+}
+
+py::dict PathJob::result()
+{
+    wait();
+    {
+        py::gil_scoped_release release;
+        job_->join();
+    }
+    if (job_->error())
+        std::rethrow_exception(job_->error());
+    if (!finished_) {
+        if (task_->profiled())
+            for (Size t = 0; t < profilers_.size(); t++)
+                task_->profiler().merge(profilers_[t]);
+        task_->finish();
+        finished_ = true;
+    }
+    // rows of each chunk are done in order from its first row
+    py::array_t<bool> done_mask(task_->num());
+    auto arr_done = done_mask.mutable_unchecked<1>();
+    const std::vector<Size>& chunk_rows = job_->chunkRows();
+    for (Size c = 0; c < chunk_rows.size(); c++)
+        for (Size i = 0; i < job_->chunk() && c * job_->chunk() + i < (Size)task_->num(); i++)
+            arr_done(c * job_->chunk() + i) = i < chunk_rows[c];
+    Size rows = job_->completed();
+    py::dict result;
+    result["paths"] = task_->output();
+    result["rows"] = rows;
+    result["valid_rows"] = job_->validRows();
+    result["done_mask"] = done_mask;
+    result["cancelled"] = rows < (Size)task_->num();
+    return result;
+}
+
+std::unique_ptr<PathJob> GeneratePathAsync(py::tuple today, int num, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int upout_type,   py::array_t<bool> upout_ob,   py::array_t<double> upout_barrier,
+        int downout_type, py::array_t<bool> downout_ob, py::array_t<double> downout_barrier,
+        int proc_type,  py::array_t<double> output_matrix,
+        bool bb = true, int skip = 0, int seed = 42, int rng = SobolRng,
+        py::object normals = py::none(), int row_mode = FullRow,
+        int ki_type = NoBarrier, py::object ki_ob = py::none(), py::object ki_barrier = py::none(),
+        py::object events = py::none(), int layout = PathMajor,
+        double is_shift = 0.0, int strata = 1, py::object weights = py::none(),
+        py::object jumps = py::none(), py::object heston = py::none(),
+        py::object profile = py::none(), std::string trace_file = "",
+        int threads = 0, int chunk = 0,
+        py::object hull_white = py::none(), py::object discounts = py::none(),
+        int construction = FromBbFlag, int pca_nodes = 64)
+{
+    std::unique_ptr<PathTask> task(new PathTask(today, num, steps, tenor,
+        ir_type, ir_term, ir_data, ir_dc, d_type, d_term, d_data, d_dc,
+        vol_type, vol_term, vol_data, vol_dc,
+        upout_type, upout_ob, upout_barrier, downout_type, downout_ob, downout_barrier,
+        proc_type, output_matrix, bb, skip, seed, rng, normals, row_mode,
+        ki_type, ki_ob, ki_barrier, events, layout, is_shift, strata, weights,
+        jumps, heston, hull_white, discounts, profile, trace_file, construction, pca_nodes));
+    return std::unique_ptr<PathJob>(new PathJob(std::move(task), threads, chunk));
+}
+
+
+void GenerateRS(int num, int steps, double tenor, py::array_t<double> output_matrix, bool bb=true, int skip = 0, int seed=42, int rng = SobolRng,
+        int layout = PathMajor, int construction = FromBbFlag, int pca_nodes = 64)
+{
+    StridedArray<double, 2> arr(_View2d(output_matrix, output_matrix.mutable_data()));
+    _CheckLayout(arr.shape(0), arr.shape(1), layout, num, steps);
+    bool column_contiguous = arr.columnContiguous();
+    // no process here, so a PCA is on calendar time
+    _CheckConstruction(construction);
+    ext::shared_ptr<PcaConstruction> pca;
+    if (construction == PcaPath)
+        pca = _MakePca(ext::shared_ptr<GeneralizedBlackScholesProcess>(), tenor, steps, pca_nodes);
+
+    _WithSequenceGenerator(rng, (Size)steps, seed, skip, [&](auto& rsg) {
+        typedef typename std::decay<decltype(rsg)>::type RSGType;
+        MyRandomSequenceGenerator<RSGType> generator((Time)tenor, (Size)steps, rsg, _UseBridge(construction, bb));
+        generator.set_construction(pca);
+
+        _WithRowWriter(FullRow, layout, column_contiguous, arr, steps, [&](auto& writer) {
+            for (ssize_t row = 0; row < num; row++)
+            {
+                CHECK_INTERRUPT(row)
+                generator.gen_bm();
+                writer.row((Size)row);
+                generator.write_bm(writer);
+            }
+            writer.flush();
+        });
+    });
+}
+
+
+//===================
+// Sharded Pricing
+//===================
+
+std::vector<Real> _MakeDiscounts(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process, int steps, double tenor)
+{
+    TimeGrid grid((Time)tenor, (Size)steps);
+    std::vector<Real> discount(grid.size());
+    for (Size i = 0; i < grid.size(); i++)
+        discount[i] = process->riskFreeRate()->discount(grid[i]);
+    return(discount);
+}
+
+SnowballPathPricer _MakeSnowball(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+        int steps, double tenor, py::array_t<double>& coupon,
+        py::array_t<bool>& call_ob, py::array_t<double>& call_barrier,
+        py::array_t<bool>& ki_ob,   py::array_t<double>& ki_barrier,
+        double min_value, double max_value)
+{
+    std::vector<Real> discount(_MakeDiscounts(process, steps, tenor));
+    return(SnowballPathPricer(_Data2Vec<Real>(coupon),
+        _Flag2Vec(call_ob), _Data2Vec<Real>(call_barrier),
+        _Flag2Vec(ki_ob), _Data2Vec<Real>(ki_barrier),
+        min_value, max_value, discount));
+}
+
+py::bytes PriceSnowballShard(py::tuple today, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, py::array_t<double> coupon,
+        py::array_t<bool> call_ob, py::array_t<double> call_barrier,
+        py::array_t<bool> ki_ob,   py::array_t<double> ki_barrier,
+        double min_value, double max_value,
+        long long first_path, long long count,
+        bool bb = true, int seed = 42, int rng = SobolRng,
+        double is_shift = 0.0, int strata = 1, py::object hull_white = py::none(),
+        int construction = FromBbFlag, int pca_nodes = 64)
+{
+    QL_REQUIRE(first_path >= 0 && count >= 0, "negative path range");
+    QL_REQUIRE(proc_type == BS || proc_type == BSM || proc_type == HullWhite, "Process type is not surppoted.");
+    _CheckConstruction(construction);
+    _CheckStrata(strata, rng, _UseBridge(construction, bb));
+    bool hybrid = (proc_type == HullWhite);
+    QL_REQUIRE(!hybrid || construction != PcaPath, "PCA construction cannot be used with stochastic rates");
+    HullWhiteRates rates = { 0.0, 0.0, 0.0 };
+    if (hybrid)
+        rates = _MakeHullWhite(hull_white);
     Date todayDate(_ParseDate(today));
-    
-    Handle<Quote> S0(ext::shared_ptr<Quote>(new SimpleQuote(1.0)));
-
-    //std::cout << "Making IR Curve "<< std::endl;
-    Handle<YieldTermStructure> ir_curve(_MakeIRCurve(todayDate,ir_type,ir_term,ir_data,ir_dc));
-    //std::cout << "Making Vol Curve " << std::endl;
-    Handle<BlackVolTermStructure> vol_curve(_MakeVolCurve(todayDate, vol_type, vol_term, vol_data, vol_dc));
-    
-    //std::cout << "Making Process " << std::endl;
-    ext::shared_ptr<GeneralizedBlackScholesProcess> process;
-    if (proc_type == BSM)
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process(
+        _MakeProcess(todayDate, ir_type, ir_term, ir_data, ir_dc,
+                     d_type, d_term, d_data, d_dc,
+                     vol_type, vol_term, vol_data, vol_dc, _BaseProcess(proc_type)));
+    SnowballPathPricer pricer(_MakeSnowball(process, steps, tenor, coupon,
+        call_ob, call_barrier, ki_ob, ki_barrier, min_value, max_value));
+
+    // everything except the path range must agree between shards
+    Fingerprint fp;
+    fp.add(todayDate.serialNumber());
+    fp.add(steps); fp.add(tenor); fp.add(proc_type);
+    fp.add(bb); fp.add(seed); fp.add(rng);
+    fp.add(ir_type); fp.add(ir_dc); _HashArray(fp, ir_term); _HashArray(fp, ir_data);
+    fp.add(d_type);  fp.add(d_dc);  _HashArray(fp, d_term);  _HashArray(fp, d_data);
+    fp.add(vol_type); fp.add(vol_dc); _HashArray(fp, vol_term); _HashArray(fp, vol_data);
+    _HashArray(fp, coupon);
+    _HashArray(fp, call_ob); _HashArray(fp, call_barrier);
+    _HashArray(fp, ki_ob);   _HashArray(fp, ki_barrier);
+    fp.add(min_value); fp.add(max_value);
+    fp.add(is_shift); fp.add(strata);
+    if (hybrid)
+        fp.add(rates);
+    if (construction != FromBbFlag)
     {
-        Handle<YieldTermStructure> d_curve = _MakeIRCurve(todayDate, d_type, d_term, d_data, d_dc);
-        process = ext::shared_ptr<GeneralizedBlackScholesProcess>(
-            new BlackScholesMertonProcess(S0, d_curve, ir_curve, vol_curve)
-            );
+        fp.add(construction);
+        fp.add(pca_nodes);
     }
-    else if (proc_type == BS)
+    ext::shared_ptr<PcaConstruction> pca;
+    if (construction == PcaPath)
+        pca = _MakePca(process, tenor, steps, pca_nodes);
+
+    ShardStatistics stats(fp.value(), pricer.size(), (Size)strata);
+    ssize_t done = 0;
+    auto price = [&](auto& generator) {
+        generator.set_drift_shift(_DriftShift(steps, tenor, is_shift));
+
+        for (ssize_t row = 0; row < count; row++)
+        {
+            CHECK_INTERRUPT(row)
+            Size stratum = (Size)((first_path + row) % strata);
+            if (strata > 1)
+                generator.set_stratum(stratum, (Size)strata);
+            generator.gen_bm();
+            Real value = generator.price_next(pricer) * generator.weight();
+            stats.add(value, pricer.callStep(), pricer.knockInStep(), stratum);
+            done = row + 1;
+        }
+    };
+    _WithSequenceGenerator(rng, _PathDimension(proc_type, steps), seed, (BigNatural)first_path, [&](auto& rsg) {
+        typedef typename std::decay<decltype(rsg)>::type RSGType;
+        if (hybrid) {
+            // flows are discounted along each path
+            HullWhiteHybridPathGenerator<RSGType> generator(process, TimeGrid((Time)tenor, (Size)steps), rsg,
+                _UseBridge(construction, bb), rates);
+            pricer.setPathDiscount(&generator.discount()[0]);
+            price(generator);
+            pricer.setPathDiscount(0);
+        }
+        else {
+            MyPathGenerator<RSGType> generator(process, (Time)tenor, (Size)steps, rsg, _UseBridge(construction, bb));
+            generator.set_construction(pca);
+            price(generator);
+        }
+    });
+    // an interrupted shard still covers the paths it has finished
+    stats.cover((std::uint64_t)first_path, (std::uint64_t)done);
+    return(py::bytes(stats.serialize()));
+}
+
+py::bytes MergeShards(py::list shards)
+{
+    QL_REQUIRE(shards.size() > 0, "no shards to merge");
+    ShardStatistics result(ShardStatistics::deserialize(shards[0].cast<std::string>()));
+    for (size_t i = 1; i < shards.size(); i++)
+        result.merge(ShardStatistics::deserialize(shards[i].cast<std::string>()));
+    return(py::bytes(result.serialize()));
+}
+
+// PriceSnowballShard over [0, num) in shards of checkpoint_every paths,
+// the merged shard saved after each; exact sums make the result the same
+// bytes as one uninterrupted shard, however often the run was resumed.
+py::bytes PriceSnowballCheckpointed(py::tuple today, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, py::array_t<double> coupon,
+        py::array_t<bool> call_ob, py::array_t<double> call_barrier,
+        py::array_t<bool> ki_ob,   py::array_t<double> ki_barrier,
+        double min_value, double max_value,
+        long long num, std::string checkpoint, long long checkpoint_every = 100000,
+        bool bb = true, int seed = 42, int rng = SobolRng,
+        double is_shift = 0.0, int strata = 1, py::object hull_white = py::none(),
+        int construction = FromBbFlag, int pca_nodes = 64)
+{
+    QL_REQUIRE(num >= 0 && checkpoint_every > 0, "num must be non-negative and checkpoint_every positive");
+    auto shard = [&](long long first_path, long long count) {
+        return ShardStatistics::deserialize(PriceSnowballShard(today, steps, tenor,
+            ir_type, ir_term, ir_data, ir_dc, d_type, d_term, d_data, d_dc,
+            vol_type, vol_term, vol_data, vol_dc, proc_type, coupon,
+            call_ob, call_barrier, ki_ob, ki_barrier, min_value, max_value,
+            first_path, count, bb, seed, rng, is_shift, strata, hull_white,
+            construction, pca_nodes).cast<std::string>());
+    };
+    // an empty shard carries the fingerprint of the run
+    ShardStatistics stats(shard(0, 0));
+    Checkpoint cp;
+    if (ReadCheckpoint(checkpoint, cp))
+    {
+        QL_REQUIRE(cp.fingerprint == stats.fingerprint() && cp.rows <= (std::uint64_t)num,
+            "checkpoint " << checkpoint << " is of a different run");
+        stats = ShardStatistics::deserialize(cp.payload);
+    }
+    cp.fingerprint = stats.fingerprint();
+    cp.rng = (std::uint32_t)rng;
+    cp.seed = (std::uint64_t)seed;
+    long long first = (long long)cp.rows;
+    while (first < num)
     {
-        process = ext::shared_ptr<GeneralizedBlackScholesProcess>(
-            new BlackScholesProcess(S0, ir_curve, vol_curve)
-            );
+        long long count = std::min(checkpoint_every, num - first);
+        ShardStatistics part(shard(first, count));
+        stats.merge(part);
+        first += (long long)part.count();
+        cp.rows = cp.next = (std::uint64_t)first;
+        cp.payload = stats.serialize();
+        WriteCheckpoint(checkpoint, cp);
     }
-    else
-        throw std::invalid_argument("Process type is not surppoted.");
-
-    typedef LowDiscrepancy::rsg_type RSGType;
-    //typedef MyPathGenerator<LowDiscrepancy>::sample_type PathType;
-    RSGType rsg = LowDiscrepancy::make_sequence_generator((Size)steps, seed);
-
-    //std::cout << "Making Generator " << std::endl;
-    MyPathGenerator<RSGType> generator(process, (Time)tenor, (Size)steps, rsg, bb);
-    
-    for (int i = 0; i < skip; i++)
-        generator.gen_bm();
-        //generator.next();
-
-    #define CHECK_INTERRUPT(row)                                                                \
-        if (row % 10000 == 0 && PyErr_CheckSignals() != 0)                                      \
-        {                                                                                       \
-            std::cout << "MC simulation stopped. " << row << " paths are made." << std::endl;   \
-            break;                                                                              \
-        } 
-
-    #define COPY_PATH(METHOD_NAME,...)                                                          \
-        for (ssize_t row = 0; row < num; row++)                                                 \
-        {                                                                                       \
-            CHECK_INTERRUPT(row)                                                                \
-            generator.gen_bm();                                                                 \
-            generator.METHOD_NAME(arr, row, ##__VA_ARGS__);                                     \
+    RemoveCheckpoint(checkpoint);
+    return(py::bytes(stats.serialize()));
+}
+
+py::dict ShardSummary(py::bytes shard)
+{
+    ShardStatistics stats(ShardStatistics::deserialize(shard));
+    Real n = (Real)std::max<std::uint64_t>(stats.count(), 1);
+    const std::vector<std::uint64_t>& stop = stats.stopHistogram();
+    const std::vector<std::uint64_t>& event = stats.eventHistogram();
+    py::array_t<double> stop_p((ssize_t)stop.size()), event_p((ssize_t)event.size());
+    auto stop_arr = stop_p.mutable_unchecked<1>();
+    auto event_arr = event_p.mutable_unchecked<1>();
+    for (size_t i = 0; i < stop.size(); i++) {
+        stop_arr(i) = stop[i] / n;
+        event_arr(i) = event[i] / n;
+    }
+    py::list ranges;
+    for (size_t i = 0; i < stats.ranges().size(); i++)
+        ranges.append(py::make_tuple(stats.ranges()[i].first, stats.ranges()[i].second));
+
+    py::dict result;
+    result["count"] = stats.count();
+    result["price"] = stats.mean();
+    result["error"] = stats.errorEstimate();
+    result["stop_probability"] = stop_p;
+    result["event_probability"] = event_p;
+    result["ranges"] = ranges;
+    return(result);
+}
+
+
+//===================
+// Callable Snowball
+//===================
+
+// Simulates paths [skip, skip+data.paths) of the snowball on threads and
+// records them at the exercise dates.
+void _SimulateExercise(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+        const SnowballPathPricer& pricer, int steps, double tenor, bool bb, int seed, int rng,
+        Size skip, int threads, ExerciseData& data)
+{
+    if (threads == 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    ChunkedJob job(data.paths, (Size)threads, 8192,
+        [&](Size first, Size count, Size, const std::atomic<bool>& cancel) {
+            Size done = 0;
+            _WithSequenceGenerator(rng, (Size)steps, seed, (BigNatural)(skip + first), [&](auto& rsg) {
+                typedef typename std::decay<decltype(rsg)>::type RSGType;
+                MyPathGenerator<RSGType> generator(process, (Time)tenor, (Size)steps, rsg, bb);
+                ExerciseRecorder recorder(pricer, data);
+                for (Size p = first; p < first + count && !cancel.load(std::memory_order_relaxed); p++) {
+                    generator.gen_bm();
+                    recorder.row(p);
+                    generator.price_next(recorder);
+                    recorder.store();
+                    done++;
+                }
+            });
+            return done;
+        });
+    _WaitJob(job);
+    job.join();
+    if (job.error())
+        std::rethrow_exception(job.error());
+}
+
+py::dict PriceCallableSnowball(py::tuple today, int num, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, py::array_t<double> coupon,
+        py::array_t<bool> call_ob, py::array_t<double> call_barrier,
+        py::array_t<bool> ki_ob,   py::array_t<double> ki_barrier,
+        double min_value, double max_value,
+        py::array_t<bool> exercise_ob, py::array_t<double> exercise_value,
+        bool issuer = true, int num_price = 0, int degree = 2,
+        bool bb = true, int seed = 42, int rng = SobolRng, int threads = 0)
+{
+    QL_REQUIRE(num > 0 && num_price >= 0 && degree >= 0 && threads >= 0,
+        "num must be positive, num_price, degree and threads non-negative");
+    QL_REQUIRE(proc_type == BS || proc_type == BSM, "Process type is not surppoted.");
+    Date todayDate(_ParseDate(today));
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process(
+        _MakeProcess(todayDate, ir_type, ir_term, ir_data, ir_dc,
+                     d_type, d_term, d_data, d_dc,
+                     vol_type, vol_term, vol_data, vol_dc, proc_type));
+    // the process sets up its local vol on first use; do it here, not in a worker
+    process->evolve(0.0, 1.0, tenor / steps, 0.0);
+    SnowballPathPricer pricer(_MakeSnowball(process, steps, tenor, coupon,
+        call_ob, call_barrier, ki_ob, ki_barrier, min_value, max_value));
+
+    // exercise dates and their discounted exercise amounts (paid like a coupon, on top of the notional)
+    std::vector<char> exercise_ob_vec(_Flag2Vec(exercise_ob));
+    std::vector<Real> exercise_value_vec(_Data2Vec<Real>(exercise_value));
+    QL_REQUIRE(exercise_ob_vec.size() == (Size)steps + 1 && exercise_value_vec.size() == (Size)steps + 1,
+        "exercise_ob and exercise_value must have steps+1 entries");
+    QL_REQUIRE(!exercise_ob_vec[0] && !exercise_ob_vec[steps], "exercise dates must be strictly inside the schedule");
+    std::vector<Size> dates;
+    std::vector<Real> values;
+    for (Size i = 1; i < (Size)steps; i++)
+        if (exercise_ob_vec[i]) {
+            dates.push_back(i);
+            values.push_back(exercise_value_vec[i] * pricer.discount()[i]);
         }
-    
-    auto arr = output_matrix.mutable_unchecked<2>();
-    auto arr_upout_ob = upout_ob.mutable_unchecked<1>();
-    auto arr_upout_barrier = upout_barrier.mutable_unchecked<1>();
-    auto arr_downout_ob = downout_ob.mutable_unchecked<1>();
-    auto arr_downout_barrier = downout_barrier.mutable_unchecked<1>();
-    double upout_b, downout_b;
-
-    if (upout_type == ConstBarrier)
-        upout_b = arr_upout_barrier(0);
-    if (downout_type == ConstBarrier)
-        downout_b = arr_downout_barrier(0);
-
-    //No Early Stop
-    if ((upout_type == NoBarrier) && (downout_type == NoBarrier))
-        COPY_PATH(copy_next)
-
-    //Down Out Stop Barrier
-    else if ((upout_type == NoBarrier) && (downout_type == ConstBarrier))
-        COPY_PATH(copy_next_downout, arr_upout_ob, upout_b, arr_downout_ob, downout_b)
-    else if ((upout_type == NoBarrier) && (downout_type == NonConstBarrier))
-        COPY_PATH(copy_next_downout, arr_upout_ob, arr_upout_barrier, arr_downout_ob, arr_downout_barrier)
-
-    //Up Out Stop Barrier
-    else if ((upout_type == ConstBarrier) && (downout_type == NoBarrier))
-        COPY_PATH(copy_next_upout, arr_upout_ob, upout_b, arr_downout_ob, downout_b)
-    else if ((upout_type == NonConstBarrier) && (downout_type == NoBarrier))
-        COPY_PATH(copy_next_upout, arr_upout_ob, arr_upout_barrier, arr_downout_ob, arr_downout_barrier)
-    
-    //Dual Stop Barriers
-    else if ((upout_type == ConstBarrier) && (downout_type == ConstBarrier))
-        COPY_PATH(copy_next_dualout, arr_upout_ob, upout_b, arr_downout_ob, downout_b)
-    else if ((upout_type == ConstBarrier) && (downout_type == NonConstBarrier))
-        COPY_PATH(copy_next_dualout, arr_upout_ob, upout_b, arr_downout_ob, arr_downout_barrier)
-    else if ((upout_type == NonConstBarrier) && (downout_type == ConstBarrier))
-        COPY_PATH(copy_next_dualout, arr_upout_ob, arr_upout_barrier, arr_downout_ob, downout_b)
-    else if ((upout_type == NonConstBarrier) && (downout_type == NonConstBarrier))
-        COPY_PATH(copy_next_dualout, arr_upout_ob, arr_upout_barrier, arr_downout_ob, arr_downout_barrier)
+    QL_REQUIRE(!dates.empty(), "no exercise dates");
+
+    // pass 1 fits the rule on paths [0, num); with num_price > 0, pass 2
+    // prices with it on the independent paths [num, num+num_price)
+    LongstaffSchwartz lsmc(values, (Size)degree, issuer);
+    ExerciseData fit_data(dates, (Size)num);
+    _SimulateExercise(process, pricer, steps, tenor, bb, seed, rng, 0, threads, fit_data);
+    lsmc.fit(fit_data);
+    Real in_sample = 0.0;
+    for (Size p = 0; p < fit_data.paths; p++)
+        in_sample += fit_data.cash[p];
+    in_sample /= fit_data.paths;
+
+    ExerciseData price_data(dates, 0);
+    if (num_price > 0)
+    {
+        price_data = ExerciseData(dates, (Size)num_price);
+        _SimulateExercise(process, pricer, steps, tenor, bb, seed, rng, (Size)num, threads, price_data);
+        lsmc.apply(price_data);
+    }
+    const ExerciseData& data = num_price > 0 ? price_data : fit_data;
+
+    Real sum = 0.0, sum_sq = 0.0;
+    py::array_t<double> exercise_probability(steps + 1), call_probability(steps + 1);
+    auto arr_exercise = exercise_probability.mutable_unchecked<1>();
+    auto arr_call = call_probability.mutable_unchecked<1>();
+    for (ssize_t i = 0; i <= steps; i++)
+        arr_exercise(i) = arr_call(i) = 0.0;
+    for (Size p = 0; p < data.paths; p++)
+    {
+        sum += data.cash[p];
+        sum_sq += data.cash[p] * data.cash[p];
+        if (data.exercised[p] > 0)
+            arr_exercise(data.end[p]) += 1.0 / data.paths;
+        else if (data.end[p] < (std::uint32_t)steps)
+            arr_call(data.end[p]) += 1.0 / data.paths;
+    }
+    Real n = (Real)data.paths, mean = sum / n;
+    py::array_t<double> coefficients(std::vector<ssize_t>{ (ssize_t)dates.size(), 2, (ssize_t)lsmc.basisSize() });
+    auto arr_beta = coefficients.mutable_unchecked<3>();
+    for (Size k = 0; k < dates.size(); k++)
+        for (Size g = 0; g < 2; g++)
+            for (Size j = 0; j < lsmc.basisSize(); j++)
+                arr_beta(k, g, j) = lsmc.coefficients(k, g == 1)[j];
+
+    py::dict result;
+    result["price"] = mean;
+    result["error"] = n > 1 ? std::sqrt(std::max(sum_sq / n - mean * mean, 0.0) / (n - 1.0)) : 0.0;
+    result["in_sample"] = in_sample;
+    result["exercise_probability"] = exercise_probability;
+    result["call_probability"] = call_probability;
+    result["coefficients"] = coefficients;
+    result["count"] = data.paths;
+    return(result);
+}
+
+//===================
+// Snowball PDE
+//===================
+
+py::dict PriceSnowballFD(py::tuple today, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, py::array_t<double> coupon,
+        py::array_t<bool> call_ob, py::array_t<double> call_barrier,
+        py::array_t<bool> ki_ob,   py::array_t<double> ki_barrier,
+        double min_value, double max_value,
+        int x_nodes = 801, int substeps = 4, int damping_steps = 1, double std_devs = 5.0)
+{
+    Date todayDate(_ParseDate(today));
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process(
+        _MakeProcess(todayDate, ir_type, ir_term, ir_data, ir_dc,
+                     d_type, d_term, d_data, d_dc,
+                     vol_type, vol_term, vol_data, vol_dc, proc_type));
+    TimeGrid grid((Time)tenor, (Size)steps);
+    SnowballFiniteDifference engine(
+        _MakeSnowball(process, steps, tenor, coupon, call_ob, call_barrier, ki_ob, ki_barrier, min_value, max_value),
+        grid, MakeForwardTerms(process, grid),
+        (Size)x_nodes, (Size)substeps, (Size)damping_steps, std_devs);
+    engine.calculate();
+
+    py::dict result;
+    result["price"] = engine.value();
+    result["delta"] = engine.delta();
+    result["gamma"] = engine.gamma();
+    return(result);
+}
+
+
+
+//===================
+// Multilevel MC
+//===================
+
+py::dict PriceSnowballMLMC(py::tuple today, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, py::array_t<double> coupon,
+        py::array_t<bool> call_ob, py::array_t<double> call_barrier,
+        py::array_t<bool> ki_ob,   py::array_t<double> ki_barrier,
+        double min_value, double max_value,
+        double rmse, int levels = 4, int pilot = 2000, int seed = 42)
+{
+    Date todayDate(_ParseDate(today));
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process(
+        _MakeProcess(todayDate, ir_type, ir_term, ir_data, ir_dc,
+                     d_type, d_term, d_data, d_dc,
+                     vol_type, vol_term, vol_data, vol_dc, proc_type));
+    QL_REQUIRE(pilot > 1, "at least two pilot samples per level are needed");
+    SnowballPathPricer daily(_MakeSnowball(process, steps, tenor, coupon,
+        call_ob, call_barrier, ki_ob, ki_barrier, min_value, max_value));
+    TimeGrid grid((Time)tenor, (Size)steps);
+    std::vector<Real> drift, diffusion;
+    TermTable(process, grid, drift, diffusion);
+    std::vector<std::vector<Size> > nodes(NestedGrids((Size)steps, (Size)levels, daily.callOb()));
+    std::vector<BridgedSnowballPricer> pricers;
+    for (Size l = 0; l < nodes.size(); l++)
+        pricers.push_back(BridgedSnowballPricer(daily, nodes[l], drift, diffusion));
+    MultilevelMonteCarlo<BridgedSnowballPricer> mlmc(process, grid, nodes, pricers, (BigNatural)seed);
+
+    // pilot run, then top up every level to the optimal allocation until
+    // the variance estimates stop asking for more
+    const Size chunk = 10000;
+    std::vector<Size> target(nodes.size(), (Size)pilot);
+    for (int round = 0; round < 10; round++) {
+        bool added = false;
+        for (Size l = 0; l < nodes.size(); l++) {
+            while (mlmc.level(l).samples < target[l]) {
+                mlmc.simulate(l, std::min(chunk, target[l] - mlmc.level(l).samples));
+                if (PyErr_CheckSignals() != 0)
+                    throw py::error_already_set();
+                added = true;
+            }
+        }
+        if (!added && round > 0)
+            break;
+        target = mlmc.optimalSamples(rmse);
+    }
+
+    Size L = nodes.size();
+    py::array_t<int> samples((ssize_t)L), grid_steps((ssize_t)L);
+    py::array_t<double> means((ssize_t)L), variances((ssize_t)L), costs((ssize_t)L);
+    auto samples_arr = samples.mutable_unchecked<1>();
+    auto steps_arr = grid_steps.mutable_unchecked<1>();
+    auto means_arr = means.mutable_unchecked<1>();
+    auto variances_arr = variances.mutable_unchecked<1>();
+    auto costs_arr = costs.mutable_unchecked<1>();
+    for (Size l = 0; l < L; l++) {
+        samples_arr(l) = (int)mlmc.level(l).samples;
+        steps_arr(l) = (int)(nodes[l].size() - 1);
+        means_arr(l) = mlmc.level(l).sum / mlmc.level(l).samples;
+        variances_arr(l) = mlmc.variance(l);
+        costs_arr(l) = mlmc.level(l).cost;
+    }
+    Real single = mlmc.singleLevelCost(rmse);
+
+    py::dict result;
+    result["price"] = mlmc.value();
+    result["error"] = mlmc.errorEstimate();
+    result["samples"] = samples;
+    result["steps"] = grid_steps;
+    result["means"] = means;
+    result["variances"] = variances;
+    result["costs"] = costs;
+    result["cost"] = mlmc.cost();
+    result["single_level_cost"] = single;
+    result["speedup"] = single / mlmc.cost();
+    return(result);
+}
+
+//===================
+// Payoff Script
+//===================
+
+// Splits a {name: array} dict into the names a script can refer to and
+// their values as doubles (bool schedules become 0/1).
+void _ScriptArrays(py::dict arrays, std::vector<std::string>& names, std::vector<std::vector<Real> >& values)
+{
+    for (auto item : arrays)
+    {
+        names.push_back(item.first.cast<std::string>());
+        py::array_t<double> data(item.second.cast<py::array_t<double>>());
+        values.push_back(_Data2Vec<Real>(data));
+    }
+}
+
+py::dict PricePayoffScript(py::tuple today, int num, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, std::string script, py::dict arrays,
+        bool bb = true, int skip = 0, int seed = 42, int rng = SobolRng)
+{
+    Date todayDate(_ParseDate(today));
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process(
+        _MakeProcess(todayDate, ir_type, ir_term, ir_data, ir_dc,
+                     d_type, d_term, d_data, d_dc,
+                     vol_type, vol_term, vol_data, vol_dc, proc_type));
+
+    std::vector<std::string> names;
+    std::vector<std::vector<Real> > values;
+    _ScriptArrays(arrays, names, values);
+    PayoffProgram program(script, names);
+    PayoffScriptPricer pricer(program, values, _MakeDiscounts(process, steps, tenor));
+
+    ShardStatistics stats(0, pricer.size());
+    ssize_t done = 0;
+    _WithSequenceGenerator(rng, (Size)steps, seed, skip, [&](auto& rsg) {
+        typedef typename std::decay<decltype(rsg)>::type RSGType;
+        MyPathGenerator<RSGType> generator(process, (Time)tenor, (Size)steps, rsg, bb);
+
+        for (ssize_t row = 0; row < num; row++)
+        {
+            CHECK_INTERRUPT(row)
+            generator.gen_bm();
+            Real value = generator.price_next(pricer);
+            stats.add(value, pricer.stopStep(), 0);
+            done = row + 1;
+        }
+    });
+    stats.cover((std::uint64_t)skip, (std::uint64_t)done);
 
+    Real n = (Real)std::max<std::uint64_t>(stats.count(), 1);
+    const std::vector<std::uint64_t>& stop = stats.stopHistogram();
+    py::array_t<double> stop_p((ssize_t)stop.size());
+    auto stop_arr = stop_p.mutable_unchecked<1>();
+    for (size_t i = 0; i < stop.size(); i++)
+        stop_arr(i) = stop[i] / n;
+
+    py::dict result;
+    result["count"] = stats.count();
+    result["price"] = stats.mean();
+    result["error"] = stats.errorEstimate();
+    result["stop_probability"] = stop_p;
+    return(result);
+}
+
+std::string DisassemblePayoff(std::string script, py::dict arrays)
+{
+    std::vector<std::string> names;
+    std::vector<std::vector<Real> > values;
+    _ScriptArrays(arrays, names, values);
+    return(PayoffProgram(script, names).disassemble());
+}
+
+
+//===================
+// Snowball Summary
+//===================
+
+// Simulates normalized paths once and keeps their snowball summaries;
+// spot-only moves are then repriced with SnowballSummary::reprice.
+SnowballSummary SummarizeSnowball(py::tuple today, int num, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, py::array_t<double> coupon,
+        py::array_t<bool> call_ob, py::array_t<double> call_barrier,
+        py::array_t<bool> ki_ob,   py::array_t<double> ki_barrier,
+        double min_value, double max_value,
+        bool bb = true, int skip = 0, int seed = 42, int rng = SobolRng)
+{
+    Date todayDate(_ParseDate(today));
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process(
+        _MakeProcess(todayDate, ir_type, ir_term, ir_data, ir_dc,
+                     d_type, d_term, d_data, d_dc,
+                     vol_type, vol_term, vol_data, vol_dc, proc_type));
+    SnowballSummary summary(_MakeSnowball(process, steps, tenor, coupon,
+        call_ob, call_barrier, ki_ob, ki_barrier, min_value, max_value));
+
+    _WithSequenceGenerator(rng, (Size)steps, seed, skip, [&](auto& rsg) {
+        typedef typename std::decay<decltype(rsg)>::type RSGType;
+        MyPathGenerator<RSGType> generator(process, (Time)tenor, (Size)steps, rsg, bb);
+
+        for (ssize_t row = 0; row < num; row++)
+        {
+            CHECK_INTERRUPT(row)
+            generator.gen_bm();
+            generator.price_next(summary);
+        }
+    });
+    return(summary);
+}
+
+py::array_t<double> RepriceSnowballLadder(const SnowballSummary& summary, py::array_t<double> spot_ratio)
+{
+    auto arr_ratio = spot_ratio.unchecked<1>();
+    py::array_t<double> price(arr_ratio.shape(0));
+    auto arr_price = price.mutable_unchecked<1>();
+    for (ssize_t k = 0; k < arr_ratio.shape(0); k++)
+        arr_price(k) = summary.reprice(arr_ratio(k));
+    return(price);
+}
+
+
+//===================
+// Scenario Grid
+//===================
+
+// One process per (spot, vol, rate) shock; spot shocks are relative, vol
+// and rate shocks are parallel absolute shifts of the input curves.
+ScenarioGrid _MakeScenarioGrid(Date today, int steps, double tenor,
+        int ir_type,  py::array_t<int>& ir_term,  py::array_t<double>& ir_data,  int ir_dc,
+        int d_type,   py::array_t<int>& d_term,   py::array_t<double>& d_data,   int d_dc,
+        int vol_type, py::array_t<int>& vol_term, py::array_t<double>& vol_data, int vol_dc,
+        int proc_type, py::array_t<double>& spot_shift, py::array_t<double>& vol_shift, py::array_t<double>& rate_shift,
+        std::vector<ext::shared_ptr<GeneralizedBlackScholesProcess> >& processes)
+{
+    auto arr_spot = spot_shift.unchecked<1>();
+    auto arr_vol = vol_shift.unchecked<1>();
+    auto arr_rate = rate_shift.unchecked<1>();
+    QL_REQUIRE(arr_vol.shape(0) == arr_spot.shape(0) && arr_rate.shape(0) == arr_spot.shape(0),
+        "spot_shift, vol_shift and rate_shift must have the same length");
+
+    std::vector<ext::shared_ptr<StochasticProcess1D> > scenario_processes;
+    std::vector<Real> spots;
+    processes.clear();
+    for (ssize_t k = 0; k < arr_spot.shape(0); k++)
+    {
+        processes.push_back(_MakeProcess(today, ir_type, ir_term, ir_data, ir_dc,
+                                         d_type, d_term, d_data, d_dc,
+                                         vol_type, vol_term, vol_data, vol_dc, proc_type,
+                                         1.0, arr_rate(k), arr_vol(k)));
+        scenario_processes.push_back(processes.back());
+        spots.push_back(1.0 + arr_spot(k));
+    }
+    return(ScenarioGrid(TimeGrid((Time)tenor, (Size)steps), scenario_processes, spots));
+}
+
+py::array_t<double> GenerateScenarios(py::tuple today, int num, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, py::array_t<double> spot_shift, py::array_t<double> vol_shift, py::array_t<double> rate_shift,
+        py::array_t<double> output_matrix,
+        bool bb = true, int skip = 0, int seed = 42, int rng = SobolRng)
+{
+    Date todayDate(_ParseDate(today));
+    std::vector<ext::shared_ptr<GeneralizedBlackScholesProcess> > processes;
+    ScenarioGrid grid(_MakeScenarioGrid(todayDate, steps, tenor,
+        ir_type, ir_term, ir_data, ir_dc, d_type, d_term, d_data, d_dc,
+        vol_type, vol_term, vol_data, vol_dc, proc_type,
+        spot_shift, vol_shift, rate_shift, processes));
+
+    auto arr = output_matrix.mutable_unchecked<3>();
+    QL_REQUIRE(arr.shape(0) == (ssize_t)grid.scenarios() && arr.shape(1) >= num && arr.shape(2) == steps + 1,
+        "output_matrix must have shape (scenarios, num, steps+1)");
+
+    _WithSequenceGenerator(rng, (Size)steps, seed, skip, [&](auto& rsg) {
+        typedef typename std::decay<decltype(rsg)>::type RSGType;
+        MyPathGenerator<RSGType> generator(processes[0], (Time)tenor, (Size)steps, rsg, bb);
+
+        for (ssize_t row = 0; row < num; row++)
+        {
+            CHECK_INTERRUPT(row)
+            generator.gen_bm();
+            grid.copy_paths(generator.bm(), arr, row);
+        }
+    });
     return(output_matrix);
 }
 
+py::dict PriceSnowballScenarios(py::tuple today, int num, int steps, double tenor,
+        int ir_type,  py::array_t<int> ir_term,  py::array_t<double> ir_data,  int ir_dc,
+        int d_type,   py::array_t<int> d_term,   py::array_t<double> d_data,   int d_dc,
+        int vol_type, py::array_t<int> vol_term, py::array_t<double> vol_data, int vol_dc,
+        int proc_type, py::array_t<double> spot_shift, py::array_t<double> vol_shift, py::array_t<double> rate_shift,
+        py::array_t<double> coupon,
+        py::array_t<bool> call_ob, py::array_t<double> call_barrier,
+        py::array_t<bool> ki_ob,   py::array_t<double> ki_barrier,
+        double min_value, double max_value,
+        bool bb = true, int skip = 0, int seed = 42, int rng = SobolRng)
+{
+    Date todayDate(_ParseDate(today));
+    std::vector<ext::shared_ptr<GeneralizedBlackScholesProcess> > processes;
+    ScenarioGrid grid(_MakeScenarioGrid(todayDate, steps, tenor,
+        ir_type, ir_term, ir_data, ir_dc, d_type, d_term, d_data, d_dc,
+        vol_type, vol_term, vol_data, vol_dc, proc_type,
+        spot_shift, vol_shift, rate_shift, processes));
 
-void GenerateRS(int num, int steps, double tenor, py::array_t<double> output_matrix, bool bb=true, int skip = 0, int seed=42)
+    // payoffs are discounted on each scenario's own (shifted) curve
+    std::vector<SnowballPathPricer> pricers;
+    for (size_t k = 0; k < processes.size(); k++)
+        pricers.push_back(_MakeSnowball(processes[k], steps, tenor, coupon,
+            call_ob, call_barrier, ki_ob, ki_barrier, min_value, max_value));
+
+    Size S = grid.scenarios();
+    std::vector<Real> values(S);
+    std::vector<ExactSum> sums(S), sums_sq(S);
+    ssize_t done = 0;
+    _WithSequenceGenerator(rng, (Size)steps, seed, skip, [&](auto& rsg) {
+        typedef typename std::decay<decltype(rsg)>::type RSGType;
+        MyPathGenerator<RSGType> generator(processes[0], (Time)tenor, (Size)steps, rsg, bb);
+
+        for (ssize_t row = 0; row < num; row++)
+        {
+            CHECK_INTERRUPT(row)
+            generator.gen_bm();
+            grid.price(generator.bm(), pricers, values);
+            for (Size k = 0; k < S; k++) {
+                sums[k].add(values[k]);
+                sums_sq[k].add(values[k] * values[k]);
+            }
+            done = row + 1;
+        }
+    });
+
+    py::array_t<double> price((ssize_t)S), error((ssize_t)S);
+    auto arr_price = price.mutable_unchecked<1>();
+    auto arr_error = error.mutable_unchecked<1>();
+    for (Size k = 0; k < S; k++) {
+        Real n = (Real)std::max<ssize_t>(done, 1);
+        Real mean = sums[k].value() / n;
+        Real var = std::max(sums_sq[k].value() / n - mean * mean, 0.0);
+        arr_price(k) = mean;
+        arr_error(k) = done > 1 ? std::sqrt(var / (n - 1.0)) : 0.0;
+    }
+    py::dict result;
+    result["price"] = price;
+    result["error"] = error;
+    result["count"] = done;
+    return(result);
+}
+
+//===================
+// Path Archives
+//===================
+
+py::dict _ArchiveDict(const PathArchiveWriter& writer)
 {
-    typedef LowDiscrepancy::rsg_type RSGType;
-    RSGType rsg = LowDiscrepancy::make_sequence_generator((Size)steps, seed);
-    MyRandomSequenceGenerator<RSGType> generator((Time)tenor, (Size)steps, rsg, bb);
-    auto arr = output_matrix.mutable_unchecked<2>();
+    py::dict result;
+    double raw = 8.0 * writer.rows() * (writer.steps() + 1);
+    result["rows"] = writer.rows();
+    result["bytes"] = writer.bytes();
+    result["ratio"] = writer.bytes() > 0 ? raw / writer.bytes() : 0.0;
+    result["max_error"] = writer.maxError();
+    return(result);
+}
+
+std::unique_ptr<PathArchiveWriter> OpenPathArchive(std::string file, int steps, int block_rows = 4096,
+                                                   int encoding = SharedExponent, double tolerance = 1.0e-4)
+{
+    QL_REQUIRE(steps > 0 && block_rows > 0, "steps and block_rows must be positive");
+    return std::unique_ptr<PathArchiveWriter>(
+        new PathArchiveWriter(file, steps, block_rows, (ArchiveEncoding)encoding, tolerance));
+}
 
-    for (int i = 0; i < skip; i++)
-        generator.gen_bm();
+// paths is (rows, steps+1) in any memory order, e.g. GeneratePath's output
+void AppendPathArchive(PathArchiveWriter& writer, py::array_t<double> paths)
+{
+    QL_REQUIRE(paths.ndim() == 2 && paths.shape(1) == (ssize_t)writer.steps() + 1,
+               "paths must be (rows, " << writer.steps() + 1 << ")");
+    const double* data = paths.data();
+    ssize_t row_stride = paths.strides(0) / (ssize_t)sizeof(double);
+    ssize_t col_stride = paths.strides(1) / (ssize_t)sizeof(double);
+    ssize_t rows = paths.shape(0);
+    py::gil_scoped_release release;
+    for (ssize_t row = 0; row < rows; row++)
+        writer.append(data + row * row_stride, col_stride);
+}
 
-    for (ssize_t row = 0; row < num; row++)
+py::dict ClosePathArchive(PathArchiveWriter& writer)
+{
+    writer.close();
+    return(_ArchiveDict(writer));
+}
+
+py::dict ArchivePaths(py::array_t<double> paths, std::string file, int block_rows = 4096,
+                      int encoding = SharedExponent, double tolerance = 1.0e-4)
+{
+    QL_REQUIRE(paths.ndim() == 2 && paths.shape(1) > 1, "paths must be (rows, steps+1)");
+    PathArchiveWriter writer(file, (Size)paths.shape(1) - 1, (Size)block_rows, (ArchiveEncoding)encoding, tolerance);
+    AppendPathArchive(writer, paths);
+    return(ClosePathArchive(writer));
+}
+
+py::array_t<double> LoadPaths(std::string file, int first_row = 0, int num_rows = -1,
+                              int first_col = 0, int num_cols = -1, int threads = 0)
+{
+    PathArchiveReader reader(file);
+    QL_REQUIRE(first_row >= 0 && first_col >= 0, "first_row and first_col must be non-negative");
+    Size rows = num_rows < 0 ? reader.rows() - std::min<Size>(first_row, reader.rows()) : (Size)num_rows;
+    Size cols = num_cols < 0 ? reader.steps() + 1 - std::min<Size>(first_col, reader.steps() + 1) : (Size)num_cols;
+    if (threads == 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    py::array_t<double> output_matrix({ (ssize_t)rows, (ssize_t)cols });
+    auto arr = output_matrix.mutable_unchecked<2>();
     {
-        CHECK_INTERRUPT(row)
-        generator.copy_bm(arr, row);
+        py::gil_scoped_release release;
+        reader.read((Size)first_row, rows, (Size)first_col, cols, arr, (Size)threads);
     }
-}
\ No newline at end of file
+    return(output_matrix);
+}
+
+py::dict ArchiveInfo(std::string file)
+{
+    PathArchiveReader reader(file);
+    py::dict result;
+    result["rows"] = reader.rows();
+    result["steps"] = reader.steps();
+    result["blocks"] = reader.blocks();
+    result["block_rows"] = reader.blockRows();
+    result["encoding"] = (int)reader.encoding();
+    result["tolerance"] = reader.tolerance();
+    result["bytes"] = reader.bytes();
+    result["ratio"] = reader.bytes() > 0 ? 8.0 * reader.rows() * (reader.steps() + 1) / reader.bytes() : 0.0;
+    return(result);
+}
+
+
+//===================
+// Geometric Asians
+//===================
+
+// A 1-d input of n values, or one value (also a scalar) that all n options share.
+template <class T>
+StridedArray<const T, 1> _Broadcast(py::array_t<T>& input, ssize_t n, const char* name)
+{
+    QL_REQUIRE(input.ndim() <= 1, name << " must be a scalar or 1-d");
+    if (input.size() == 1)
+        return StridedArray<const T, 1>(input.data(), n, 0);
+    QL_REQUIRE(input.size() == n, name << " has " << input.size() << " values, " << n << " required");
+    return StridedArray<const T, 1>(input.data(), n, input.strides(0) / (ssize_t)sizeof(T));
+}
+
+py::array_t<double> PriceGeometricAsian(py::array_t<double> spot, py::array_t<double> strike,
+        py::array_t<double> rate, py::array_t<double> dividend, py::array_t<double> vol,
+        py::array_t<double> expiry, py::array_t<int> option_type, py::array_t<double> fixing_times,
+        bool average_strike = false, py::object past_fixings = py::none(), py::object running_accumulator = py::none(),
+        int threads = 0)
+{
+    QL_REQUIRE(fixing_times.ndim() == 1 || fixing_times.ndim() == 2, "fixing_times must be 1-d or 2-d");
+    bool with_past = !past_fixings.is_none(), with_running = !running_accumulator.is_none();
+    py::array_t<double> past_arr(with_past ? past_fixings.cast<py::array_t<double>>() : py::array_t<double>(1));
+    py::array_t<double> running_arr(with_running ? running_accumulator.cast<py::array_t<double>>() : py::array_t<double>(1));
+    ssize_t rows = fixing_times.ndim() == 2 ? fixing_times.shape(0) : 1;
+    ssize_t n = std::max({ spot.size(), strike.size(), rate.size(), dividend.size(), vol.size(),
+                           expiry.size(), option_type.size(), past_arr.size(), running_arr.size(), rows });
+
+    // one row of times is the schedule of every option
+    StridedArray<const double, 2> times;
+    if (fixing_times.ndim() == 1)
+        times = StridedArray<const double, 2>(fixing_times.data(), n, fixing_times.shape(0),
+            0, fixing_times.strides(0) / (ssize_t)sizeof(double));
+    else {
+        times = _View2d(fixing_times, fixing_times.data());
+        QL_REQUIRE(rows == 1 || rows == n, "fixing_times has " << rows << " rows, " << n << " required");
+        if (rows == 1)
+            times = StridedArray<const double, 2>(fixing_times.data(), n, times.shape(1), 0, times.stride(1));
+    }
+
+    GeometricAsianBatch batch((Size)n, average_strike,
+        _Broadcast(spot, n, "spot"), _Broadcast(strike, n, "strike"),
+        _Broadcast(rate, n, "rate"), _Broadcast(dividend, n, "dividend"),
+        _Broadcast(vol, n, "vol"), _Broadcast(expiry, n, "expiry"),
+        _Broadcast(option_type, n, "option_type"), times,
+        with_past ? _Broadcast(past_arr, n, "past_fixings") : StridedArray<const double, 1>(),
+        with_running ? _Broadcast(running_arr, n, "running_accumulator") : StridedArray<const double, 1>());
+
+    py::array_t<double> price(n);
+    batch.run(price.mutable_data(), (Size)threads, [](ChunkedJob& job) { _WaitJob(job); });
+    return(price);
+}
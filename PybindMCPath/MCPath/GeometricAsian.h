@@ -0,0 +1,215 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/errors.hpp>
+#include <ql/types.hpp>
+#include <PathJob.h>
+#include <StridedArray.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace QuantLib;
+
+//===================
+// Geometric Asian Batch
+//===================
+
+namespace geometric_detail {
+
+    //! sums of a fixing schedule that the closed forms need
+    struct FixingMoments {
+        Size count;         // fixings counted
+        Real first;         // time of the first one
+        Real timeSum;       // sum of t[i]
+        Real crossSum;      // sum over i, j of min(t[i], t[j])
+    };
+
+    /*! The times of a sorted schedule, skipping NaN padding and, with
+        skipPast, times before 0; with fromFirst they are measured from the
+        first fixing. crossSum is timeSum + 2*temp of the QuantLib engines,
+        written as one weighted sum.
+    */
+    template <class Row>
+    inline FixingMoments moments(const Row& t, ssize_t size, bool skipPast, bool fromFirst) {
+        FixingMoments m = { 0, 0.0, 0.0, 0.0 };
+        ssize_t count = 0;
+        for (ssize_t j = 0; j < size; j++)
+            if (t(j) == t(j) && !(skipPast && t(j) < 0.0))
+                count++;
+        Real weight = 2.0 * count - 1.0;
+        for (ssize_t j = 0; j < size; j++) {
+            Real tj = t(j);
+            if (tj != tj || (skipPast && tj < 0.0))
+                continue;
+            if (m.count == 0)
+                m.first = tj;
+            if (fromFirst)
+                tj -= m.first;
+            m.timeSum += tj;
+            m.crossSum += weight * tj;
+            weight -= 2.0;
+            m.count++;
+        }
+        return m;
+    }
+
+    //! std::erfc rather than CumulativeNormalDistribution, so the loops stay free of calls into QuantLib
+    inline Real cdf(Real x) { return 0.5 * std::erfc(-x * 0.70710678118654752440); }
+
+    //! w*(f*N(w*d1) - k*N(w*d2)) with d1,2 = (log(f/k) +- v/2)/sqrt(v), w = 1 call, -1 put
+    inline Real black(Real w, Real f, Real k, Real variance) {
+        Real sd = std::sqrt(variance);
+        Real d1 = sd > 0.0 ? (std::log(f / k) + 0.5 * variance) / sd
+                           : (f > k ? std::numeric_limits<Real>::max() : -std::numeric_limits<Real>::max());
+        Real d2 = sd > 0.0 ? d1 - sd : d1;
+        return w * (f * cdf(w * d1) - k * cdf(w * d2));
+    }
+
+}
+
+//! analytic discrete geometric Asians, many at a time
+/*! Evaluates what AnalyticDiscreteGeometricAveragePriceAsianEngine and
+    AnalyticDiscreteGeometricAverageStrikeAsianEngine return for plain
+    vanilla payoffs, without building an instrument, a process or term
+    structures per option. Inputs are struct-of-arrays views of length
+    size(): rate and dividend are continuous zero rates to expiry, vol the
+    Black vol to expiry, type 1 for calls and -1 for puts; a view of
+    stride 0 repeats one value for every option.
+
+    fixingTimes has a sorted row of times per option, or one row of
+    stride 0 shared by all; NaN pads rows of fewer fixings. As in the
+    engines:
+    - average price counts only times >= 0, pastFixings and
+      runningAccumulator (the product of the past fixings) being the
+      rest of the average;
+    - average strike ignores the strike, has no past fixings and
+      measures all times, expiry included, from the first fixing, i.e.
+      an average that starts later is valued as if it started today.
+
+    price() walks its rows in blocks: the schedule sums first, then the
+    formulas in a branch-free loop over contiguous block arrays.
+*/
+class GeometricAsianBatch {
+public:
+    GeometricAsianBatch(Size size, bool averageStrike,
+            const StridedArray<const Real, 1>& spot, const StridedArray<const Real, 1>& strike,
+            const StridedArray<const Real, 1>& rate, const StridedArray<const Real, 1>& dividend,
+            const StridedArray<const Real, 1>& vol, const StridedArray<const Real, 1>& expiry,
+            const StridedArray<const int, 1>& type, const StridedArray<const Real, 2>& fixingTimes,
+            const StridedArray<const Real, 1>& pastFixings = StridedArray<const Real, 1>(),
+            const StridedArray<const Real, 1>& runningAccumulator = StridedArray<const Real, 1>())
+        : size_(size), averageStrike_(averageStrike), spot_(spot), strike_(strike), rate_(rate),
+        dividend_(dividend), vol_(vol), expiry_(expiry), type_(type), fixingTimes_(fixingTimes),
+        pastFixings_(pastFixings), runningAccumulator_(runningAccumulator) {
+        QL_REQUIRE(fixingTimes.shape(1) > 0, "no fixing times given");
+        QL_REQUIRE(fixingTimes.stride(0) == 0 || fixingTimes.shape(0) >= (ssize_t)size,
+            "fixing times have " << fixingTimes.shape(0) << " rows, " << size << " required");
+        QL_REQUIRE(!averageStrike || pastFixings.empty(), "past fixings currently not managed for average strike");
+        sharedSchedule_ = fixingTimes.stride(0) == 0;
+        if (sharedSchedule_)
+            shared_ = schedule(0);
+    }
+
+    Size size() const { return size_; }
+
+    //! prices of options [first, first+count) into out[0, count)
+    void price(Size first, Size count, Real* out) const {
+        const Size block = 256;
+        Real n[block], tbar[block], varG[block], origin[block];
+        for (Size b = first; b < first + count; b += block) {
+            Size len = std::min(block, first + count - b);
+            for (Size i = 0; i < len; i++) {
+                const geometric_detail::FixingMoments& m = sharedSchedule_ ? shared_ : schedule(b + i);
+                Real past = pastFixings_.empty() ? 0.0 : pastFixings_(b + i);
+                QL_REQUIRE(m.count + past > 0, "option " << b + i << " has no fixings");
+                n[i] = m.count + past;
+                tbar[i] = m.timeSum / n[i];
+                varG[i] = m.crossSum / (n[i] * n[i]);
+                origin[i] = averageStrike_ ? m.first : 0.0;
+            }
+            for (Size i = 0; i < len; i++)
+                check(b + i);
+            if (averageStrike_)
+                averageStrike(b, len, tbar, varG, origin, out + (b - first));
+            else
+                averagePrice(b, len, n, tbar, varG, out + (b - first));
+        }
+    }
+
+    //! all prices into out[0, size()) on threads threads (0 for all cores)
+    void run(Real* out, Size threads = 0) const {
+        run(out, threads, [](ChunkedJob&) {});
+    }
+
+    //! as run(), with wait(job) called before the join, e.g. to poll for interrupts
+    template <class Wait>
+    void run(Real* out, Size threads, Wait wait) const {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        ChunkedJob job(size_, threads, 16384,
+            [&](Size first, Size count, Size, const std::atomic<bool>&) {
+                price(first, count, out + first);
+                return count;
+            });
+        wait(job);
+        job.join();
+        if (job.error())
+            std::rethrow_exception(job.error());
+    }
+
+private:
+    geometric_detail::FixingMoments schedule(Size i) const {
+        ssize_t cols = fixingTimes_.shape(1);
+        const Real* row = &fixingTimes_(i, 0);
+        ssize_t stride = fixingTimes_.stride(1);
+        StridedArray<const Real, 1> t(row, cols, stride);
+        return geometric_detail::moments(t, cols, !averageStrike_, averageStrike_);
+    }
+
+    void check(Size i) const {
+        QL_REQUIRE(spot_(i) > 0.0, "option " << i << ": positive underlying value required");
+        QL_REQUIRE(vol_(i) >= 0.0, "option " << i << ": negative volatility");
+        QL_REQUIRE(type_(i) == 1 || type_(i) == -1, "option " << i << ": type must be 1 (call) or -1 (put)");
+        QL_REQUIRE(pastFixings_.empty() || pastFixings_(i) >= 0.0, "option " << i << ": negative past fixings");
+        QL_REQUIRE(runningAccumulator_.empty() || runningAccumulator_(i) > 0.0,
+            "option " << i << ": positive running product required");
+    }
+
+    // muG = (sum of log past fixings + (N - past) log S + nu sum t) / N, then Black on exp(muG + varG/2)
+    void averagePrice(Size b, Size len, const Real* n, const Real* tbar, const Real* varG, Real* out) const {
+        for (Size i = 0; i < len; i++) {
+            Real s = spot_(b + i), r = rate_(b + i), sigma = vol_(b + i);
+            Real past = pastFixings_.empty() ? 0.0 : pastFixings_(b + i);
+            Real runningLog = past > 0.0 && !runningAccumulator_.empty() ? std::log(runningAccumulator_(b + i)) : 0.0;
+            Real nu = r - dividend_(b + i) - 0.5 * sigma * sigma;
+            Real variance = sigma * sigma * varG[i];
+            Real muG = (runningLog + (n[i] - past) * std::log(s)) / n[i] + nu * tbar[i];
+            out[i] = std::exp(-r * expiry_(b + i))
+                * geometric_detail::black(type_(b + i), std::exp(muG + 0.5 * variance), strike_(b + i), variance);
+        }
+    }
+
+    // an exchange of S(T) against the geometric average over T - t0, log-normal jointly
+    void averageStrike(Size b, Size len, const Real* tbar, const Real* varG, const Real* origin, Real* out) const {
+        for (Size i = 0; i < len; i++) {
+            Real s = spot_(b + i), r = rate_(b + i), q = dividend_(b + i), sigma = vol_(b + i);
+            Real residual = expiry_(b + i) - origin[i];
+            Real variance = sigma * sigma * varG[i];
+            Real sumVariance = variance + sigma * sigma * (residual - 2.0 * tbar[i]);
+            Real forwardG = s * std::exp((r - q - 0.5 * sigma * sigma) * tbar[i] + 0.5 * variance);
+            Real forwardS = s * std::exp((r - q) * residual);
+            out[i] = std::exp(-r * residual)
+                * geometric_detail::black(type_(b + i), forwardS, forwardG, std::max(sumVariance, 0.0));
+        }
+    }
+
+    Size size_;
+    bool averageStrike_, sharedSchedule_;
+    StridedArray<const Real, 1> spot_, strike_, rate_, dividend_, vol_, expiry_;
+    StridedArray<const int, 1> type_;
+    StridedArray<const Real, 2> fixingTimes_;
+    StridedArray<const Real, 1> pastFixings_, runningAccumulator_;
+    geometric_detail::FixingMoments shared_;
+};
@@ -0,0 +1,304 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/math/distributions/normaldistribution.hpp>
+#include <ql/methods/montecarlo/brownianbridge.hpp>
+#include <ql/processes/blackscholesprocess.hpp>
+#include <ql/timegrid.hpp>
+#include <PathObservers.h>
+#include <PathProfiler.h>
+#include <ScenarioGrid.h>
+#include <StridedArray.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Model Parameters
+//===================
+
+//! Hull-White short rate r = x + phi, dx = -a x dt + sigma dW_r, d<W_r, W_S> = rho dt
+struct HullWhiteRates {
+    Real a, sigma, rho;
+};
+
+namespace hw_detail {
+
+    //! (1 - exp(-a t)) / a
+    inline Real B(Real a, Time t) {
+        Real u = a * t;
+        return std::fabs(u) < 1.0e-8 ? t * (1.0 - 0.5 * u) : -std::expm1(-u) / a;
+    }
+
+    //! Var(x(t+h) | x(t)) / sigma^2
+    inline Real varX(Real a, Time h) {
+        return B(2.0 * a, h);
+    }
+
+    //! Var(integral of x over [t, t+h] | x(t)) / sigma^2, by series where it cancels
+    inline Real varI(Real a, Time h) {
+        Real u = a * h;
+        if (std::fabs(u) < 1.0e-3)
+            return h * h * h * (1.0 / 3.0 - u / 4.0 + 7.0 * u * u / 60.0);
+        return (h - 2.0 * B(a, h) + B(2.0 * a, h)) / (a * a);
+    }
+
+    //! (h - B(a, h)) / a, the weight of dW_r in the step's integral of x
+    inline Real C(Real a, Time h) {
+        Real u = a * h;
+        if (std::fabs(u) < 1.0e-3)
+            return h * h * (0.5 - u / 6.0 + u * u / 24.0);
+        return (h - B(a, h)) / a;
+    }
+
+}
+
+//===================
+// Hybrid Paths
+//===================
+
+//! equity paths under Hull-White short rates, with the interface of MyPathGenerator
+/*! The step from t to t+h is exact: given x(t), the equity shock
+    e_S = int v dW_S, the short rate factor x(t+h) and its integral
+    I = int x ds over the step are jointly Gaussian, and their 3x3
+    covariance is factored once per step. phi is fitted so that
+    E[exp(-int r)] is the process's discount factor at every grid date,
+    and log S moves by int r + (the process's carry without rates) + e_S,
+    so S times the discount factor keeps the deterministic-rate forward.
+
+    Draws are laid out as [equity | rate | rate integral], steps
+    dimensions each; only the equity block goes through the Brownian
+    bridge, so W(T) stays the first dimension for stratification and
+    importance sampling shifts the equity alone. The discount factors
+    of the path, exp(-int_0^t r), are accumulated in the same loop and
+    kept in discount() up to the last step evolved.
+*/
+template <class GSG>
+class HullWhiteHybridPathGenerator {
+public:
+    HullWhiteHybridPathGenerator(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+        const TimeGrid& timeGrid, const GSG& generator, bool brownianBridge,
+        const HullWhiteRates& rates);
+
+    //! sequence dimensionality needed for steps
+    static Size dimension(Size steps) { return 3 * steps; }
+
+    void gen_bm() const;
+    template <class Profiler>
+    void gen_bm(Profiler& profiler) const;
+    template <class Array>
+    void load_bm(const Array&, ssize_t) const {
+        QL_FAIL("cached normals are not supported with stochastic rates");
+    }
+    void set_drift_shift(const std::vector<Real>& theta);
+    void set_stratum(Size k, Size n) const;
+    Real weight() const { return weight_; }
+    //! discount factors of the last path, steps 0..steps
+    const std::vector<Real>& discount() const { return discount_; }
+
+    template <class Writer, class Observer>
+    PathEnd write_next(Writer& writer, Observer& observer) const;
+    template <class Writer, class Observer, class Profiler>
+    PathEnd write_next(Writer& writer, Observer& observer, Profiler& profiler) const;
+    template <class Pricer>
+    Real price_next(Pricer& pricer) const;
+private:
+    //! log-increment of the equity at step i, advances x and the discount
+    Real step(Size i, Real& x, Real& logDiscount) const;
+    Size steps_;
+    bool brownianBridge_;
+    GSG generator_;
+    TimeGrid timeGrid_;
+    BrownianBridge bb_;
+    HullWhiteRates rates_;
+    std::vector<Real> decay_, integral_;    // exp(-a h), B(a, h): x(t) in x(t+h) and in I
+    std::vector<Real> phi_, carry_;         // int phi, equity log drift without int r
+    std::vector<Real> chol_;                // [i * 6]: L00, L10, L11, L20, L21, L22 of (e_S, x, I)
+    std::vector<Real> shift_;
+    mutable Size stratum_, strata_;
+    mutable std::vector<Real> draw_, temp_, discount_;
+    mutable Real weight_;
+    InverseCumulativeNormal icn_;
+    CumulativeNormalDistribution cdf_;
+};
+
+template <class GSG>
+HullWhiteHybridPathGenerator<GSG>::HullWhiteHybridPathGenerator(
+    const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+    const TimeGrid& timeGrid, const GSG& generator, bool brownianBridge,
+    const HullWhiteRates& rates)
+    : steps_(timeGrid.size() - 1), brownianBridge_(brownianBridge),
+    generator_(generator), timeGrid_(timeGrid), bb_(timeGrid), rates_(rates),
+    decay_(steps_), integral_(steps_), phi_(steps_), carry_(steps_), chol_(6 * steps_),
+    stratum_(0), strata_(1), temp_(steps_), discount_(steps_ + 1, 1.0), weight_(1.0) {
+    QL_REQUIRE(generator_.dimension() == dimension(steps_),
+        "sequence generator dimensionality (" << generator_.dimension()
+        << ") != " << dimension(steps_) << " for " << steps_ << " steps");
+    QL_REQUIRE(rates_.a > 0.0 && rates_.sigma >= 0.0 && rates_.rho >= -1.0 && rates_.rho <= 1.0,
+        "Hull-White needs a > 0, sigma >= 0 and rho in [-1, 1]");
+    std::vector<Real> drift, diffusion;
+    TermTable(process, timeGrid_, drift, diffusion);
+    const Handle<YieldTermStructure>& curve = process->riskFreeRate();
+    Real a = rates_.a, sigma = rates_.sigma, rho = rates_.rho;
+    Real logP = 0.0, V = 0.0;
+    for (Size i = 0; i < steps_; i++) {
+        Time t = timeGrid_[i + 1], h = timeGrid_.dt(i);
+        // phi fits the curve: int_0^t phi = -log P(0, t) + Var(int_0^t x) / 2
+        Real logPNext = std::log(curve->discount(t)), VNext = sigma * sigma * hw_detail::varI(a, t);
+        phi_[i] = (logP - logPNext) + 0.5 * (VNext - V);
+        carry_[i] = drift[i] - (logP - logPNext);
+        logP = logPNext;
+        V = VNext;
+
+        decay_[i] = std::exp(-a * h);
+        integral_[i] = hw_detail::B(a, h);
+        Real v = diffusion[i] / std::sqrt(h);
+        Real c[3][3];
+        c[0][0] = diffusion[i] * diffusion[i];
+        c[1][1] = sigma * sigma * hw_detail::varX(a, h);
+        c[2][2] = sigma * sigma * hw_detail::varI(a, h);
+        c[1][0] = rho * sigma * v * integral_[i];
+        c[2][0] = rho * sigma * v * hw_detail::C(a, h);
+        c[2][1] = 0.5 * sigma * sigma * integral_[i] * integral_[i];
+        // Cholesky, a factor with no variance left gets a zero column
+        Real L[3][3] = { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 } };
+        for (Size j = 0; j < 3; j++) {
+            Real d = c[j][j];
+            for (Size k = 0; k < j; k++)
+                d -= L[j][k] * L[j][k];
+            if (d <= 1.0e-14 * c[j][j])
+                continue;
+            L[j][j] = std::sqrt(d);
+            for (Size r = j + 1; r < 3; r++) {
+                Real s = c[r][j];
+                for (Size k = 0; k < j; k++)
+                    s -= L[r][k] * L[j][k];
+                L[r][j] = s / L[j][j];
+            }
+        }
+        Real* l = &chol_[6 * i];
+        l[0] = L[0][0]; l[1] = L[1][0]; l[2] = L[1][1];
+        l[3] = L[2][0]; l[4] = L[2][1]; l[5] = L[2][2];
+    }
+}
+
+template <class GSG>
+void HullWhiteHybridPathGenerator<GSG>::gen_bm() const
+{
+    NoProfiler profiler;
+    gen_bm(profiler);
+}
+
+template <class GSG>
+template <class Profiler>
+void HullWhiteHybridPathGenerator<GSG>::gen_bm(Profiler& profiler) const
+{
+    typedef typename GSG::sample_type sequence_type;
+    std::uint64_t t = profiler.start();
+    const sequence_type& sequence_ = generator_.nextSequence();
+    draw_.assign(sequence_.value.begin(), sequence_.value.end());
+    t = profiler.lap(SequencePhase, t);
+    if (strata_ > 1)
+        draw_[0] = icn_((stratum_ + cdf_(draw_[0])) / strata_);
+    if (brownianBridge_)
+        bb_.transform(draw_.begin(), draw_.begin() + steps_, temp_.begin());
+    else
+        std::copy(draw_.begin(), draw_.begin() + steps_, temp_.begin());
+    weight_ = sequence_.weight;
+    if (!shift_.empty()) {
+        Real log_weight = 0.0;
+        for (Size i = 0; i < steps_; i++) {
+            temp_[i] += shift_[i];
+            log_weight += shift_[i] * (0.5 * shift_[i] - temp_[i]);
+        }
+        weight_ *= std::exp(log_weight);
+    }
+    profiler.lap(BridgePhase, t);
+}
+
+template <class GSG>
+void HullWhiteHybridPathGenerator<GSG>::set_drift_shift(const std::vector<Real>& theta)
+{
+    QL_REQUIRE(theta.empty() || theta.size() == steps_,
+        theta.size() << " shifts given for " << steps_ << " steps");
+    shift_ = theta;
+}
+
+template <class GSG>
+void HullWhiteHybridPathGenerator<GSG>::set_stratum(Size k, Size n) const
+{
+    QL_REQUIRE(n > 0 && k < n, "stratum " << k << " out of " << n);
+    stratum_ = k;
+    strata_ = n;
+}
+
+template <class GSG>
+inline Real HullWhiteHybridPathGenerator<GSG>::step(Size i, Real& x, Real& logDiscount) const
+{
+    const Real* l = &chol_[6 * i];
+    Real z0 = temp_[i], z1 = draw_[steps_ + i], z2 = draw_[2 * steps_ + i];
+    Real eS = l[0] * z0;
+    Real eX = l[1] * z0 + l[2] * z1;
+    Real eI = l[3] * z0 + l[4] * z1 + l[5] * z2;
+    Real R = integral_[i] * x + eI + phi_[i];
+    x = decay_[i] * x + eX;
+    logDiscount -= R;
+    discount_[i + 1] = std::exp(logDiscount);
+    return R + carry_[i] + eS;
+}
+
+// Same contract as MyPathGenerator::write_next.
+template <class GSG>
+template <class Writer, class Observer>
+PathEnd HullWhiteHybridPathGenerator<GSG>::write_next(Writer& writer, Observer& observer) const
+{
+    NoProfiler profiler;
+    return write_next(writer, observer, profiler);
+}
+
+template <class GSG>
+template <class Writer, class Observer, class Profiler>
+PathEnd HullWhiteHybridPathGenerator<GSG>::write_next(Writer& writer, Observer& observer, Profiler& profiler) const
+{
+    Real s = 0.0, x = 0.0, logDiscount = 0.0, last = 1.0;
+    writer.write(0, last);
+    observer.reset();
+    for (Size i = 1; i <= steps_; i++) {
+        std::uint64_t tick = profiler.start();
+        s += step(i - 1, x, logDiscount);
+        last = std::exp(s);
+        tick = profiler.lap(EvolvePhase, tick);
+        writer.write(i, last);
+        tick = profiler.lap(WritePhase, tick);
+        bool stop = observer.observe(i, last);
+        profiler.lap(ObservePhase, tick);
+        if (stop) {
+            writer.stop(i);
+            PathEnd end = { i, last };
+            return end;
+        }
+    }
+    PathEnd end = { 0, last };
+    return end;
+}
+
+// The pricer should read discount() for its flows, see
+// SnowballPathPricer::setPathDiscount.
+template <class GSG>
+template <class Pricer>
+Real HullWhiteHybridPathGenerator<GSG>::price_next(Pricer& pricer) const
+{
+    Real s = 0.0, x = 0.0, logDiscount = 0.0, last = 1.0;
+    pricer.reset();
+    for (Size i = 1; i <= steps_; i++) {
+        s += step(i - 1, x, logDiscount);
+        last = std::exp(s);
+        if (pricer.observe(i, last))
+            return pricer.value();
+    }
+    pricer.finish(last);
+    return pricer.value();
+}
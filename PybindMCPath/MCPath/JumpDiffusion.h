@@ -0,0 +1,297 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/math/distributions/normaldistribution.hpp>
+#include <ql/methods/montecarlo/brownianbridge.hpp>
+#include <ql/stochasticprocess.hpp>
+#include <ql/timegrid.hpp>
+#include <PathObservers.h>
+#include <PathProfiler.h>
+#include <ScenarioGrid.h>
+#include <StridedArray.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Model Parameters
+//===================
+
+//! Merton jumps: Poisson arrivals, normal log jump sizes
+struct MertonJumps {
+    Real intensity;     // jumps per year
+    Real mean;          // mean of the log jump
+    Real stdDev;        // std deviation of the log jump
+    //! E[exp(J)] - 1, removed from the drift so the forward is unchanged
+    Real compensator() const { return std::exp(mean + 0.5 * stdDev * stdDev) - 1.0; }
+};
+
+//! Heston variance: dv = kappa (theta - v) dt + sigma sqrt(v) dW, d<W, W_S> = rho dt
+struct HestonVariance {
+    Real v0, kappa, theta, sigma, rho;
+};
+
+//===================
+// Jump Diffusion Paths
+//===================
+
+//! Merton or Bates paths with the interface of MyPathGenerator
+/*! Draws are laid out as [diffusion | jumps | variance], steps
+    dimensions each, the variance block only with Heston. Only the
+    diffusion block goes through the Brownian bridge, so W(T) stays the
+    first dimension for stratification. The jump count comes from
+    inverting the Poisson distribution on the normal scale against
+    per-step thresholds, so the usual no-jump step costs one comparison.
+    Given k jumps, where the normal falls inside its count's interval is
+    again uniform and gives the size normal z: the log path moves by
+    k*mean + sqrt(k)*stdDev*z, and no dimension is spent on sizes.
+
+    Rates, dividends and, without Heston, the diffusion vol are read off
+    the Black-Scholes process through TermTable; the drift is compensated
+    by intensity*compensator() so forwards match the process. Paths are
+    kept in log space and only exponentiated where they are written or
+    observed. Heston uses full truncation Euler for the variance.
+*/
+template <class GSG>
+class JumpDiffusionPathGenerator {
+public:
+    JumpDiffusionPathGenerator(const ext::shared_ptr<StochasticProcess1D>& process,
+        const TimeGrid& timeGrid, const GSG& generator, bool brownianBridge,
+        const MertonJumps& jumps, const HestonVariance* heston = 0);
+
+    //! sequence dimensionality needed for steps
+    static Size dimension(Size steps, bool heston) { return steps * (heston ? 3 : 2); }
+
+    void gen_bm() const;
+    template <class Profiler>
+    void gen_bm(Profiler& profiler) const;
+    template <class Array>
+    void load_bm(const Array&, ssize_t) const {
+        QL_FAIL("cached normals are not supported with jumps");
+    }
+    void set_drift_shift(const std::vector<Real>& theta);
+    void set_stratum(Size k, Size n) const;
+    Real weight() const { return weight_; }
+
+    template <class Writer, class Observer>
+    PathEnd write_next(Writer& writer, Observer& observer) const;
+    template <class Writer, class Observer, class Profiler>
+    PathEnd write_next(Writer& writer, Observer& observer, Profiler& profiler) const;
+    template <class Pricer>
+    Real price_next(Pricer& pricer) const;
+private:
+    //! log-increment of step i, also advances the variance
+    Real step(Size i, Real& v) const;
+    Size steps_;
+    bool brownianBridge_, heston_;
+    GSG generator_;
+    TimeGrid timeGrid_;
+    BrownianBridge bb_;
+    MertonJumps jumps_;
+    HestonVariance variance_;
+    std::vector<Real> drift_, diffusion_;       // compensated log drift, diffusion std
+    std::vector<Real> carry_;                   // (r - q - intensity*compensator) dt, Heston only
+    std::vector<Real> thresholds_;              // [i * maxJumps_ + k]: normal quantile of P(N <= k)
+    std::vector<Real> tails_, masses_;          // [i * maxJumps_ + k]: P(N > k), P(N = k + 1)
+    Size maxJumps_;
+    std::vector<Real> shift_;
+    mutable Size stratum_, strata_;
+    mutable std::vector<Real> draw_, temp_;
+    mutable Real weight_;
+    InverseCumulativeNormal icn_;
+    CumulativeNormalDistribution phi_;
+};
+
+template <class GSG>
+JumpDiffusionPathGenerator<GSG>::JumpDiffusionPathGenerator(
+    const ext::shared_ptr<StochasticProcess1D>& process,
+    const TimeGrid& timeGrid, const GSG& generator, bool brownianBridge,
+    const MertonJumps& jumps, const HestonVariance* heston)
+    : steps_(timeGrid.size() - 1), brownianBridge_(brownianBridge), heston_(heston != 0),
+    generator_(generator), timeGrid_(timeGrid), bb_(timeGrid), jumps_(jumps),
+    maxJumps_(1), stratum_(0), strata_(1), temp_(steps_), weight_(1.0) {
+    QL_REQUIRE(generator_.dimension() == dimension(steps_, heston_),
+        "sequence generator dimensionality (" << generator_.dimension()
+        << ") != " << dimension(steps_, heston_) << " for " << steps_ << " steps");
+    QL_REQUIRE(jumps_.intensity >= 0.0 && jumps_.stdDev >= 0.0,
+        "jump intensity and size deviation must be non-negative");
+    if (heston_) {
+        variance_ = *heston;
+        QL_REQUIRE(variance_.v0 >= 0.0 && variance_.theta >= 0.0 && variance_.sigma >= 0.0
+            && variance_.rho >= -1.0 && variance_.rho <= 1.0, "invalid Heston parameters");
+    }
+    std::vector<Real> drift, diffusion;
+    TermTable(process, timeGrid_, drift, diffusion);
+    Real compensation = jumps_.intensity * jumps_.compensator();
+    drift_.resize(steps_);
+    diffusion_ = diffusion;
+    carry_.resize(steps_);
+    for (Size i = 0; i < steps_; i++) {
+        Time dt = timeGrid_.dt(i);
+        drift_[i] = drift[i] - compensation * dt;
+        carry_[i] = drift[i] + 0.5 * diffusion[i] * diffusion[i] - compensation * dt;
+    }
+
+    // Poisson quantiles on the normal scale, up to a tail below 1e-12;
+    // tails are summed from the top so small ones keep their precision
+    std::vector<std::vector<Real> > masses(steps_);
+    for (Size i = 0; i < steps_; i++) {
+        Real mean = jumps_.intensity * timeGrid_.dt(i);
+        Real p = std::exp(-mean), cumulative = p;
+        masses[i].push_back(p);
+        while (1.0 - cumulative > 1.0e-12 && masses[i].size() < 100) {
+            p *= mean / masses[i].size();
+            cumulative += p;
+            masses[i].push_back(p);
+        }
+        maxJumps_ = std::max<Size>(maxJumps_, masses[i].size());
+    }
+    thresholds_.assign(steps_ * maxJumps_, QL_MAX_REAL);
+    tails_.assign(steps_ * maxJumps_, 0.0);
+    masses_.assign(steps_ * maxJumps_, 1.0);
+    for (Size i = 0; i < steps_; i++) {
+        Real tail = 0.0;
+        for (Size k = masses[i].size() - 1; k-- > 0; ) {
+            tail += masses[i][k + 1];
+            thresholds_[i * maxJumps_ + k] = -icn_(tail);
+            tails_[i * maxJumps_ + k] = tail;
+            masses_[i * maxJumps_ + k] = masses[i][k + 1];
+        }
+    }
+}
+
+template <class GSG>
+void JumpDiffusionPathGenerator<GSG>::gen_bm() const
+{
+    NoProfiler profiler;
+    gen_bm(profiler);
+}
+
+template <class GSG>
+template <class Profiler>
+void JumpDiffusionPathGenerator<GSG>::gen_bm(Profiler& profiler) const
+{
+    typedef typename GSG::sample_type sequence_type;
+    std::uint64_t t = profiler.start();
+    const sequence_type& sequence_ = generator_.nextSequence();
+    draw_.assign(sequence_.value.begin(), sequence_.value.end());
+    t = profiler.lap(SequencePhase, t);
+    if (strata_ > 1)
+        draw_[0] = icn_((stratum_ + phi_(draw_[0])) / strata_);
+    if (brownianBridge_)
+        bb_.transform(draw_.begin(), draw_.begin() + steps_, temp_.begin());
+    else
+        std::copy(draw_.begin(), draw_.begin() + steps_, temp_.begin());
+    weight_ = sequence_.weight;
+    if (!shift_.empty()) {
+        Real log_weight = 0.0;
+        for (Size i = 0; i < steps_; i++) {
+            temp_[i] += shift_[i];
+            log_weight += shift_[i] * (0.5 * shift_[i] - temp_[i]);
+        }
+        weight_ *= std::exp(log_weight);
+    }
+    profiler.lap(BridgePhase, t);
+}
+
+template <class GSG>
+void JumpDiffusionPathGenerator<GSG>::set_drift_shift(const std::vector<Real>& theta)
+{
+    QL_REQUIRE(theta.empty() || theta.size() == steps_,
+        theta.size() << " shifts given for " << steps_ << " steps");
+    shift_ = theta;
+}
+
+template <class GSG>
+void JumpDiffusionPathGenerator<GSG>::set_stratum(Size k, Size n) const
+{
+    QL_REQUIRE(n > 0 && k < n, "stratum " << k << " out of " << n);
+    stratum_ = k;
+    strata_ = n;
+}
+
+template <class GSG>
+inline Real JumpDiffusionPathGenerator<GSG>::step(Size i, Real& v) const
+{
+    Real z = temp_[i];
+    Real dx;
+    if (heston_) {
+        Time dt = timeGrid_.dt(i);
+        Real vp = std::max(v, 0.0);
+        Real sd = std::sqrt(vp * dt);
+        dx = carry_[i] - 0.5 * vp * dt + sd * z;
+        Real w = variance_.rho * z
+            + std::sqrt(1.0 - variance_.rho * variance_.rho) * draw_[2 * steps_ + i];
+        v += variance_.kappa * (variance_.theta - vp) * dt + variance_.sigma * sd * w;
+    }
+    else {
+        dx = drift_[i] + diffusion_[i] * z;
+    }
+    Real u = draw_[steps_ + i];
+    const Real* c = &thresholds_[i * maxJumps_];
+    if (u >= c[0]) {
+        Size k = 1;
+        while (k < maxJumps_ && u >= c[k])
+            k++;
+        // u is in [c[k-1], c[k]): its position there is uniform
+        Size j = i * maxJumps_ + k - 1;
+        Real p = (tails_[j] - phi_(-u)) / masses_[j];
+        Real zJump = icn_(std::min(std::max(p, 1.0e-12), 1.0 - 1.0e-12));
+        dx += k * jumps_.mean + std::sqrt((Real)k) * jumps_.stdDev * zJump;
+    }
+    return dx;
+}
+
+// Same contract as MyPathGenerator::write_next.
+template <class GSG>
+template <class Writer, class Observer>
+PathEnd JumpDiffusionPathGenerator<GSG>::write_next(Writer& writer, Observer& observer) const
+{
+    NoProfiler profiler;
+    return write_next(writer, observer, profiler);
+}
+
+template <class GSG>
+template <class Writer, class Observer, class Profiler>
+PathEnd JumpDiffusionPathGenerator<GSG>::write_next(Writer& writer, Observer& observer, Profiler& profiler) const
+{
+    Real x = 0.0, v = variance_.v0, last = 1.0;
+    writer.write(0, last);
+    observer.reset();
+    for (Size i = 1; i <= steps_; i++) {
+        std::uint64_t tick = profiler.start();
+        x += step(i - 1, v);
+        last = std::exp(x);
+        tick = profiler.lap(EvolvePhase, tick);
+        writer.write(i, last);
+        tick = profiler.lap(WritePhase, tick);
+        bool stop = observer.observe(i, last);
+        profiler.lap(ObservePhase, tick);
+        if (stop) {
+            writer.stop(i);
+            PathEnd end = { i, last };
+            return end;
+        }
+    }
+    PathEnd end = { 0, last };
+    return end;
+}
+
+template <class GSG>
+template <class Pricer>
+Real JumpDiffusionPathGenerator<GSG>::price_next(Pricer& pricer) const
+{
+    Real x = 0.0, v = variance_.v0, last = 1.0;
+    pricer.reset();
+    for (Size i = 1; i <= steps_; i++) {
+        x += step(i - 1, v);
+        last = std::exp(x);
+        if (pricer.observe(i, last))
+            return pricer.value();
+    }
+    pricer.finish(last);
+    return pricer.value();
+}
@@ -0,0 +1,259 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/errors.hpp>
+#include <ql/types.hpp>
+#include <SnowballPricer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Exercise Data
+//===================
+
+//! snowball paths seen at their exercise dates, for least squares MC
+/*! Spots are kept date-major, spot[k * paths + p] for exercise date k,
+    so the regression at a date reads one contiguous row. cash[p] is the
+    discounted flow of path p under the exercise rule applied so far
+    (at first the snowball's own flow), paid at step end[p].
+*/
+struct ExerciseData {
+    ExerciseData(const std::vector<Size>& dates, Size paths)
+        : dates(dates), paths(paths), spot(dates.size() * paths, 0.0),
+        kiStep(paths, 0), end(paths, 0), exercised(paths, 0), cash(paths, 0.0) {}
+    std::vector<Size> dates;                // steps of the exercise dates
+    Size paths;
+    std::vector<Real> spot;
+    std::vector<std::uint32_t> kiStep;      // first knock-in step, 0 if none
+    std::vector<std::uint32_t> end;         // step the path pays at
+    std::vector<std::uint32_t> exercised;   // exercise date index + 1, 0 if not exercised
+    std::vector<Real> cash;
+};
+
+//! records a path for ExerciseData, fed by MyPathGenerator::price_next
+/*! Wraps the snowball pricer, so mechanical calls and knock-ins are the
+    snowball's: the path stops at an autocall and the flow recorded is
+    the snowball's value.
+*/
+class ExerciseRecorder {
+public:
+    ExerciseRecorder(const SnowballPathPricer& snowball, ExerciseData& data)
+        : snowball_(snowball), data_(data), path_(0), next_(0) {}
+    //! selects the path the next price_next records
+    void row(Size path) { path_ = path; }
+
+    void reset() {
+        snowball_.reset();
+        next_ = 0;
+    }
+    bool observe(Size i, Real x) {
+        if (next_ < data_.dates.size() && data_.dates[next_] == i)
+            data_.spot[next_++ * data_.paths + path_] = x;
+        return snowball_.observe(i, x);
+    }
+    void finish(Real x) { snowball_.finish(x); }
+    Real value() const { return snowball_.value(); }
+
+    //! stores the flow of the path after price_next
+    void store() {
+        data_.kiStep[path_] = (std::uint32_t)snowball_.knockInStep();
+        data_.end[path_] = (std::uint32_t)(snowball_.callStep() > 0 ? snowball_.callStep() : snowball_.size() - 1);
+        data_.exercised[path_] = 0;
+        data_.cash[path_] = snowball_.value();
+    }
+private:
+    SnowballPathPricer snowball_;
+    ExerciseData& data_;
+    Size path_, next_;
+};
+
+//===================
+// Normal Equations
+//===================
+
+namespace lsmc_detail {
+
+    //! dot product with four partial sums, which compilers vectorize
+    inline Real dot(const Real* x, const Real* y, Size n) {
+        Real s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        Size i = 0;
+        for (; i + 4 <= n; i += 4) {
+            s0 += x[i] * y[i];
+            s1 += x[i + 1] * y[i + 1];
+            s2 += x[i + 2] * y[i + 2];
+            s3 += x[i + 3] * y[i + 3];
+        }
+        for (; i < n; i++)
+            s0 += x[i] * y[i];
+        return (s0 + s1) + (s2 + s3);
+    }
+
+    //! A = X'X and b = X'y for the column-major n x K basis matrix X
+    /*! Rows are taken in blocks small enough that the K columns of a
+        block stay in L1 while all K(K+1)/2 products are formed.
+    */
+    inline void normalEquations(const std::vector<Real>& X, const Real* y, Size n, Size K,
+                                std::vector<Real>& A, std::vector<Real>& b) {
+        const Size block = 512;
+        A.assign(K * K, 0.0);
+        b.assign(K, 0.0);
+        for (Size i0 = 0; i0 < n; i0 += block) {
+            Size m = std::min(block, n - i0);
+            for (Size j = 0; j < K; j++) {
+                const Real* xj = &X[j * n + i0];
+                for (Size k = j; k < K; k++)
+                    A[j * K + k] += dot(xj, &X[k * n + i0], m);
+                b[j] += dot(xj, y + i0, m);
+            }
+        }
+        for (Size j = 0; j < K; j++)
+            for (Size k = 0; k < j; k++)
+                A[j * K + k] = A[k * K + j];
+    }
+
+    //! solves A beta = b by Cholesky, dropping basis functions with no variance left
+    inline std::vector<Real> solve(std::vector<Real> A, const std::vector<Real>& b, Size K) {
+        Real scale = 0.0;
+        for (Size j = 0; j < K; j++)
+            scale = std::max(scale, A[j * K + j]);
+        std::vector<char> dropped(K, 0);
+        for (Size j = 0; j < K; j++) {
+            Real d = A[j * K + j];
+            for (Size k = 0; k < j; k++)
+                d -= A[j * K + k] * A[j * K + k];
+            if (d <= 1.0e-12 * scale) {
+                dropped[j] = 1;
+                for (Size i = j; i < K; i++)
+                    A[i * K + j] = 0.0;
+                continue;
+            }
+            d = std::sqrt(d);
+            A[j * K + j] = d;
+            for (Size i = j + 1; i < K; i++) {
+                Real s = A[i * K + j];
+                for (Size k = 0; k < j; k++)
+                    s -= A[i * K + k] * A[j * K + k];
+                A[i * K + j] = s / d;
+            }
+        }
+        std::vector<Real> beta(b);
+        for (Size j = 0; j < K; j++) {
+            if (dropped[j]) {
+                beta[j] = 0.0;
+                continue;
+            }
+            for (Size k = 0; k < j; k++)
+                beta[j] -= A[j * K + k] * beta[k];
+            beta[j] /= A[j * K + j];
+        }
+        for (Size j = K; j-- > 0;) {
+            if (dropped[j]) {
+                beta[j] = 0.0;
+                continue;
+            }
+            for (Size k = j + 1; k < K; k++)
+                beta[j] -= A[k * K + j] * beta[k];
+            beta[j] /= A[j * K + j];
+        }
+        return beta;
+    }
+
+}
+
+//===================
+// Longstaff-Schwartz
+//===================
+
+//! least squares exercise rule for a callable snowball
+/*! Going backwards over the exercise dates, the discounted flows of the
+    paths alive after the date are regressed on polynomials of degree
+    degree in x = S - 1, separately for knocked-in and not knocked-in
+    paths, and a path is exercised where the discounted exercise value
+    is below (issuer call) or above (holder put) the fitted continuation
+    value. A path is alive at a date if it pays after it, so a mechanical
+    autocall on the date comes first.
+
+    fit() estimates the rule and leaves the in-sample flows, which are
+    biased by the foresight of the fit; apply() uses a fitted rule on
+    independent paths, which gives a value from the exerciser's side
+    (high for an issuer call, low for a holder put).
+*/
+class LongstaffSchwartz {
+public:
+    //! exerciseValue[k] is the discounted amount paid on exercise at date k
+    LongstaffSchwartz(const std::vector<Real>& exerciseValue, Size degree, bool issuer)
+        : exerciseValue_(exerciseValue), degree_(degree), issuer_(issuer),
+        beta_(exerciseValue.size() * 2 * (degree + 1), 0.0) {}
+
+    void fit(ExerciseData& data) { backward(data, &beta_); }
+    void apply(ExerciseData& data) const { backward(data, 0); }
+
+    Size basisSize() const { return degree_ + 1; }
+    //! coefficients of date k, knocked-in group ki
+    const Real* coefficients(Size k, bool ki) const { return &beta_[(2 * k + (ki ? 1 : 0)) * basisSize()]; }
+private:
+    // fits into *fitted if given, else uses beta_
+    void backward(ExerciseData& data, std::vector<Real>* fitted) const;
+    std::vector<Real> exerciseValue_;
+    Size degree_;
+    bool issuer_;
+    std::vector<Real> beta_;
+};
+
+inline void LongstaffSchwartz::backward(ExerciseData& data, std::vector<Real>* fitted) const
+{
+    Size K = basisSize(), n = data.paths;
+    QL_REQUIRE(data.dates.size() == exerciseValue_.size(), "exercise values do not match the dates");
+    std::vector<Size> alive;
+    std::vector<Real> X, y, A, b;
+    alive.reserve(n);
+    for (Size k = data.dates.size(); k-- > 0;) {
+        Size step = data.dates[k];
+        const Real* spot = &data.spot[k * n];
+        for (int group = 0; group < 2; group++) {
+            // basis of the alive paths of the group, one contiguous column per power
+            alive.clear();
+            for (Size p = 0; p < n; p++)
+                if (data.end[p] > step && ((data.kiStep[p] != 0 && data.kiStep[p] <= step) == (group == 1)))
+                    alive.push_back(p);
+            Size m = alive.size();
+            Size offset = (2 * k + group) * K;
+            if (m == 0)
+                continue;
+            X.resize(K * m);
+            for (Size i = 0; i < m; i++) {
+                Real x = spot[alive[i]] - 1.0, power = 1.0;
+                for (Size j = 0; j < K; j++) {
+                    X[j * m + i] = power;
+                    power *= x;
+                }
+            }
+            if (fitted) {
+                y.resize(m);
+                for (Size i = 0; i < m; i++)
+                    y[i] = data.cash[alive[i]];
+                lsmc_detail::normalEquations(X, &y[0], m, K, A, b);
+                std::vector<Real> solution(lsmc_detail::solve(A, b, K));
+                std::copy(solution.begin(), solution.end(), fitted->begin() + offset);
+            }
+            const Real* beta = &beta_[offset];
+            Real value = exerciseValue_[k];
+            for (Size i = 0; i < m; i++) {
+                Real continuation = 0.0;
+                for (Size j = 0; j < K; j++)
+                    continuation += X[j * m + i] * beta[j];
+                if (issuer_ ? value < continuation : value > continuation) {
+                    Size p = alive[i];
+                    data.cash[p] = value;
+                    data.end[p] = (std::uint32_t)step;
+                    data.exercised[p] = (std::uint32_t)(k + 1);
+                }
+            }
+        }
+    }
+}
@@ -16,9 +16,189 @@ PYBIND11_MODULE(MCPath, m) {
           "upout_type"_a,  "upout_ob"_a,   "upout_barrier"_a,
           "downout_type"_a,"downout_ob"_a, "downout_barrier"_a,
           "proc_type"_a, "output_matrix"_a,
-          "bb"_a = true, "skip"_a = 0, "seed"_a = 42);
+          "bb"_a = true, "skip"_a = 0, "seed"_a = 42, "rng"_a = 0,
+          "normals"_a = none(), "row_mode"_a = 0,
+          "ki_type"_a = 0, "ki_ob"_a = none(), "ki_barrier"_a = none(),
+          "events"_a = none(), "layout"_a = 0,
+          "is_shift"_a = 0.0, "strata"_a = 1, "weights"_a = none(),
+          "jumps"_a = none(), "heston"_a = none(),
+          "profile"_a = none(), "trace_file"_a = "",
+          "checkpoint"_a = "", "checkpoint_every"_a = 0,
+          "hull_white"_a = none(), "discounts"_a = none(),
+          "construction"_a = 0, "pca_nodes"_a = 64);
+
+    m.def("GeneratePathAsync", &GeneratePathAsync, "GeneratePath on background threads, returns a PathJob",
+          "today"_a, "num"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "upout_type"_a,  "upout_ob"_a,   "upout_barrier"_a,
+          "downout_type"_a,"downout_ob"_a, "downout_barrier"_a,
+          "proc_type"_a, "output_matrix"_a,
+          "bb"_a = true, "skip"_a = 0, "seed"_a = 42, "rng"_a = 0,
+          "normals"_a = none(), "row_mode"_a = 0,
+          "ki_type"_a = 0, "ki_ob"_a = none(), "ki_barrier"_a = none(),
+          "events"_a = none(), "layout"_a = 0,
+          "is_shift"_a = 0.0, "strata"_a = 1, "weights"_a = none(),
+          "jumps"_a = none(), "heston"_a = none(),
+          "profile"_a = none(), "trace_file"_a = "",
+          "threads"_a = 0, "chunk"_a = 0,
+          "hull_white"_a = none(), "discounts"_a = none(),
+          "construction"_a = 0, "pca_nodes"_a = 64);
+
+    py::class_<PathJob>(m, "PathJob")
+        .def("cancel", &PathJob::cancel, "Ask the workers to stop after their current row")
+        .def("done", &PathJob::done)
+        .def("wait", &PathJob::wait, "Wait up to timeout seconds, forever if negative; True if done", "timeout"_a = -1.0)
+        .def("progress", &PathJob::progress, "Rows done, total, fraction, seconds, rows_per_sec, threads, cancelled, done")
+        .def("result", &PathJob::result, "Wait, then paths, rows, valid_rows, done_mask and cancelled");
 
     m.def("GenerateRS", &GenerateRS, "QuantLib Sobol Random Seuqence Generator",
-         "num"_a,  "steps"_a,  "tenor"_a,  "output_matrix"_a,  "bb"_a = true, "skip"_a = 0,"seed"_a = 42);
+         "num"_a,  "steps"_a,  "tenor"_a,  "output_matrix"_a,  "bb"_a = true, "skip"_a = 0,"seed"_a = 42, "rng"_a = 0,
+         "layout"_a = 0, "construction"_a = 0, "pca_nodes"_a = 64);
+
+    m.def("PriceSnowballShard", &PriceSnowballShard, "Snowball pricing over paths [first_path, first_path+count), returns a mergeable shard",
+          "today"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "coupon"_a,
+          "call_ob"_a, "call_barrier"_a,
+          "ki_ob"_a,   "ki_barrier"_a,
+          "min_value"_a, "max_value"_a,
+          "first_path"_a, "count"_a,
+          "bb"_a = true, "seed"_a = 42, "rng"_a = 0,
+          "is_shift"_a = 0.0, "strata"_a = 1, "hull_white"_a = none(),
+          "construction"_a = 0, "pca_nodes"_a = 64);
+
+    m.def("MergeShards", &MergeShards, "Merge shards of the same run", "shards"_a);
+
+    m.def("PriceSnowballFD", &PriceSnowballFD, "Snowball price, delta and gamma by Crank-Nicolson/Rannacher finite differences",
+          "today"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "coupon"_a,
+          "call_ob"_a, "call_barrier"_a,
+          "ki_ob"_a,   "ki_barrier"_a,
+          "min_value"_a, "max_value"_a,
+          "x_nodes"_a = 801, "substeps"_a = 4, "damping_steps"_a = 1, "std_devs"_a = 5.0);
+
+    m.def("PriceSnowballMLMC", &PriceSnowballMLMC, "Snowball price by multilevel Monte Carlo on nested time grids",
+          "today"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "coupon"_a,
+          "call_ob"_a, "call_barrier"_a,
+          "ki_ob"_a,   "ki_barrier"_a,
+          "min_value"_a, "max_value"_a,
+          "rmse"_a, "levels"_a = 4, "pilot"_a = 2000, "seed"_a = 42);
+
+    m.def("PricePayoffScript", &PricePayoffScript, "Prices a payoff script compiled to bytecode and run inside the path loop",
+          "today"_a, "num"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "script"_a, "arrays"_a,
+          "bb"_a = true, "skip"_a = 0, "seed"_a = 42, "rng"_a = 0);
+
+    m.def("DisassemblePayoff", &DisassemblePayoff, "Bytecode listing of a payoff script",
+          "script"_a, "arrays"_a);
+
+    py::class_<SnowballSummary>(m, "SnowballSummary")
+        .def("reprice", &SnowballSummary::reprice, "Price with the spot multiplied by spot_ratio, coupons by coupon_scale and knock-in barriers by ki_scale",
+             "spot_ratio"_a = 1.0, "coupon_scale"_a = 1.0, "ki_scale"_a = 1.0)
+        .def("reprice_ladder", &RepriceSnowballLadder, "Prices for an array of spot ratios", "spot_ratio"_a)
+        .def("error", &SnowballSummary::errorEstimate, "Standard error of reprice(spot_ratio, coupon_scale, ki_scale)",
+             "spot_ratio"_a = 1.0, "coupon_scale"_a = 1.0, "ki_scale"_a = 1.0)
+        .def("solve_coupon", &SnowballSummary::solveCoupon, "coupon_scale that prices at target", "target"_a = 0.0, "spot_ratio"_a = 1.0)
+        .def("solve_knock_in", &SnowballSummary::solveKnockIn, "ki_scale where the price crosses target", "target"_a = 0.0, "spot_ratio"_a = 1.0)
+        .def("call_probability", &SnowballSummary::callProbability, "Autocall probability at spot_ratio", "spot_ratio"_a = 1.0)
+        .def("samples", &SnowballSummary::samples)
+        .def("records", &SnowballSummary::records);
+
+    m.def("SummarizeSnowball", &SummarizeSnowball, "Normalized snowball path summaries for spot-only repricing",
+          "today"_a, "num"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "coupon"_a,
+          "call_ob"_a, "call_barrier"_a,
+          "ki_ob"_a,   "ki_barrier"_a,
+          "min_value"_a, "max_value"_a,
+          "bb"_a = true, "skip"_a = 0, "seed"_a = 42, "rng"_a = 0);
+
+    m.def("GenerateScenarios", &GenerateScenarios, "Paths of many spot/vol/rate scenarios from one set of normals",
+          "today"_a, "num"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "spot_shift"_a, "vol_shift"_a, "rate_shift"_a,
+          "output_matrix"_a,
+          "bb"_a = true, "skip"_a = 0, "seed"_a = 42, "rng"_a = 0);
+
+    m.def("PriceSnowballScenarios", &PriceSnowballScenarios, "Snowball prices of many spot/vol/rate scenarios in one simulation pass",
+          "today"_a, "num"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "spot_shift"_a, "vol_shift"_a, "rate_shift"_a,
+          "coupon"_a,
+          "call_ob"_a, "call_barrier"_a,
+          "ki_ob"_a,   "ki_barrier"_a,
+          "min_value"_a, "max_value"_a,
+          "bb"_a = true, "skip"_a = 0, "seed"_a = 42, "rng"_a = 0);
+
+    m.def("PriceSnowballCheckpointed", &PriceSnowballCheckpointed, "PriceSnowballShard over [0, num), resumable from a checkpoint file",
+          "today"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "coupon"_a,
+          "call_ob"_a, "call_barrier"_a,
+          "ki_ob"_a,   "ki_barrier"_a,
+          "min_value"_a, "max_value"_a,
+          "num"_a, "checkpoint"_a, "checkpoint_every"_a = 100000,
+          "bb"_a = true, "seed"_a = 42, "rng"_a = 0,
+          "is_shift"_a = 0.0, "strata"_a = 1, "hull_white"_a = none(),
+          "construction"_a = 0, "pca_nodes"_a = 64);
+
+    m.def("PriceCallableSnowball", &PriceCallableSnowball, "Least squares MC for a snowball with issuer calls or holder puts",
+          "today"_a, "num"_a, "steps"_a, "tenor"_a,
+          "ir_type"_a,  "ir_term"_a,  "ir_data"_a,  "ir_dc"_a,
+          "d_type"_a,   "d_term"_a,   "d_data"_a,   "d_dc"_a,
+          "vol_type"_a, "vol_term"_a, "vol_data"_a, "vol_dc"_a,
+          "proc_type"_a, "coupon"_a,
+          "call_ob"_a, "call_barrier"_a,
+          "ki_ob"_a,   "ki_barrier"_a,
+          "min_value"_a, "max_value"_a,
+          "exercise_ob"_a, "exercise_value"_a,
+          "issuer"_a = true, "num_price"_a = 0, "degree"_a = 2,
+          "bb"_a = true, "seed"_a = 42, "rng"_a = 0, "threads"_a = 0);
+
+    m.def("ShardSummary", &ShardSummary, "Price, error and histograms of a (merged) shard", "shard"_a);
+
+    py::class_<PathArchiveWriter>(m, "PathArchiveWriter")
+        .def("append", &AppendPathArchive, "Append (rows, steps+1) paths", "paths"_a)
+        .def("close", &ClosePathArchive, "Write the index; rows, bytes, ratio and max_error")
+        .def("rows", &PathArchiveWriter::rows);
+
+    m.def("OpenPathArchive", &OpenPathArchive, "Archive writer for paths of steps+1 prices, appended in chunks",
+          "file"_a, "steps"_a, "block_rows"_a = 4096, "encoding"_a = 1, "tolerance"_a = 1.0e-4);
+
+    m.def("ArchivePaths", &ArchivePaths, "Write (rows, steps+1) paths to a compressed archive",
+          "paths"_a, "file"_a, "block_rows"_a = 4096, "encoding"_a = 1, "tolerance"_a = 1.0e-4);
+
+    m.def("LoadPaths", &LoadPaths, "Decode rows [first_row, first_row+num_rows) and the columns asked for of an archive",
+          "file"_a, "first_row"_a = 0, "num_rows"_a = -1, "first_col"_a = 0, "num_cols"_a = -1, "threads"_a = 0);
+
+    m.def("ArchiveInfo", &ArchiveInfo, "Rows, steps, blocks, encoding and size of an archive", "file"_a);
+
+    m.def("PriceGeometricAsian", &PriceGeometricAsian, "Analytic discrete geometric average-price or average-strike Asians of arrays of inputs",
+          "spot"_a, "strike"_a, "rate"_a, "dividend"_a, "vol"_a, "expiry"_a,
+          "option_type"_a, "fixing_times"_a,
+          "average_strike"_a = false, "past_fixings"_a = none(), "running_accumulator"_a = none(),
+          "threads"_a = 0);
 
 }
\ No newline at end of file
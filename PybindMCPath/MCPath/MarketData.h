@@ -0,0 +1,183 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/processes/blackscholesprocess.hpp>
+#include <ql/quotes/simplequote.hpp>
+#include <ql/termstructures/volatility/all.hpp>
+#include <ql/termstructures/yield/all.hpp>
+#include <ql/time/all.hpp>
+#include <stdexcept>
+#include <vector>
+
+using namespace QuantLib;
+
+enum IRType {
+    FlatRateCurve, SpotRateCurve, ForwardRateCurve, DiscountFactorCurve
+};
+enum VolType{
+    FlatVolCurve, SpotVolCurve
+};
+enum ProcType{
+    BS, BSM, Merton, Bates, HullWhite
+};
+enum DCType {
+    A365, AA, A360, F360
+};
+
+//===================
+// Market Data
+//===================
+
+//! a rate, dividend or vol curve as GeneratePath takes it
+/*! type is an IRType or VolType, dc a DCType and term[i] the day offset
+    from today of data[i]; flat curves only read data[0].
+*/
+struct CurveData {
+    CurveData() : type(0), dc(A365) {}
+    CurveData(int type, const std::vector<int>& term, const std::vector<Real>& data, int dc)
+        : type(type), term(term), data(data), dc(dc) {}
+    int type;
+    std::vector<int> term;
+    std::vector<Real> data;
+    int dc;
+};
+
+inline DayCounter _MakeDC(int dc_enum)
+{
+    switch (dc_enum) {
+    case A365:
+        return(Actual365Fixed());
+    case AA:
+        return(ActualActual());
+    case A360:
+        return(Actual360());
+    case F360:
+        return(Thirty360());
+    default:
+        throw std::invalid_argument("DayCounter type is not surppoted.");
+    }
+}
+
+inline std::vector<Date> _TermDates(Date today, const std::vector<int>& term)
+{
+    std::vector<Date> result;
+    for (Size i = 0; i < term.size(); i++)
+        result.push_back(today + term[i] * Days);
+    return(result);
+}
+
+inline Handle<YieldTermStructure> _MakeIRCurve(Date today, const CurveData& ir)
+{
+    QL_REQUIRE(!ir.data.empty(), "IR curve has no data");
+    std::vector<Date> ir_term_vec(_TermDates(today, ir.term));
+    DayCounter dc = _MakeDC(ir.dc);
+
+    Handle<YieldTermStructure> ir_curve;
+    switch (ir.type) {
+    case FlatRateCurve:
+        ir_curve = Handle<YieldTermStructure>(
+            ext::shared_ptr<YieldTermStructure>(
+                new FlatForward(today, (Rate)ir.data[0], dc)
+                )
+            );
+        break;
+    case SpotRateCurve:
+        ir_curve = Handle<YieldTermStructure>(
+            ext::shared_ptr<YieldTermStructure>(
+                new InterpolatedZeroCurve<Linear>(ir_term_vec, ir.data, dc, Linear())
+                )
+            );
+        break;
+    case ForwardRateCurve:
+        ir_curve = Handle<YieldTermStructure>(
+            ext::shared_ptr<YieldTermStructure>(
+                new InterpolatedForwardCurve<Linear>(ir_term_vec, ir.data, dc, Linear())
+                )
+            );
+        break;
+    case DiscountFactorCurve:
+        ir_curve = Handle<YieldTermStructure>(
+            ext::shared_ptr<YieldTermStructure>(
+                new InterpolatedDiscountCurve<Linear>(ir_term_vec, ir.data, dc, Linear())
+                )
+            );
+        break;
+    default:
+        throw std::invalid_argument("IR curve type is not surppoted.");
+    }
+    return(ir_curve);
+}
+
+inline Handle<BlackVolTermStructure> _MakeVolCurve(Date today, const CurveData& vol, double vol_shift = 0.0)
+{
+    QL_REQUIRE(!vol.data.empty(), "vol curve has no data");
+    std::vector<Date> vol_term_vec(_TermDates(today, vol.term));
+    std::vector<Real> vol_data_vec(vol.data);
+    for (Size i = 0; i < vol_data_vec.size(); i++)
+        vol_data_vec[i] += vol_shift;
+    DayCounter dc = _MakeDC(vol.dc);
+
+    Handle<BlackVolTermStructure> vol_curve;
+    switch (vol.type) {
+    case FlatVolCurve:
+        vol_curve = Handle<BlackVolTermStructure>(
+            ext::shared_ptr<BlackVolTermStructure>(
+                new BlackConstantVol(today, NullCalendar(), (Volatility)vol_data_vec[0], dc)
+                )
+            );
+        break;
+    case SpotVolCurve:
+        vol_curve = Handle<BlackVolTermStructure>(
+            ext::shared_ptr<BlackVolTermStructure>(
+                new BlackVarianceCurve(today, vol_term_vec, vol_data_vec, dc)
+                )
+            );
+        break;
+    default:
+        throw std::invalid_argument("Vol curve type is not surppoted.");
+    }
+    return(vol_curve);
+}
+
+//! the process the curves are built into; Merton, Bates and HullWhite add their factors to BSM
+inline int _BaseProcess(int proc_type)
+{
+    return (proc_type == Merton || proc_type == Bates || proc_type == HullWhite) ? (int)BSM : proc_type;
+}
+
+//! the BS or BSM process of the curves, d is only read for BSM
+inline ext::shared_ptr<GeneralizedBlackScholesProcess> _MakeProcess(Date today,
+        const CurveData& ir, const CurveData& d, const CurveData& vol,
+        int proc_type, double spot = 1.0, double rate_shift = 0.0, double vol_shift = 0.0)
+{
+    Handle<Quote> S0(ext::shared_ptr<Quote>(new SimpleQuote(spot)));
+
+    Handle<YieldTermStructure> ir_curve(_MakeIRCurve(today, ir));
+    if (rate_shift != 0.0)
+        ir_curve = Handle<YieldTermStructure>(
+            ext::shared_ptr<YieldTermStructure>(
+                new ZeroSpreadedTermStructure(ir_curve,
+                    Handle<Quote>(ext::shared_ptr<Quote>(new SimpleQuote(rate_shift))))
+                )
+            );
+    Handle<BlackVolTermStructure> vol_curve(_MakeVolCurve(today, vol, vol_shift));
+
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process;
+    if (proc_type == BSM)
+    {
+        Handle<YieldTermStructure> d_curve = _MakeIRCurve(today, d);
+        process = ext::shared_ptr<GeneralizedBlackScholesProcess>(
+            new BlackScholesMertonProcess(S0, d_curve, ir_curve, vol_curve)
+            );
+    }
+    else if (proc_type == BS)
+    {
+        process = ext::shared_ptr<GeneralizedBlackScholesProcess>(
+            new BlackScholesProcess(S0, ir_curve, vol_curve)
+            );
+    }
+    else
+        throw std::invalid_argument("Process type is not surppoted.");
+    return(process);
+}
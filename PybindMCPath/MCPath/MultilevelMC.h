@@ -0,0 +1,344 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/math/distributions/normaldistribution.hpp>
+#include <MyPathGenerator.h>
+#include <PhiloxRsg.h>
+#include <ScenarioGrid.h>
+#include <SnowballPricer.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Nested Grids
+//===================
+
+//! node indices of each level on the full grid 0..steps
+/*! The last level is the full grid; each coarser level keeps every
+    second node of the next one, its last node and every node flagged
+    in keep, so every coarse step is a union of fine steps.
+*/
+inline std::vector<std::vector<Size> > NestedGrids(Size steps, Size levels,
+    const std::vector<char>& keep = std::vector<char>())
+{
+    QL_REQUIRE(levels >= 1, "at least one level is needed");
+    QL_REQUIRE(keep.empty() || keep.size() == steps + 1,
+        "keep flags must have steps+1 (" << steps + 1 << ") entries");
+    std::vector<std::vector<Size> > nodes(levels);
+    for (Size i = 0; i <= steps; i++)
+        nodes[levels - 1].push_back(i);
+    for (Size l = levels - 1; l-- > 0; ) {
+        const std::vector<Size>& fine = nodes[l + 1];
+        for (Size k = 0; k < fine.size(); k++)
+            if (k % 2 == 0 || k + 1 == fine.size() || (!keep.empty() && keep[fine[k]]))
+                nodes[l].push_back(fine[k]);
+        QL_REQUIRE(nodes[l].size() < fine.size(), "too many levels for " << steps << " steps");
+    }
+    return nodes;
+}
+
+//===================
+// Bridged Snowball
+//===================
+
+//! the snowball priced on the nodes of a coarser grid
+/*! Call dates must be nodes. A knock-in date between two nodes is not
+    observed; instead the pricer keeps the probability that none of the
+    skipped dates knocked in, given the two node values. In log space the
+    path between nodes is a Brownian bridge, so each skipped date is
+    Gaussian with a mean interpolated by variance; the dates are taken as
+    independent given the nodes. The payoff is then the conditional
+    expectation over the skipped dates, which is smooth in the path and
+    keeps the level corrections of MultilevelMonteCarlo small.
+    On the full grid there is nothing to skip and the pricer is exact.
+
+    drift and diffusion are the per-step log coefficients of TermTable.
+*/
+class BridgedSnowballPricer {
+public:
+    BridgedSnowballPricer(const SnowballPathPricer& daily, const std::vector<Size>& nodes,
+        const std::vector<Real>& drift, const std::vector<Real>& diffusion);
+
+    void reset() {
+        survival_ = 1.0;
+        last_ = 0.0;
+        value_ = 0.0;
+    }
+    bool observed(Size) const { return true; }
+    bool observe(Size k, Real x) {
+        Real y = std::log(x);
+        if (survival_ > 0.0) {
+            for (Size j = skipStart_[k - 1]; j < skipStart_[k]; j++) {
+                const Skipped& d = skipped_[j];
+                Real mean = last_ + d.drift + d.weight * (y - last_);
+                survival_ *= phi_((mean - d.logBarrier) / d.stdDev);
+            }
+        }
+        last_ = y;
+        if (callOb_[k] && x >= callBarrier_[k]) {
+            value_ = coupon_[k] * discount_[k];
+            return true;
+        }
+        if (kiOb_[k] && x < kiBarrier_[k])
+            survival_ = 0.0;
+        return false;
+    }
+    void finish(Real x) {
+        Size n = coupon_.size() - 1;
+        Real knocked = (std::min(std::max(x, minValue_), maxValue_) - 1.0);
+        value_ = ((1.0 - survival_) * knocked + survival_ * coupon_[n]) * discount_[n];
+    }
+    Real value() const { return value_; }
+    Size size() const { return coupon_.size(); }
+    //! knock-in dates priced through the bridge
+    Size skippedDates() const { return skipped_.size(); }
+private:
+    struct Skipped {
+        Real drift, weight, stdDev, logBarrier;
+    };
+    std::vector<Real> coupon_, callBarrier_, kiBarrier_, discount_;
+    std::vector<char> callOb_, kiOb_;
+    Real minValue_, maxValue_;
+    std::vector<Skipped> skipped_;
+    std::vector<Size> skipStart_;       // skipped_ of step k are [skipStart_[k-1], skipStart_[k])
+    CumulativeNormalDistribution phi_;
+    Real survival_, last_, value_;
+};
+
+inline BridgedSnowballPricer::BridgedSnowballPricer(const SnowballPathPricer& daily,
+    const std::vector<Size>& nodes, const std::vector<Real>& drift, const std::vector<Real>& diffusion)
+    : minValue_(daily.minValue()), maxValue_(daily.maxValue()),
+    survival_(1.0), last_(0.0), value_(0.0) {
+    QL_REQUIRE(drift.size() + 1 == daily.size() && diffusion.size() + 1 == daily.size(),
+        "term tables must have one entry per step");
+    QL_REQUIRE(!nodes.empty() && nodes[0] == 0 && nodes.back() + 1 == daily.size(),
+        "nodes must run from 0 to the last step");
+    skipStart_.push_back(0);
+    for (Size k = 0; k < nodes.size(); k++) {
+        Size i = nodes[k];
+        coupon_.push_back(daily.coupon()[i]);
+        callOb_.push_back(daily.callOb()[i]);
+        callBarrier_.push_back(daily.callBarrier()[i]);
+        kiOb_.push_back(daily.kiOb()[i]);
+        kiBarrier_.push_back(daily.kiBarrier()[i]);
+        discount_.push_back(daily.discount()[i]);
+        if (k == 0)
+            continue;
+        // cumulative log drift and variance from node k-1 to each fine date
+        Size a = nodes[k - 1];
+        std::vector<Real> m(1, 0.0), v(1, 0.0);
+        for (Size j = a; j < i; j++) {
+            m.push_back(m.back() + drift[j]);
+            v.push_back(v.back() + diffusion[j] * diffusion[j]);
+        }
+        Real mb = m.back(), vb = v.back();
+        for (Size j = a + 1; j < i; j++) {
+            QL_REQUIRE(!daily.callOb()[j], "call date " << j << " is not a node");
+            if (!daily.kiOb()[j])
+                continue;
+            Real w = v[j - a] / vb;
+            Skipped d = { m[j - a] - w * mb, w, std::sqrt(v[j - a] * (vb - v[j - a]) / vb),
+                std::log(daily.kiBarrier()[j]) };
+            skipped_.push_back(d);
+        }
+        skipStart_.push_back(skipped_.size());
+    }
+}
+
+//===================
+// Multilevel MC
+//===================
+
+//! multilevel Monte Carlo over nested time grids (Giles, 2008)
+/*! Level 0 samples the payoff on the coarsest grid, level l > 0 samples
+    the difference between the payoffs on grids l and l-1 driven by the
+    same Brownian path: the coarse normals are the sums of the fine
+    increments over each coarse step. The last level is the full grid,
+    so the estimator has no bias against a single-level run on it.
+    Level l draws from its own Philox stream, so runs are reproducible
+    whatever the order in which samples are added.
+
+    Pricer follows the price_next interface; pricers[l] is the payoff
+    on the grid of level l.
+*/
+template <class Pricer>
+class MultilevelMonteCarlo {
+public:
+    struct LevelStatistics {
+        Size samples;
+        Real sum, sumSquares;           // of the level correction
+        Real fineSum, fineSumSquares;   // of the fine payoff alone
+        Real cost;                      // steps evolved per sample
+    };
+
+    MultilevelMonteCarlo(const ext::shared_ptr<StochasticProcess1D>& process,
+        const TimeGrid& grid, const std::vector<std::vector<Size> >& nodes,
+        const std::vector<Pricer>& pricers, BigNatural seed);
+
+    Size levels() const { return stats_.size(); }
+    //! adds n samples to level l
+    void simulate(Size l, Size n);
+    //! samples per level that reach the target rmse at minimal cost
+    std::vector<Size> optimalSamples(Real rmse) const;
+
+    Real value() const;
+    Real errorEstimate() const;
+    const LevelStatistics& level(Size l) const { return stats_[l]; }
+    Real variance(Size l) const;
+    //! total cost in evolved steps
+    Real cost() const;
+    //! cost of a plain run on the full grid with the same rmse
+    Real singleLevelCost(Real rmse) const;
+private:
+    typedef MyPathGenerator<PhiloxRsg> generator_type;
+    std::vector<TimeGrid> grids_;
+    std::vector<generator_type> fine_, coarse_;         // coarse_[l - 1] pairs with level l
+    std::vector<Pricer> finePricers_, coarsePricers_;
+    std::vector<std::vector<Size> > groups_;    // fine steps per coarse step
+    std::vector<LevelStatistics> stats_;
+    std::vector<Real> coarseZ_;
+};
+
+template <class Pricer>
+MultilevelMonteCarlo<Pricer>::MultilevelMonteCarlo(
+    const ext::shared_ptr<StochasticProcess1D>& process,
+    const TimeGrid& grid, const std::vector<std::vector<Size> >& nodes,
+    const std::vector<Pricer>& pricers, BigNatural seed) {
+    Size L = nodes.size();
+    QL_REQUIRE(pricers.size() == L, pricers.size() << " pricers given for " << L << " levels");
+    for (Size l = 0; l < L; l++) {
+        std::vector<Time> times;
+        for (Size k = 0; k < nodes[l].size(); k++)
+            times.push_back(grid[nodes[l][k]]);
+        grids_.push_back(TimeGrid(times.begin(), times.end()));
+        QL_REQUIRE(grids_[l].size() == nodes[l].size(), "level " << l << " grid has repeated times");
+        QL_REQUIRE(pricers[l].size() == nodes[l].size(),
+            "pricer of level " << l << " has " << pricers[l].size() << " dates");
+    }
+    stats_.resize(L);
+    groups_.resize(L);
+    for (Size l = 0; l < L; l++) {
+        Size steps = grids_[l].size() - 1;
+        fine_.push_back(generator_type(process, grids_[l], PhiloxRsg(steps, seed, l), false));
+        finePricers_.push_back(pricers[l]);
+        LevelStatistics s = { 0, 0.0, 0.0, 0.0, 0.0, (Real)steps };
+        if (l > 0) {
+            // the coarse path never draws, it only evolves set_bm normals
+            Size coarse_steps = grids_[l - 1].size() - 1;
+            coarse_.push_back(generator_type(process, grids_[l - 1], PhiloxRsg(coarse_steps, seed, l), false));
+            coarsePricers_.push_back(pricers[l - 1]);
+            s.cost += coarse_steps;
+            Size j = 0;
+            for (Size k = 1; k < nodes[l - 1].size(); k++) {
+                Size count = 0;
+                while (nodes[l][j] < nodes[l - 1][k]) {
+                    j++;
+                    count++;
+                }
+                groups_[l].push_back(count);
+            }
+        }
+        stats_[l] = s;
+    }
+}
+
+template <class Pricer>
+void MultilevelMonteCarlo<Pricer>::simulate(Size l, Size n)
+{
+    LevelStatistics& s = stats_[l];
+    const generator_type& fine = fine_[l];
+    for (Size m = 0; m < n; m++) {
+        fine.gen_bm();
+        Real p_fine = fine.price_next(finePricers_[l]);
+        Real y = p_fine;
+        if (l > 0) {
+            // coarse increments are the sums of the fine increments
+            const std::vector<Real>& z = fine.bm();
+            const TimeGrid& fg = grids_[l];
+            const TimeGrid& cg = grids_[l - 1];
+            coarseZ_.resize(cg.size() - 1);
+            Size j = 0;
+            for (Size k = 0; k < groups_[l].size(); k++) {
+                Real w = 0.0;
+                for (Size g = 0; g < groups_[l][k]; g++, j++)
+                    w += std::sqrt(fg.dt(j)) * z[j];
+                coarseZ_[k] = w / std::sqrt(cg.dt(k));
+            }
+            coarse_[l - 1].set_bm(coarseZ_);
+            y -= coarse_[l - 1].price_next(coarsePricers_[l - 1]);
+        }
+        s.sum += y;
+        s.sumSquares += y * y;
+        s.fineSum += p_fine;
+        s.fineSumSquares += p_fine * p_fine;
+    }
+    s.samples += n;
+}
+
+template <class Pricer>
+Real MultilevelMonteCarlo<Pricer>::variance(Size l) const
+{
+    const LevelStatistics& s = stats_[l];
+    if (s.samples < 2)
+        return 0.0;
+    Real m = s.sum / s.samples;
+    return std::max(s.sumSquares / s.samples - m * m, 0.0) * s.samples / (s.samples - 1.0);
+}
+
+template <class Pricer>
+std::vector<Size> MultilevelMonteCarlo<Pricer>::optimalSamples(Real rmse) const
+{
+    QL_REQUIRE(rmse > 0.0, "target rmse must be positive");
+    // N_l = sqrt(V_l / C_l) * sum_k sqrt(V_k C_k) / rmse^2
+    Real total = 0.0;
+    for (Size l = 0; l < levels(); l++)
+        total += std::sqrt(variance(l) * stats_[l].cost);
+    std::vector<Size> result(levels());
+    for (Size l = 0; l < levels(); l++)
+        result[l] = (Size)std::ceil(std::sqrt(variance(l) / stats_[l].cost) * total / (rmse * rmse));
+    return result;
+}
+
+template <class Pricer>
+Real MultilevelMonteCarlo<Pricer>::value() const
+{
+    Real v = 0.0;
+    for (Size l = 0; l < levels(); l++)
+        if (stats_[l].samples > 0)
+            v += stats_[l].sum / stats_[l].samples;
+    return v;
+}
+
+template <class Pricer>
+Real MultilevelMonteCarlo<Pricer>::errorEstimate() const
+{
+    Real v = 0.0;
+    for (Size l = 0; l < levels(); l++)
+        if (stats_[l].samples > 0)
+            v += variance(l) / stats_[l].samples;
+    return std::sqrt(v);
+}
+
+template <class Pricer>
+Real MultilevelMonteCarlo<Pricer>::cost() const
+{
+    Real c = 0.0;
+    for (Size l = 0; l < levels(); l++)
+        c += stats_[l].samples * stats_[l].cost;
+    return c;
+}
+
+template <class Pricer>
+Real MultilevelMonteCarlo<Pricer>::singleLevelCost(Real rmse) const
+{
+    const LevelStatistics& s = stats_.back();
+    if (s.samples < 2)
+        return 0.0;
+    Real m = s.fineSum / s.samples;
+    Real v = std::max(s.fineSumSquares / s.samples - m * m, 0.0) * s.samples / (s.samples - 1.0);
+    return v / (rmse * rmse) * (grids_.back().size() - 1);
+}
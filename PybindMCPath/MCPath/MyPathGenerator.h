@@ -1,16 +1,20 @@
 /* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
+#pragma once
+
+#include <ql/math/distributions/normaldistribution.hpp>
 #include <ql/methods/montecarlo/brownianbridge.hpp>
 #include <ql/stochasticprocess.hpp>
-#include <pybind11.h>
-#include <numpy.h>
+#include <PathConstruction.h>
+#include <PathObservers.h>
+#include <PathProfiler.h>
+#include <PathWriters.h>
+#include <StridedArray.h>
 
-namespace py = pybind11;
 using namespace QuantLib;
 
-typedef py::detail::unchecked_mutable_reference<double, 2i64> array2d_double;
-typedef py::detail::unchecked_mutable_reference<double, 1i64> array1d_double;
-typedef py::detail::unchecked_mutable_reference<bool, 1i64> array1d_bool;
+// Outputs are any Array with arr(row, i) (or arr(i) for 1-d): a
+// StridedArray over a C++ buffer or a pybind11 unchecked reference.
 
 template <class GSG>
 class MyPathGenerator {
@@ -30,27 +34,49 @@ public:
     //@{
     const sample_type& next() const;
     void gen_bm() const;
-    void copy_bm  (array2d_double& arr, ssize_t& row) const;
-    void copy_next(array2d_double& arr, ssize_t& row) const;
-    void copy_term(array1d_double& drift, array1d_double& stoch) const;
-
-    void copy_next_upout  (array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, double& upout_barrier,         array1d_bool& downout_ob, double& downout_barrier)         const;
-    void copy_next_upout  (array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, array1d_double& upout_barrier, array1d_bool& downout_ob, array1d_double& downout_barrier) const;
-
-    void copy_next_downout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, double& upout_barrier, array1d_bool& downout_ob, double& downout_barrier)         const;
-    void copy_next_downout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, array1d_double& upout_barrier, array1d_bool& downout_ob, array1d_double& downout_barrier) const;
-
-    void copy_next_dualout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, double& upout_barrier,         array1d_bool& downout_ob, double& downout_barrier)         const;
-    void copy_next_dualout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, array1d_double& upout_barrier, array1d_bool& downout_ob, double& downout_barrier)         const;
-    void copy_next_dualout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, double& upout_barrier,         array1d_bool& downout_ob, array1d_double& downout_barrier) const;
-    void copy_next_dualout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, array1d_double& upout_barrier, array1d_bool& downout_ob, array1d_double& downout_barrier) const;
+    //! gen_bm() with the sequence and bridge phases charged to profiler
+    template <class Profiler>
+    void gen_bm(Profiler& profiler) const;
+    template <class Array>
+    void load_bm(const Array& arr, ssize_t row) const;
+    void set_bm(const std::vector<Real>& z) const;
+    //! adds theta[i] to the normal of step i, the likelihood ratio goes to weight()
+    void set_drift_shift(const std::vector<Real>& theta);
+    //! draws the first sequence dimension (W(T) with the bridge) from stratum k of n
+    void set_stratum(Size k, Size n) const;
+    //! builds the steps from the principal components of pca, null goes back to the bridge flag
+    void set_construction(const ext::shared_ptr<PcaConstruction>& pca);
+    template <class Array>
+    void copy_bm  (Array& arr, ssize_t& row) const;
+    template <class Array>
+    void copy_next(Array& arr, ssize_t& row) const;
+    template <class Array>
+    void copy_term(Array& drift, Array& stoch) const;
+
+    //! writes the path of the last draw into row, until observer ends it
+    template <class Array, class Observer>
+    void copy_next(Array& arr, ssize_t& row, Observer& observer) const;
+    //! evolves the last draw into writer until observer ends it
+    template <class Writer, class Observer>
+    PathEnd write_next(Writer& writer, Observer& observer) const;
+    //! write_next() with every step's evolve, write and observe charged to profiler
+    template <class Writer, class Observer, class Profiler>
+    PathEnd write_next(Writer& writer, Observer& observer, Profiler& profiler) const;
+
+    template <class Pricer>
+    Real price_next(Pricer& pricer) const;
 
     const sample_type& antithetic() const;
+    //! bridged normals of the last gen_bm()/load_bm()
+    const std::vector<Real>& bm() const { return temp_; }
+    //! likelihood ratio of the last draw
+    Real weight() const { return next_.weight; }
     Size size() const { return dimension_; }
     const TimeGrid& timeGrid() const { return timeGrid_; }
     //@}
 private:
     const sample_type& next(bool antithetic) const;
+    void shift_bm() const;
     bool brownianBridge_;
     GSG generator_;
     Size dimension_;
@@ -59,6 +85,12 @@ private:
     mutable sample_type next_;
     mutable std::vector<Real> temp_;
     BrownianBridge bb_;
+    ext::shared_ptr<PcaConstruction> pca_;
+    std::vector<Real> shift_;
+    mutable Size stratum_, strata_;
+    mutable std::vector<Real> stratified_;
+    InverseCumulativeNormal icn_;
+    CumulativeNormalDistribution phi_;
 };
 
 template <class GSG>
@@ -71,7 +103,8 @@ MyPathGenerator<GSG>::MyPathGenerator(
     : brownianBridge_(brownianBridge), generator_(generator),
     dimension_(generator_.dimension()), timeGrid_(length, timeSteps),
     process_(ext::dynamic_pointer_cast<StochasticProcess1D>(process)),
-    next_(Path(timeGrid_), 1.0), temp_(dimension_), bb_(timeGrid_) {
+    next_(Path(timeGrid_), 1.0), temp_(dimension_), bb_(timeGrid_),
+    stratum_(0), strata_(1) {
     QL_REQUIRE(dimension_ == timeSteps,
         "sequence generator dimensionality (" << dimension_
         << ") != timeSteps (" << timeSteps << ")");
@@ -86,7 +119,8 @@ MyPathGenerator<GSG>::MyPathGenerator(
     : brownianBridge_(brownianBridge), generator_(generator),
     dimension_(generator_.dimension()), timeGrid_(timeGrid),
     process_(ext::dynamic_pointer_cast<StochasticProcess1D>(process)),
-    next_(Path(timeGrid_), 1.0), temp_(dimension_), bb_(timeGrid_) {
+    next_(Path(timeGrid_), 1.0), temp_(dimension_), bb_(timeGrid_),
+    stratum_(0), strata_(1) {
     QL_REQUIRE(dimension_ == timeGrid_.size() - 1,
         "sequence generator dimensionality (" << dimension_
         << ") != timeSteps (" << timeGrid_.size() - 1 << ")");
@@ -113,7 +147,12 @@ const typename MyPathGenerator<GSG>::sample_type&
         antithetic ? generator_.lastSequence()
         : generator_.nextSequence();
 
-    if (brownianBridge_) {
+    if (pca_) {
+        pca_->transform(sequence_.value.begin(),
+            sequence_.value.end(),
+            temp_.begin());
+    }
+    else if (brownianBridge_) {
         bb_.transform(sequence_.value.begin(),
             sequence_.value.end(),
             temp_.begin());
@@ -146,25 +185,106 @@ const typename MyPathGenerator<GSG>::sample_type&
 
 template <class GSG>
 void MyPathGenerator<GSG>::gen_bm() const
+{
+    NoProfiler profiler;
+    gen_bm(profiler);
+}
+
+template <class GSG>
+template <class Profiler>
+void MyPathGenerator<GSG>::gen_bm(Profiler& profiler) const
 {
     typedef typename GSG::sample_type sequence_type;
+    std::uint64_t t = profiler.start();
     const sequence_type& sequence_ = generator_.nextSequence();
+    t = profiler.lap(SequencePhase, t);
+    const Real* z = &sequence_.value[0];
+    if (strata_ > 1) {
+        // z[0] -> Phi^-1((k + Phi(z[0])) / n)
+        stratified_.assign(sequence_.value.begin(), sequence_.value.end());
+        stratified_[0] = icn_((stratum_ + phi_(z[0])) / strata_);
+        z = &stratified_[0];
+    }
 
-    if (brownianBridge_) {
-        bb_.transform(sequence_.value.begin(),
-            sequence_.value.end(),
-            temp_.begin());
+    if (pca_) {
+        pca_->transform(z, z + dimension_, temp_.begin());
+    }
+    else if (brownianBridge_) {
+        bb_.transform(z, z + dimension_, temp_.begin());
     }
     else {
-        std::copy(sequence_.value.begin(),
-            sequence_.value.end(),
-            temp_.begin());
+        std::copy(z, z + dimension_, temp_.begin());
     }
     next_.weight = sequence_.weight;
+    shift_bm();
+    profiler.lap(BridgePhase, t);
+}
+
+// Reuses bridged normals saved by GenerateRS/copy_bm (columns 1..steps of
+// row), so repricings under new market data see the same random numbers.
+template <class GSG>
+template <class Array>
+void MyPathGenerator<GSG>::load_bm(const Array& arr, ssize_t row) const
+{
+    for (Size i = 1; i < next_.value.length(); i++)
+        temp_[i - 1] = arr(row, i);
+    next_.weight = 1.0;
+    shift_bm();
+}
+
+// Importance sampling: the normals are drawn from N(theta, 1) instead of
+// N(0, 1), so each path is weighted by exp(-sum theta*z + sum theta^2/2).
+template <class GSG>
+void MyPathGenerator<GSG>::set_drift_shift(const std::vector<Real>& theta)
+{
+    QL_REQUIRE(theta.empty() || theta.size() == dimension_,
+        theta.size() << " shifts given for " << dimension_ << " steps");
+    shift_ = theta;
+}
+
+template <class GSG>
+void MyPathGenerator<GSG>::shift_bm() const
+{
+    if (shift_.empty())
+        return;
+    Real log_weight = 0.0;
+    for (Size i = 0; i < dimension_; i++) {
+        temp_[i] += shift_[i];
+        log_weight += shift_[i] * (0.5 * shift_[i] - temp_[i]);
+    }
+    next_.weight *= std::exp(log_weight);
+}
+
+template <class GSG>
+void MyPathGenerator<GSG>::set_construction(const ext::shared_ptr<PcaConstruction>& pca)
+{
+    QL_REQUIRE(!pca || pca->size() == dimension_,
+        "PCA construction of " << pca->size() << " steps given for " << dimension_ << " steps");
+    pca_ = pca;
 }
 
 template <class GSG>
-void MyPathGenerator<GSG>::copy_term(array1d_double& drift, array1d_double& stoch) const
+void MyPathGenerator<GSG>::set_stratum(Size k, Size n) const
+{
+    QL_REQUIRE(n > 0 && k < n, "stratum " << k << " out of " << n);
+    stratum_ = k;
+    strata_ = n;
+}
+
+// Uses z (one standard normal per step) as the bridged normals of the
+// next path, e.g. coarse-grid normals built from a finer path.
+template <class GSG>
+void MyPathGenerator<GSG>::set_bm(const std::vector<Real>& z) const
+{
+    QL_REQUIRE(z.size() == temp_.size(),
+        z.size() << " normals given for " << temp_.size() << " steps");
+    std::copy(z.begin(), z.end(), temp_.begin());
+    next_.weight = 1.0;
+}
+
+template <class GSG>
+template <class Array>
+void MyPathGenerator<GSG>::copy_term(Array& drift, Array& stoch) const
 {
     Path& path = next_.value;
     Real last = 1;
@@ -180,34 +300,18 @@ void MyPathGenerator<GSG>::copy_term(array1d_double& drift, array1d_double& stoc
 }
 
 template <class GSG>
-void MyPathGenerator<GSG>::copy_bm(array2d_double& arr, ssize_t& row) const
+template <class Array>
+void MyPathGenerator<GSG>::copy_bm(Array& arr, ssize_t& row) const
 {
     typedef typename GSG::sample_type sequence_type;
     const sequence_type& sequence_ = generator_.nextSequence();
 
-    if (brownianBridge_) {
-        bb_.transform(sequence_.value.begin(),
+    if (pca_) {
+        pca_->transform(sequence_.value.begin(),
             sequence_.value.end(),
             temp_.begin());
     }
-    else {
-        std::copy(sequence_.value.begin(),
-            sequence_.value.end(),
-            temp_.begin());
-    }
-    for (Size i = 1; i < next_.value.length(); i++)
-        arr(row, i) = temp_[i-1];
-
-    //next_.weight = sequence_.weight;
-}
-
-template <class GSG>
-void MyPathGenerator<GSG>::copy_next(array2d_double& arr, ssize_t& row) const
-{
-    typedef typename GSG::sample_type sequence_type;
-    const sequence_type& sequence_ = generator_.nextSequence();
-
-    if (brownianBridge_) {
+    else if (brownianBridge_) {
         bb_.transform(sequence_.value.begin(),
             sequence_.value.end(),
             temp_.begin());
@@ -217,158 +321,94 @@ void MyPathGenerator<GSG>::copy_next(array2d_double& arr, ssize_t& row) const
             sequence_.value.end(),
             temp_.begin());
     }
+    for (Size i = 1; i < next_.value.length(); i++)
+        arr(row, i) = temp_[i-1];
 
-    next_.weight = sequence_.weight;
-
-    Path& path = next_.value;
-    Real last = 1;
-    arr(row, 0) = 1;
-    for (Size i = 1; i < path.length(); i++) {
-        Time t = timeGrid_[i - 1];
-        Time dt = timeGrid_.dt(i - 1);
-        Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        last = new_value;
-    }
-}
-
-template <class GSG>
-void MyPathGenerator<GSG>::copy_next_upout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, double& upout_barrier, array1d_bool& downout_ob, double& downout_barrier) const
-{
-    Path& path = next_.value;
-    Real last = 1;
-    arr(row, 0) = 1;
-    for (Size i = 1; i < path.length(); i++) {
-        Time t = timeGrid_[i - 1];
-        Time dt = timeGrid_.dt(i - 1);
-        Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        if (upout_ob(i) && new_value >= upout_barrier)
-            break;
-        last = new_value;
-    }
-}
-
-template <class GSG>
-void MyPathGenerator<GSG>::copy_next_upout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, array1d_double& upout_barrier, array1d_bool& downout_ob, array1d_double& downout_barrier) const
-{
-    Path& path = next_.value;
-    Real last = 1;
-    arr(row, 0) = 1;
-    for (Size i = 1; i < path.length(); i++) {
-        Time t = timeGrid_[i - 1];
-        Time dt = timeGrid_.dt(i - 1);
-        Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        if (upout_ob(i) && new_value >= upout_barrier(i))
-            break;
-        last = new_value;
-    }
+    //next_.weight = sequence_.weight;
 }
 
 template <class GSG>
-void MyPathGenerator<GSG>::copy_next_downout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, double& upout_barrier, array1d_bool& downout_ob, double& downout_barrier) const
+template <class Array>
+void MyPathGenerator<GSG>::copy_next(Array& arr, ssize_t& row) const
 {
-    Path& path = next_.value;
-    Real last = 1;
-    arr(row, 0) = 1;
-    for (Size i = 1; i < path.length(); i++) {
-        Time t = timeGrid_[i - 1];
-        Time dt = timeGrid_.dt(i - 1);
-        Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        if (downout_ob(i) && new_value < downout_barrier)
-            break;
-        last = new_value;
-    }
+    NoObserver observer;
+    copy_next(arr, row, observer);
 }
 
 template <class GSG>
-void MyPathGenerator<GSG>::copy_next_downout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, array1d_double& upout_barrier, array1d_bool& downout_ob, array1d_double& downout_barrier) const
+template <class Array, class Observer>
+void MyPathGenerator<GSG>::copy_next(Array& arr, ssize_t& row, Observer& observer) const
 {
-    Path& path = next_.value;
-    Real last = 1;
-    arr(row, 0) = 1;
-    for (Size i = 1; i < path.length(); i++) {
-        Time t = timeGrid_[i - 1];
-        Time dt = timeGrid_.dt(i - 1);
-        Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        if (downout_ob(i) && new_value < downout_barrier(i))
-            break;
-        last = new_value;
-    }
+    RowWriter<Array> writer(arr);
+    writer.row((Size)row);
+    write_next(writer, observer);
 }
 
+// The single path loop: where values go (Writer) and barrier, knock-in
+// and accrual logic (Observer) are compile-time policies, so each
+// combination gets its own loop and unused checks cost nothing.
 template <class GSG>
-void MyPathGenerator<GSG>::copy_next_dualout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, array1d_double& upout_barrier, array1d_bool& downout_ob, double& downout_barrier) const
+template <class Writer, class Observer>
+PathEnd MyPathGenerator<GSG>::write_next(Writer& writer, Observer& observer) const
 {
-    Path& path = next_.value;
-    Real last = 1;
-    arr(row, 0) = 1;
-    for (Size i = 1; i < path.length(); i++) {
-        Time t = timeGrid_[i - 1];
-        Time dt = timeGrid_.dt(i - 1);
-        Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        if ((upout_ob(i) && new_value >= upout_barrier(i)) || (downout_ob(i) && new_value < downout_barrier))
-            break;
-        last = new_value;
-    }
+    NoProfiler profiler;
+    return write_next(writer, observer, profiler);
 }
 
 template <class GSG>
-void MyPathGenerator<GSG>::copy_next_dualout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, double& upout_barrier, array1d_bool& downout_ob, array1d_double& downout_barrier) const
+template <class Writer, class Observer, class Profiler>
+PathEnd MyPathGenerator<GSG>::write_next(Writer& writer, Observer& observer, Profiler& profiler) const
 {
     Path& path = next_.value;
     Real last = 1;
-    arr(row, 0) = 1;
+    writer.write(0, last);
+    observer.reset();
     for (Size i = 1; i < path.length(); i++) {
         Time t = timeGrid_[i - 1];
         Time dt = timeGrid_.dt(i - 1);
+        std::uint64_t tick = profiler.start();
         Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        if ((upout_ob(i) && new_value >= upout_barrier) || (downout_ob(i) && new_value < downout_barrier(i)))
-            break;
+        tick = profiler.lap(EvolvePhase, tick);
+        writer.write(i, new_value);
+        tick = profiler.lap(WritePhase, tick);
+        bool stop = observer.observe(i, new_value);
+        profiler.lap(ObservePhase, tick);
+        if (stop) {
+            writer.stop(i);
+            PathEnd end = { i, new_value };
+            return end;
+        }
         last = new_value;
     }
+    PathEnd end = { 0, last };
+    return end;
 }
 
-template <class GSG>
-void MyPathGenerator<GSG>::copy_next_dualout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, double& upout_barrier, array1d_bool& downout_ob, double& downout_barrier) const
-{
-    Path& path = next_.value;
-    Real last = 1;
-    arr(row, 0) = 1;
-    for (Size i = 1; i < path.length(); i++) {
-        Time t = timeGrid_[i - 1];
-        Time dt = timeGrid_.dt(i - 1);
-        Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        if ((upout_ob(i) && new_value >= upout_barrier) || (downout_ob(i) && new_value < downout_barrier))
-            break;
-        last = new_value;
-    }
-}
+//===================
+// Fused Pricers
+//===================
 
+// Evolves the path drawn by gen_bm() without storing it; the pricer sees
+// every step through observe(i, x) and may stop the path early, otherwise
+// finish(x) receives the terminal value.
 template <class GSG>
-void MyPathGenerator<GSG>::copy_next_dualout(array2d_double& arr, ssize_t& row, array1d_bool& upout_ob, array1d_double& upout_barrier, array1d_bool& downout_ob, array1d_double& downout_barrier) const
+template <class Pricer>
+Real MyPathGenerator<GSG>::price_next(Pricer& pricer) const
 {
     Path& path = next_.value;
     Real last = 1;
-    arr(row, 0) = 1;
+    pricer.reset();
     for (Size i = 1; i < path.length(); i++) {
         Time t = timeGrid_[i - 1];
         Time dt = timeGrid_.dt(i - 1);
-        Real new_value = process_->evolve(t, last, dt, temp_[i - 1]);
-        arr(row, i) = new_value;
-        if ((upout_ob(i) && new_value >= upout_barrier(i)) || (downout_ob(i) && new_value < downout_barrier(i)))
-            break;
-        last = new_value;
+        last = process_->evolve(t, last, dt, temp_[i - 1]);
+        if (pricer.observe(i, last))
+            return pricer.value();
     }
+    pricer.finish(last);
+    return pricer.value();
 }
 
-
 //===================
 // Custom RSG
 //===================
@@ -443,7 +483,13 @@ public:
         bool brownianBridge);
 
     void gen_bm() const;
-    void copy_bm(array2d_double& arr, ssize_t& row) const;
+    template <class Array>
+    void copy_bm(Array& arr, ssize_t& row) const;
+    //! writes 0 and the bridged normals of the last gen_bm() as steps 0..steps
+    template <class Writer>
+    void write_bm(Writer& writer) const;
+    //! as MyPathGenerator::set_construction
+    void set_construction(const ext::shared_ptr<PcaConstruction>& pca);
     Size size() const { return dimension_; }
     const TimeGrid& timeGrid() const { return timeGrid_; }
 
@@ -455,6 +501,7 @@ private:
     mutable sample_type next_;
     mutable std::vector<Real> temp_;
     BrownianBridge bb_;
+    ext::shared_ptr<PcaConstruction> pca_;
 };
 
 template <class GSG>
@@ -472,12 +519,26 @@ MyRandomSequenceGenerator<GSG>::MyRandomSequenceGenerator(
 }
 
 template <class GSG>
-void MyRandomSequenceGenerator<GSG>::copy_bm(array2d_double& arr, ssize_t& row) const
+void MyRandomSequenceGenerator<GSG>::set_construction(const ext::shared_ptr<PcaConstruction>& pca)
+{
+    QL_REQUIRE(!pca || pca->size() == dimension_,
+        "PCA construction of " << pca->size() << " steps given for " << dimension_ << " steps");
+    pca_ = pca;
+}
+
+template <class GSG>
+template <class Array>
+void MyRandomSequenceGenerator<GSG>::copy_bm(Array& arr, ssize_t& row) const
 {
     typedef typename GSG::sample_type sequence_type;
     const sequence_type& sequence_ = generator_.nextSequence();
 
-    if (brownianBridge_) {
+    if (pca_) {
+        pca_->transform(sequence_.value.begin(),
+            sequence_.value.end(),
+            temp_.begin());
+    }
+    else if (brownianBridge_) {
         bb_.transform(sequence_.value.begin(),
             sequence_.value.end(),
             temp_.begin());
@@ -491,13 +552,27 @@ void MyRandomSequenceGenerator<GSG>::copy_bm(array2d_double& arr, ssize_t& row)
         arr(row, i) = temp_[i - 1];
 }
 
+template <class GSG>
+template <class Writer>
+void MyRandomSequenceGenerator<GSG>::write_bm(Writer& writer) const
+{
+    writer.write(0, 0.0);
+    for (Size i = 1; i < next_.value.length(); i++)
+        writer.write(i, temp_[i - 1]);
+}
+
 template <class GSG>
 void MyRandomSequenceGenerator<GSG>::gen_bm() const
 {
     typedef typename GSG::sample_type sequence_type;
     const sequence_type& sequence_ = generator_.nextSequence();
 
-    if (brownianBridge_) {
+    if (pca_) {
+        pca_->transform(sequence_.value.begin(),
+            sequence_.value.end(),
+            temp_.begin());
+    }
+    else if (brownianBridge_) {
         bb_.transform(sequence_.value.begin(),
             sequence_.value.end(),
             temp_.begin());
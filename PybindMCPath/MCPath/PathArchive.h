@@ -0,0 +1,596 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/errors.hpp>
+#include <ql/types.hpp>
+#include <PathJob.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace QuantLib;
+
+//===================
+// Archive Format
+//===================
+
+// A path archive stores each path as its spot and the log-returns of its
+// steps, in independent blocks of rows:
+//
+//   block 0 | block 1 | ... | index: uint64 offset of each block and end | footer
+//
+// A block holds its row count and exponent, the spot and the number of
+// valid returns of each row (paths truncated by a knock-out stop early),
+// one Rice parameter and the end offset of each column, then the columns
+// of returns one after the other. Columns come in step order, so reading
+// steps [0, j] of a block touches only the front of it.
+//
+// Returns are quantized with error feedback: each is encoded as the
+// difference between the exact log price and the log price decoded so
+// far, so errors do not add up along the path and every decoded price
+// is within the tolerance of the original in log terms. SharedExponent
+// stores integer multiples of 2^exponent, one exponent per archive chosen
+// from the tolerance and repeated in every block header and the footer,
+// Rice-coded per column. HalfFloat stores the differences as IEEE
+// float16, with no tolerance to choose.
+
+enum ArchiveEncoding {
+    HalfFloat, SharedExponent
+};
+
+namespace archive_detail {
+
+    const char magic[4] = { 'M', 'C', 'P', 'A' };
+    const std::uint32_t version = 1;
+    // longest unary prefix before a value is stored raw
+    const std::uint32_t escape = 24;
+
+    struct Footer {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t rows;
+        std::uint32_t steps;
+        std::uint32_t blockRows;
+        std::uint32_t encoding;
+        std::int32_t exponent;
+        double tolerance;
+        std::uint64_t indexOffset;
+        std::uint64_t blocks;
+    };
+
+    struct BlockHeader {
+        std::uint32_t rows;
+        std::int32_t exponent;
+    };
+
+    inline std::uint32_t zigzag(std::int32_t v) {
+        return ((std::uint32_t)v << 1) ^ (std::uint32_t)(v >> 31);
+    }
+    inline std::int32_t unzigzag(std::uint32_t u) {
+        return (std::int32_t)(u >> 1) ^ -(std::int32_t)(u & 1);
+    }
+
+    inline std::uint16_t toHalf(float f) {
+        std::uint32_t x;
+        std::memcpy(&x, &f, 4);
+        std::uint32_t sign = (x >> 16) & 0x8000, mantissa = x & 0x7fffff;
+        std::int32_t exponent = (std::int32_t)((x >> 23) & 0xff) - 127 + 15;
+        if (exponent >= 31)
+            return (std::uint16_t)(sign | 0x7c00);
+        if (exponent <= 0) {
+            if (exponent < -10)
+                return (std::uint16_t)sign;
+            // subnormal, round to nearest even
+            mantissa |= 0x800000;
+            std::uint32_t shift = (std::uint32_t)(14 - exponent);
+            std::uint32_t half = mantissa >> shift, rest = mantissa & ((1u << shift) - 1);
+            std::uint32_t mid = 1u << (shift - 1);
+            if (rest > mid || (rest == mid && (half & 1)))
+                half++;
+            return (std::uint16_t)(sign | half);
+        }
+        std::uint32_t half = ((std::uint32_t)exponent << 10) | (mantissa >> 13);
+        std::uint32_t rest = mantissa & 0x1fff;
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+            half++;     // may carry into the exponent, which is still right
+        return (std::uint16_t)(sign | half);
+    }
+    inline float fromHalf(std::uint16_t h) {
+        std::uint32_t sign = (std::uint32_t)(h & 0x8000) << 16;
+        std::uint32_t exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+        std::uint32_t x;
+        if (exponent == 0) {
+            if (mantissa == 0)
+                x = sign;
+            else {
+                exponent = 127 - 15 + 1;
+                while (!(mantissa & 0x400)) {
+                    mantissa <<= 1;
+                    exponent--;
+                }
+                x = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+            }
+        }
+        else if (exponent == 31)
+            x = sign | 0x7f800000 | (mantissa << 13);
+        else
+            x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        float f;
+        std::memcpy(&f, &x, 4);
+        return f;
+    }
+
+    //! LSB-first bit stream
+    class BitWriter {
+    public:
+        explicit BitWriter(std::vector<char>& out) : out_(out), bits_(0), count_(0) {}
+        void put(std::uint64_t value, std::uint32_t n) {
+            bits_ |= value << count_;
+            count_ += n;
+            while (count_ >= 8) {
+                out_.push_back((char)(bits_ & 0xff));
+                bits_ >>= 8;
+                count_ -= 8;
+            }
+        }
+        void rice(std::uint32_t u, std::uint32_t k) {
+            std::uint32_t q = u >> k;
+            if (q >= escape) {
+                put((1u << escape) - 1, escape);
+                put(u, 32);
+                return;
+            }
+            put((1u << q) - 1, q + 1);
+            put(u & ((1u << k) - 1), k);
+        }
+        //! pads to a whole byte
+        void flush() {
+            if (count_ > 0)
+                put(0, 8 - count_);
+        }
+    private:
+        std::vector<char>& out_;
+        std::uint64_t bits_;
+        std::uint32_t count_;
+    };
+
+    //! reads a BitWriter stream, which must be followed by 8 readable bytes
+    class BitReader {
+    public:
+        explicit BitReader(const char* data) : data_(data), pos_(0) {}
+        std::uint64_t peek() const {
+            std::uint64_t x;
+            std::memcpy(&x, data_ + (pos_ >> 3), 8);
+            return x >> (pos_ & 7);
+        }
+        std::uint32_t get(std::uint32_t n) {
+            std::uint32_t x = n ? (std::uint32_t)(peek() & ((std::uint64_t(1) << n) - 1)) : 0;
+            pos_ += n;
+            return x;
+        }
+        std::uint32_t rice(std::uint32_t k) {
+            std::uint64_t bits = peek();
+            std::uint32_t q = 0;
+            while ((bits & 1) && q < escape) {
+                bits >>= 1;
+                q++;
+            }
+            if (q == escape) {
+                pos_ += escape;
+                return get(32);
+            }
+            pos_ += q + 1;
+            return (q << k) | get(k);
+        }
+    private:
+        const char* data_;
+        std::uint64_t pos_;
+    };
+
+    template <class T>
+    inline T load(const char* p) {
+        T x;
+        std::memcpy(&x, p, sizeof(T));
+        return x;
+    }
+
+}
+
+//===================
+// Archive Writer
+//===================
+
+//! appends paths to an archive file, one block of rows at a time
+/*! Paths are steps+1 positive prices, NaN after the step a knock-out
+    stopped them (as TruncatedRowWriter leaves them). Blocks are
+    independent, so an archive can be written a chunk of paths at a time
+    without holding all of them. close() writes the index; an archive
+    that was not closed cannot be read.
+*/
+class PathArchiveWriter {
+public:
+    PathArchiveWriter(const std::string& file, Size steps, Size blockRows = 4096,
+                      ArchiveEncoding encoding = SharedExponent, Real tolerance = 1.0e-4);
+    ~PathArchiveWriter();
+
+    //! appends path(0), ..., path(steps) where path(i) = data[i*stride]
+    void append(const Real* data, std::ptrdiff_t stride = 1);
+    void close();
+
+    Size rows() const { return rows_; }
+    Size steps() const { return steps_; }
+    //! bytes written so far
+    std::uint64_t bytes() const { return offsets_.back(); }
+    //! largest |log(decoded) - log(original)| so far
+    Real maxError() const { return maxError_; }
+private:
+    void flushBlock();
+    std::ofstream out_;
+    Size steps_, blockRows_;
+    ArchiveEncoding encoding_;
+    Real tolerance_, quantum_;
+    int exponent_;
+    std::vector<Real> logs_;            // block rows x (steps+1) log prices
+    std::vector<std::uint32_t> length_;
+    std::vector<std::uint64_t> offsets_;
+    Size rows_;
+    Real maxError_;
+    bool closed_;
+};
+
+inline PathArchiveWriter::PathArchiveWriter(const std::string& file, Size steps, Size blockRows,
+                                            ArchiveEncoding encoding, Real tolerance)
+    : out_(file.c_str(), std::ios::binary | std::ios::trunc), steps_(steps),
+    blockRows_(blockRows), encoding_(encoding), tolerance_(tolerance), quantum_(0.0), exponent_(0),
+    offsets_(1, 0), rows_(0), maxError_(0.0), closed_(false) {
+    QL_REQUIRE(out_, "cannot open archive file " << file);
+    QL_REQUIRE(steps > 0 && blockRows > 0, "steps and block rows must be positive");
+    QL_REQUIRE(encoding == HalfFloat || encoding == SharedExponent, "Archive encoding is not surppoted.");
+    if (encoding == SharedExponent) {
+        QL_REQUIRE(tolerance > 0.0, "tolerance must be positive");
+        // rounding to multiples of 2^exponent errs by at most half of it
+        exponent_ = (int)std::floor(std::log2(2.0 * tolerance));
+        quantum_ = std::ldexp(1.0, exponent_);
+    }
+    logs_.reserve(blockRows * (steps + 1));
+    length_.reserve(blockRows);
+}
+
+inline PathArchiveWriter::~PathArchiveWriter()
+{
+    try {
+        close();
+    }
+    catch (...) {}
+}
+
+inline void PathArchiveWriter::append(const Real* data, std::ptrdiff_t stride)
+{
+    QL_REQUIRE(!closed_, "archive is closed");
+    std::uint32_t length = (std::uint32_t)steps_;
+    for (Size i = 0; i <= steps_; i++) {
+        Real x = data[(std::ptrdiff_t)i * stride];
+        if (i > 0 && std::isnan(x)) {
+            length = (std::uint32_t)(i - 1);
+            break;
+        }
+        QL_REQUIRE(x > 0.0 && std::isfinite(x), "path values must be positive, row " << rows_ << " step " << i);
+    }
+    for (Size i = 0; i <= steps_; i++)
+        logs_.push_back(i <= length ? std::log(data[(std::ptrdiff_t)i * stride]) : 0.0);
+    length_.push_back(length);
+    rows_++;
+    if (length_.size() == blockRows_)
+        flushBlock();
+}
+
+inline void PathArchiveWriter::flushBlock()
+{
+    using namespace archive_detail;
+    Size n = length_.size(), width = steps_ + 1;
+    if (n == 0)
+        return;
+    BlockHeader header = { (std::uint32_t)n, exponent_ };
+    std::vector<char> block(sizeof(BlockHeader));
+    std::memcpy(&block[0], &header, sizeof(BlockHeader));
+    Size spots = block.size();
+    Size lengths = spots + n * sizeof(double);
+    Size ks = lengths + n * sizeof(std::uint32_t);
+    Size ends = ks + steps_;
+    Size data = ends + steps_ * sizeof(std::uint32_t);
+    block.resize(data);
+    std::vector<Real> decoded(n);
+    for (Size r = 0; r < n; r++) {
+        Real s0 = std::exp(logs_[r * width]);
+        std::memcpy(&block[spots + r * sizeof(double)], &s0, sizeof(double));
+        std::memcpy(&block[lengths + r * sizeof(std::uint32_t)], &length_[r], sizeof(std::uint32_t));
+        decoded[r] = std::log(s0);
+    }
+    std::vector<std::uint32_t> u(n);
+    BitWriter bits(block);
+    for (Size j = 1; j <= steps_; j++) {
+        std::uint32_t k = 0;
+        if (encoding_ == SharedExponent) {
+            // Rice parameter from the mean of the column's codes
+            std::uint64_t sum = 0, count = 0;
+            for (Size r = 0; r < n; r++) {
+                if (length_[r] < j)
+                    continue;
+                Real q = std::floor((logs_[r * width + j] - decoded[r]) / quantum_ + 0.5);
+                QL_REQUIRE(std::fabs(q) < 1.0e9, "log-return too large for the tolerance, row " << rows_ - n + r);
+                u[r] = zigzag((std::int32_t)q);
+                decoded[r] += q * quantum_;
+                sum += u[r];
+                count++;
+            }
+            while (k < 30 && (count << (k + 1)) <= sum)
+                k++;
+            for (Size r = 0; r < n; r++)
+                if (length_[r] >= j)
+                    bits.rice(u[r], k);
+        }
+        else {
+            for (Size r = 0; r < n; r++) {
+                if (length_[r] < j)
+                    continue;
+                std::uint16_t h = toHalf((float)(logs_[r * width + j] - decoded[r]));
+                decoded[r] += (Real)fromHalf(h);
+                bits.put(h, 16);
+            }
+        }
+        bits.flush();
+        for (Size r = 0; r < n; r++)
+            if (length_[r] >= j)
+                maxError_ = std::max(maxError_, std::fabs(logs_[r * width + j] - decoded[r]));
+        block[ks + j - 1] = (char)k;
+        std::uint32_t end = (std::uint32_t)(block.size() - data);
+        std::memcpy(&block[ends + (j - 1) * sizeof(std::uint32_t)], &end, sizeof(std::uint32_t));
+    }
+    // room for the readers' 8-byte loads
+    block.resize(block.size() + 8, 0);
+    out_.write(&block[0], block.size());
+    QL_REQUIRE(out_, "cannot write archive");
+    offsets_.push_back(offsets_.back() + block.size());
+    logs_.clear();
+    length_.clear();
+}
+
+inline void PathArchiveWriter::close()
+{
+    using namespace archive_detail;
+    if (closed_)
+        return;
+    flushBlock();
+    closed_ = true;
+    Footer footer;
+    std::memcpy(footer.magic, magic, 4);
+    footer.version = version;
+    footer.rows = rows_;
+    footer.steps = (std::uint32_t)steps_;
+    footer.blockRows = (std::uint32_t)blockRows_;
+    footer.encoding = (std::uint32_t)encoding_;
+    footer.exponent = exponent_;
+    footer.tolerance = encoding_ == SharedExponent ? tolerance_ : 0.0;
+    footer.indexOffset = offsets_.back();
+    footer.blocks = offsets_.size() - 1;
+    out_.write((const char*)&offsets_[0], offsets_.size() * sizeof(std::uint64_t));
+    out_.write((const char*)&footer, sizeof(Footer));
+    offsets_.push_back(offsets_.back() + offsets_.size() * sizeof(std::uint64_t) + sizeof(Footer));
+    out_.close();
+    QL_REQUIRE(!out_.fail(), "cannot write archive");
+}
+
+//===================
+// Archive Reader
+//===================
+
+//! read-only memory map of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& file);
+    ~MappedFile();
+    const char* data() const { return data_; }
+    std::uint64_t size() const { return size_; }
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+    const char* data_;
+    std::uint64_t size_;
+#if defined(_WIN32)
+    HANDLE file_, mapping_;
+#endif
+};
+
+#if defined(_WIN32)
+inline MappedFile::MappedFile(const std::string& file) : data_(0), size_(0), mapping_(0)
+{
+    file_ = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL, 0);
+    QL_REQUIRE(file_ != INVALID_HANDLE_VALUE, "cannot open archive file " << file);
+    LARGE_INTEGER size;
+    GetFileSizeEx(file_, &size);
+    size_ = (std::uint64_t)size.QuadPart;
+    if (size_ > 0) {
+        mapping_ = CreateFileMappingA(file_, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping_)
+            data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!data_) {
+        if (mapping_)
+            CloseHandle(mapping_);
+        CloseHandle(file_);
+        QL_FAIL("cannot map archive file " << file);
+    }
+}
+
+inline MappedFile::~MappedFile()
+{
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_);
+    CloseHandle(file_);
+}
+#else
+inline MappedFile::MappedFile(const std::string& file) : data_(0), size_(0)
+{
+    int fd = ::open(file.c_str(), O_RDONLY);
+    QL_REQUIRE(fd >= 0, "cannot open archive file " << file);
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        size_ = (std::uint64_t)st.st_size;
+        void* p = ::mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+            data_ = (const char*)p;
+    }
+    ::close(fd);
+    QL_REQUIRE(data_, "cannot map archive file " << file);
+}
+
+inline MappedFile::~MappedFile()
+{
+    ::munmap((void*)data_, size_);
+}
+#endif
+
+//! random access to the rows and steps of an archive
+/*! The file is memory-mapped and only the blocks of the requested rows
+    are decoded, each only up to the last requested column: a column is
+    its spot plus the returns before it, so columns [0, j] are decoded
+    to read column j. Decoded prices are exp of the decoded log prices,
+    bit for bit the values PathArchiveWriter measured its error on.
+*/
+class PathArchiveReader {
+public:
+    explicit PathArchiveReader(const std::string& file);
+
+    Size rows() const { return (Size)footer_.rows; }
+    Size steps() const { return footer_.steps; }
+    Size blocks() const { return (Size)footer_.blocks; }
+    Size blockRows() const { return footer_.blockRows; }
+    ArchiveEncoding encoding() const { return (ArchiveEncoding)footer_.encoding; }
+    Real tolerance() const { return footer_.tolerance; }
+    std::uint64_t bytes() const { return file_.size(); }
+
+    //! writes the prices of rows [firstRow, firstRow+numRows) and
+    //! columns [firstCol, firstCol+numCols) to out(row - firstRow, col - firstCol),
+    //! decoding blocks on up to threads threads
+    template <class Out>
+    void read(Size firstRow, Size numRows, Size firstCol, Size numCols, Out& out, Size threads = 1) const;
+private:
+    template <class Out>
+    void readBlock(Size b, Size from, Size to, Size firstCol, Size lastCol, Size outRow, Out& out) const;
+    MappedFile file_;
+    archive_detail::Footer footer_;
+    const char* index_;
+};
+
+inline PathArchiveReader::PathArchiveReader(const std::string& file) : file_(file)
+{
+    using namespace archive_detail;
+    QL_REQUIRE(file_.size() >= sizeof(Footer), file << " is not a path archive");
+    std::memcpy(&footer_, file_.data() + file_.size() - sizeof(Footer), sizeof(Footer));
+    QL_REQUIRE(std::memcmp(footer_.magic, magic, 4) == 0, file << " is not a path archive");
+    QL_REQUIRE(footer_.version == version, "archive version " << footer_.version << " is not surppoted.");
+    QL_REQUIRE(footer_.indexOffset + (footer_.blocks + 1) * sizeof(std::uint64_t) + sizeof(Footer)
+               == file_.size(), file << " is truncated");
+    index_ = file_.data() + footer_.indexOffset;
+}
+
+template <class Out>
+inline void PathArchiveReader::read(Size firstRow, Size numRows, Size firstCol, Size numCols,
+                                    Out& out, Size threads) const
+{
+    QL_REQUIRE(firstRow + numRows <= rows(), "rows [" << firstRow << ", " << firstRow + numRows
+               << ") out of " << rows());
+    QL_REQUIRE(firstCol + numCols <= steps() + 1, "columns [" << firstCol << ", " << firstCol + numCols
+               << ") out of " << steps() + 1);
+    if (numRows == 0 || numCols == 0)
+        return;
+    Size lastRow = firstRow + numRows, lastCol = firstCol + numCols - 1;
+    Size firstBlock = firstRow / blockRows(), blocks = (lastRow - 1) / blockRows() + 1 - firstBlock;
+    auto block = [&](Size b) {
+        Size from = std::max(firstRow, b * blockRows()) - b * blockRows();
+        Size to = std::min(lastRow, (b + 1) * blockRows()) - b * blockRows();
+        readBlock(b, from, to, firstCol, lastCol, b * blockRows() + from - firstRow, out);
+    };
+    if (threads <= 1 || blocks == 1) {
+        for (Size b = 0; b < blocks; b++)
+            block(firstBlock + b);
+        return;
+    }
+    // blocks are independent and fill disjoint rows of out
+    ChunkedJob job(blocks, threads, 1, [&](Size first, Size count, Size, const std::atomic<bool>&) {
+        for (Size b = first; b < first + count; b++)
+            block(firstBlock + b);
+        return count;
+    });
+    job.join();
+    if (job.error())
+        std::rethrow_exception(job.error());
+}
+
+template <class Out>
+inline void PathArchiveReader::readBlock(Size b, Size from, Size to, Size firstCol, Size lastCol,
+                                         Size outRow, Out& out) const
+{
+    using namespace archive_detail;
+    const char* block = file_.data() + load<std::uint64_t>(index_ + b * sizeof(std::uint64_t));
+    BlockHeader header = load<BlockHeader>(block);
+    Size n = header.rows, steps = footer_.steps;
+    QL_REQUIRE(to <= n, "archive block " << b << " is corrupt");
+    const char* spots = block + sizeof(BlockHeader);
+    const char* lengths = spots + n * sizeof(double);
+    const char* ks = lengths + n * sizeof(std::uint32_t);
+    const char* ends = ks + steps;
+    const char* data = ends + steps * sizeof(std::uint32_t);
+    Real quantum = std::ldexp(1.0, header.exponent);
+    bool half = encoding() == HalfFloat;
+
+    // one stream per column, read a row at a time so out is written along its rows
+    std::vector<BitReader> bits;
+    std::vector<std::uint32_t> k(lastCol + 1, 0);
+    for (Size j = 1; j <= lastCol; j++) {
+        bits.push_back(BitReader(data + (j > 1 ? load<std::uint32_t>(ends + (j - 2) * sizeof(std::uint32_t)) : 0)));
+        k[j] = (std::uint8_t)ks[j - 1];
+    }
+    const Real nan = std::numeric_limits<Real>::quiet_NaN();
+    // rows before from are decoded to get past them
+    for (Size r = 0; r < to; r++) {
+        Real s0 = load<double>(spots + r * sizeof(double));
+        Size length = std::min<Size>(load<std::uint32_t>(lengths + r * sizeof(std::uint32_t)), lastCol);
+        Real decoded = std::log(s0);
+        bool wanted = r >= from;
+        if (wanted && firstCol == 0)
+            out(outRow + r - from, 0) = s0;
+        for (Size j = 1; j <= length; j++) {
+            if (half)
+                decoded += (Real)fromHalf((std::uint16_t)bits[j - 1].get(16));
+            else
+                decoded += unzigzag(bits[j - 1].rice(k[j])) * quantum;
+            if (wanted && j >= firstCol)
+                out(outRow + r - from, j - firstCol) = std::exp(decoded);
+        }
+        if (wanted)
+            for (Size j = std::max<Size>(length + 1, firstCol); j <= lastCol; j++)
+                out(outRow + r - from, j - firstCol) = nan;
+    }
+}
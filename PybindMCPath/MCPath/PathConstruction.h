@@ -0,0 +1,159 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/errors.hpp>
+#include <ql/math/matrix.hpp>
+#include <ql/math/matrixutilities/symmetricschurdecomposition.hpp>
+#include <ql/types.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace QuantLib;
+
+enum ConstructionType {
+    FromBbFlag, IncrementalPath, BridgePath, PcaPath
+};
+
+//===================
+// Path Construction
+//===================
+
+inline void _CheckConstruction(int construction)
+{
+    if (construction < FromBbFlag || construction > PcaPath)
+        throw std::invalid_argument("Path construction type is not surppoted.");
+}
+
+//! whether the Brownian bridge builds the path; FromBbFlag leaves it to bb
+inline bool _UseBridge(int construction, bool bb)
+{
+    return construction == FromBbFlag ? bb : construction == BridgePath;
+}
+
+//! principal components construction of the step normals
+/*! Maps standard normals to standard normal step increments, like
+    BrownianBridge::transform, but with the leading dimensions on the
+    principal components of the path W, so they carry as much of its
+    variance as possible. The clock is the cumulative step variance:
+    dt for calendar time, or the process's variance per step, which puts
+    the factors where a vol term structure puts the variance.
+
+    A full PCA costs a dense n x n product per path. Here the PCA is
+    exact on at most nodes grid points spread evenly over the steps,
+    which take the first dimensions, and the points in between are
+    filled by Brownian bridges, breadth first over all gaps, with the
+    remaining dimensions. The cost is nodes^2 + O(n); nodes >= steps
+    gives the full PCA.
+*/
+class PcaConstruction {
+public:
+    PcaConstruction(const std::vector<Real>& variance, Size nodes = 64);
+
+    Size size() const { return steps_; }
+    //! grid points of the PCA, the rest are bridged
+    Size nodes() const { return node_.size(); }
+    //! variances of the factors, largest first
+    const std::vector<Real>& eigenvalues() const { return eigenvalues_; }
+
+    template <class I, class O>
+    void transform(I begin, I end, O output) const;
+private:
+    //! W(mid) = leftWeight*W(left) + rightWeight*W(right) + sd*z
+    struct Fill {
+        Size left, mid, right;
+        Real leftWeight, rightWeight, sd;
+    };
+    Size steps_;
+    std::vector<Real> clock_, sqrtStep_;
+    std::vector<Size> node_;
+    std::vector<Real> factor_;          // W(node_[j]) = sum_k factor_[j*m + k] * z[k]
+    std::vector<Real> eigenvalues_;
+    std::vector<Fill> fill_;            // in the order of dimensions m, m+1, ...
+};
+
+inline PcaConstruction::PcaConstruction(const std::vector<Real>& variance, Size nodes)
+    : steps_(variance.size()), clock_(variance.size() + 1, 0.0), sqrtStep_(variance.size())
+{
+    QL_REQUIRE(steps_ > 0, "no steps to construct");
+    QL_REQUIRE(nodes > 0, "PCA needs at least one node");
+    for (Size i = 0; i < steps_; i++) {
+        QL_REQUIRE(variance[i] > 0.0, "step " << i << " has no variance");
+        clock_[i + 1] = clock_[i] + variance[i];
+        sqrtStep_[i] = std::sqrt(variance[i]);
+    }
+
+    // nodes evenly over the steps, the last at maturity
+    Size m = std::min(nodes, steps_);
+    for (Size j = 1; j <= m; j++)
+        node_.push_back((j * steps_ + m / 2) / m);
+
+    // Cov(W(s), W(t)) = min(s, t) on the clock
+    Matrix cov(m, m);
+    for (Size j = 0; j < m; j++)
+        for (Size k = 0; k < m; k++)
+            cov[j][k] = clock_[node_[std::min(j, k)]];
+    SymmetricSchurDecomposition pca(cov);
+    const Array& lambda = pca.eigenvalues();
+    const Matrix& vectors = pca.eigenvectors();
+    factor_.resize(m * m);
+    eigenvalues_.resize(m);
+    for (Size k = 0; k < m; k++) {
+        eigenvalues_[k] = std::max(lambda[k], 0.0);
+        Real scale = std::sqrt(eigenvalues_[k]);
+        for (Size j = 0; j < m; j++)
+            factor_[j * m + k] = vectors[j][k] * scale;
+    }
+
+    // bridges between the known points, one level of all gaps at a time
+    std::vector<std::pair<Size, Size> > gaps, next;
+    Size left = 0;
+    for (Size j = 0; j < m; j++) {
+        if (node_[j] - left > 1)
+            gaps.push_back(std::make_pair(left, node_[j]));
+        left = node_[j];
+    }
+    while (!gaps.empty()) {
+        next.clear();
+        for (Size g = 0; g < gaps.size(); g++) {
+            Size l = gaps[g].first, r = gaps[g].second, mid = (l + r) / 2;
+            Real a = clock_[mid] - clock_[l], b = clock_[r] - clock_[mid];
+            Fill f = { l, mid, r, b / (a + b), a / (a + b), std::sqrt(a * b / (a + b)) };
+            fill_.push_back(f);
+            if (mid - l > 1)
+                next.push_back(std::make_pair(l, mid));
+            if (r - mid > 1)
+                next.push_back(std::make_pair(mid, r));
+        }
+        gaps.swap(next);
+    }
+    QL_ENSURE(m + fill_.size() == steps_, "PCA and bridge cover " << m + fill_.size() << " of " << steps_ << " steps");
+}
+
+template <class I, class O>
+inline void PcaConstruction::transform(I begin, I end, O output) const
+{
+    QL_REQUIRE(end >= begin && (Size)(end - begin) == steps_,
+        "PCA construction takes " << steps_ << " normals, " << (end - begin) << " given");
+    // output[i-1] = W(t_i) first
+    Size m = node_.size();
+    for (Size j = 0; j < m; j++) {
+        const Real* row = &factor_[j * m];
+        Real w = 0.0;
+        for (Size k = 0; k < m; k++)
+            w += row[k] * begin[k];
+        output[node_[j] - 1] = w;
+    }
+    for (Size f = 0; f < fill_.size(); f++) {
+        const Fill& b = fill_[f];
+        Real w_left = b.left > 0 ? output[b.left - 1] : 0.0;
+        output[b.mid - 1] = b.leftWeight * w_left + b.rightWeight * output[b.right - 1] + b.sd * begin[m + f];
+    }
+    // then the normalized increments, from the back so W(t_{i-1}) is still there
+    for (Size i = steps_ - 1; i > 0; i--)
+        output[i] = (output[i] - output[i - 1]) / sqrtStep_[i];
+    output[0] /= sqrtStep_[0];
+}
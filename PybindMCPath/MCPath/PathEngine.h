@@ -0,0 +1,471 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/math/randomnumbers/rngtraits.hpp>
+#include <ql/math/randomnumbers/sobolrsg.hpp>
+#include <ql/processes/blackscholesprocess.hpp>
+#include <ql/timegrid.hpp>
+#include <HullWhiteHybrid.h>
+#include <JumpDiffusion.h>
+#include <MarketData.h>
+#include <MyPathGenerator.h>
+#include <PathConstruction.h>
+#include <PathObservers.h>
+#include <PathProfiler.h>
+#include <PathWriters.h>
+#include <PhiloxRsg.h>
+#include <StridedArray.h>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+using namespace QuantLib;
+
+enum BarType {
+    NoBarrier,ConstBarrier,NonConstBarrier
+};
+enum RngType {
+    SobolRng, PhiloxRng
+};
+enum RowType {
+    FullRow, TruncatedRow, NoRow
+};
+enum LayoutType {
+    PathMajor, TimeMajor
+};
+
+//===================
+// Dispatch
+//===================
+
+// Calls f(rsg) with the generator chosen by rng_type, positioned so that
+// its next draw is sequence number `skip`.
+template <class F>
+void _WithSequenceGenerator(int rng_type, Size dimension, BigNatural seed, BigNatural skip, F f)
+{
+    switch (rng_type) {
+    case SobolRng: {
+        SobolRsg sobol(dimension, seed);
+        if (skip > 0)
+            sobol.skipTo((std::uint32_t)skip);
+        LowDiscrepancy::rsg_type rsg(sobol);
+        f(rsg);
+        break;
+    }
+    case PhiloxRng: {
+        PhiloxRsg rsg(dimension, seed);
+        rsg.skipTo(skip);
+        f(rsg);
+        break;
+    }
+    default:
+        throw std::invalid_argument("Random sequence type is not surppoted.");
+    }
+}
+
+// Calls f(level) with the barrier level policy of bar_type, so that only
+// the needed observer combination is instantiated in the path loop.
+template <class Side, class F>
+void _WithBarrierLevel(int bar_type, int steps, const std::vector<char>& ob, const std::vector<Real>& barrier, F f)
+{
+    switch (bar_type) {
+    case NoBarrier:
+        f(NoLevel());
+        break;
+    case ConstBarrier:
+        QL_REQUIRE(ob.size() > (Size)steps && barrier.size() > 0,
+            "barrier needs steps+1 observation flags and a level");
+        f(ConstLevel<Side>(&ob[0], barrier[0]));
+        break;
+    case NonConstBarrier:
+        QL_REQUIRE(ob.size() > (Size)steps && barrier.size() > (Size)steps,
+            "barrier needs steps+1 observation flags and levels");
+        f(StepLevel<Side>(&ob[0], &barrier[0]));
+        break;
+    default:
+        throw std::invalid_argument("Barrier type is not surppoted.");
+    }
+}
+
+// Calls f(writer) with the path writer of row_mode and layout. Time-major
+// outputs (steps+1, num) and Fortran-ordered path-major outputs are written
+// tile by tile, C-ordered path-major outputs row by row.
+template <class Array, class F>
+void _WithRowWriter(int row_mode, int layout, bool column_contiguous, Array& arr, int steps, F f)
+{
+    QL_REQUIRE(row_mode == FullRow || row_mode == TruncatedRow || row_mode == NoRow,
+        "Row mode is not surppoted.");
+    QL_REQUIRE(layout == PathMajor || layout == TimeMajor, "Layout is not surppoted.");
+    bool truncate = (row_mode == TruncatedRow);
+    if (row_mode == NoRow) {
+        NullWriter writer;
+        f(writer);
+    }
+    else if (layout == TimeMajor) {
+        TileWriter<Array, true> writer(arr, (Size)steps, truncate);
+        f(writer);
+    }
+    else if (column_contiguous) {
+        TileWriter<Array, false> writer(arr, (Size)steps, truncate);
+        f(writer);
+    }
+    else if (truncate) {
+        TruncatedRowWriter<Array> writer(arr, (Size)steps);
+        f(writer);
+    }
+    else {
+        RowWriter<Array> writer(arr);
+        f(writer);
+    }
+}
+
+// Checks the shape of a path-major (num, steps+1) or time-major
+// (steps+1, num) output.
+inline void _CheckLayout(ssize_t rows, ssize_t cols, int layout, int num, int steps)
+{
+    if (layout == TimeMajor) {
+        QL_REQUIRE(rows == steps + 1 && cols >= num,
+            "output_matrix must have shape (steps+1, num) with layout=1");
+    }
+    else {
+        QL_REQUIRE(rows >= num && cols == steps + 1,
+            "output_matrix must have shape (num, steps+1)");
+    }
+}
+
+// Per-step normal shifts that move the standardized terminal Brownian
+// value W(T)/sqrt(T) by is_shift; zero means no importance sampling.
+inline std::vector<Real> _DriftShift(int steps, double tenor, double is_shift)
+{
+    if (is_shift == 0.0)
+        return std::vector<Real>();
+    TimeGrid grid((Time)tenor, (Size)steps);
+    std::vector<Real> theta(steps);
+    for (int i = 0; i < steps; i++)
+        theta[i] = is_shift * std::sqrt(grid.dt(i) / tenor);
+    return(theta);
+}
+
+// Stratification replaces the first dimension of each draw, which Sobol
+// points already spread evenly, so it is only offered with Philox. It is
+// W(T) only when the bridge builds the path: incrementally it would be the
+// first step, with PCA the first principal component.
+inline void _CheckStrata(int strata, int rng, bool bridge)
+{
+    QL_REQUIRE(strata >= 1, "strata must be positive");
+    QL_REQUIRE(strata == 1 || rng == PhiloxRng, "strata need rng=PhiloxRng");
+    QL_REQUIRE(strata == 1 || bridge, "strata need the Brownian bridge");
+}
+
+inline bool _IsJumpProcess(int proc_type)
+{
+    return proc_type == Merton || proc_type == Bates;
+}
+
+// The sequence dimensions a path of proc_type draws.
+inline Size _PathDimension(int proc_type, int steps)
+{
+    if (_IsJumpProcess(proc_type))
+        return JumpDiffusionPathGenerator<PhiloxRsg>::dimension((Size)steps, proc_type == Bates);
+    if (proc_type == HullWhite)
+        return HullWhiteHybridPathGenerator<PhiloxRsg>::dimension((Size)steps);
+    return (Size)steps;
+}
+
+// Calls f(generator) with the path generator of proc_type: the QuantLib
+// process for BS/BSM, the jump-diffusion engine for Merton/Bates and the
+// Hull-White hybrid for HullWhite. rsg must have _PathDimension(proc_type,
+// steps) dimensions.
+template <class RSG, class F>
+void _WithPathGenerator(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process, int proc_type,
+    const MertonJumps& jumps, const HestonVariance& heston, const HullWhiteRates& rates,
+    double tenor, int steps, RSG& rsg, bool bb, F f)
+{
+    if (proc_type == HullWhite) {
+        HullWhiteHybridPathGenerator<RSG> generator(process, TimeGrid((Time)tenor, (Size)steps), rsg, bb, rates);
+        f(generator);
+    }
+    else if (_IsJumpProcess(proc_type)) {
+        JumpDiffusionPathGenerator<RSG> generator(process, TimeGrid((Time)tenor, (Size)steps), rsg, bb,
+            jumps, proc_type == Bates ? &heston : 0);
+        f(generator);
+    }
+    else {
+        MyPathGenerator<RSG> generator(process, (Time)tenor, (Size)steps, rsg, bb);
+        f(generator);
+    }
+}
+
+// The discount factors of the path just generated, if the generator has
+// its own; they are only there up to the step where the path stopped.
+template <class Generator>
+const std::vector<Real>* _PathDiscount(const Generator&)
+{
+    return 0;
+}
+
+template <class GSG>
+const std::vector<Real>* _PathDiscount(const HullWhiteHybridPathGenerator<GSG>& generator)
+{
+    return &generator.discount();
+}
+
+// The PCA of the process's variance clock on the tenor/steps grid, once per
+// grid; calendar time without a process or where the vol gives a step
+// no variance.
+inline ext::shared_ptr<PcaConstruction> _MakePca(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+    double tenor, int steps, int nodes)
+{
+    QL_REQUIRE(nodes > 0, "pca_nodes must be positive");
+    TimeGrid grid((Time)tenor, (Size)steps);
+    std::vector<Real> variance(steps), dt(steps);
+    bool clock = true;
+    for (int i = 0; i < steps; i++) {
+        dt[i] = grid.dt(i);
+        variance[i] = process ? process->variance(grid[i], process->x0(), grid.dt(i)) : 0.0;
+        clock = clock && variance[i] > 0.0;
+    }
+    return ext::shared_ptr<PcaConstruction>(new PcaConstruction(clock ? variance : dt, (Size)nodes));
+}
+
+// Hands the PCA to the generators that build their steps from one normal each.
+template <class Generator>
+void _SetConstruction(Generator&, const ext::shared_ptr<PcaConstruction>& pca)
+{
+    QL_REQUIRE(!pca, "PCA construction is not available for this process");
+}
+
+template <class GSG>
+void _SetConstruction(MyPathGenerator<GSG>& generator, const ext::shared_ptr<PcaConstruction>& pca)
+{
+    generator.set_construction(pca);
+}
+
+// Calls f(profiler) with the PathProfiler when on, else with a NoProfiler,
+// so the unprofiled path loop carries no timing code at all.
+template <class F>
+void _WithProfiler(bool on, PathProfiler& path_profiler, F f)
+{
+    if (on) {
+        f(path_profiler);
+    }
+    else {
+        NoProfiler profiler;
+        f(profiler);
+    }
+}
+
+//===================
+// Path Runs
+//===================
+
+//! what GeneratePath simulates, apart from the market and the outputs
+/*! Fields are GeneratePath's arguments of the same names. Barriers take
+    steps+1 observation flags; jumps and heston are only read for Merton
+    and Bates, hull_white for HullWhite. construction is a ConstructionType,
+    FromBbFlag leaving it to bb; PcaPath takes pca_nodes grid points.
+*/
+struct PathSpec {
+    PathSpec()
+        : steps(0), tenor(0.0), proc_type(BS), bb(true), skip(0), seed(42), rng(SobolRng),
+        row_mode(FullRow), layout(PathMajor), is_shift(0.0), strata(1),
+        upout_type(NoBarrier), downout_type(NoBarrier), ki_type(NoBarrier), profile(false),
+        construction(FromBbFlag), pca_nodes(64) {
+        MertonJumps no_jumps = { 0.0, 0.0, 0.0 };
+        HestonVariance no_variance = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+        HullWhiteRates no_rates = { 0.0, 0.0, 0.0 };
+        jumps = no_jumps;
+        heston = no_variance;
+        hull_white = no_rates;
+    }
+    int steps;
+    double tenor;
+    int proc_type;
+    bool bb;
+    int skip, seed, rng, row_mode, layout;
+    double is_shift;
+    int strata;
+    int upout_type, downout_type, ki_type;
+    std::vector<char> upout_ob, downout_ob, ki_ob;
+    std::vector<Real> upout_barrier, downout_barrier, ki_barrier;
+    MertonJumps jumps;
+    HestonVariance heston;
+    HullWhiteRates hull_white;
+    bool profile;           // time the phases into the profiler given to run()
+    int construction, pca_nodes;
+};
+
+//! where GeneratePath writes, all optional but paths (unless row_mode is NoRow)
+struct PathOutputs {
+    PathOutputs() : weights(0), koStep(0), koLevel(0), kiFlag(0), kiStep(0) {}
+    StridedArray<double, 2> paths;          // (num, steps+1), (steps+1, num) if TimeMajor
+    StridedArray<const double, 2> normals;  // GenerateRS rows replacing the RNG and bridge
+    double* weights;                        // likelihood ratios, num of them
+    long long* koStep;                      // knock-out step, 0 if none
+    double* koLevel;                        // spot at the knock-out, NaN if none
+    bool* kiFlag;
+    long long* kiStep;                      // first knock-in step, 0 if none
+    StridedArray<double, 2> discounts;      // (num, steps+1) discount factors of each path
+};
+
+//! GeneratePath on plain memory, free of Python
+/*! run() generates any range of rows: the sequence generator is skipped
+    to the first row and outputs are touched only at the rows generated,
+    so ranges can go to different threads and give the same rows as one
+    pass. The caller keeps the outputs alive and owns the threads.
+*/
+class PathRun {
+public:
+    PathRun(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process, const PathSpec& spec,
+            int num, const PathOutputs& outputs);
+
+    //! generates rows [first, first+count) until stop(row), returns the rows done
+    template <class Stop>
+    Size run(ssize_t first, ssize_t count, PathProfiler& path_profiler, Stop stop) const;
+    //! generates rows [first, first+count)
+    Size run(ssize_t first, ssize_t count) const {
+        PathProfiler profiler((Size)spec_.steps);
+        return run(first, count, profiler, [](ssize_t) { return false; });
+    }
+
+    int num() const { return num_; }
+    const PathSpec& spec() const { return spec_; }
+private:
+    ext::shared_ptr<GeneralizedBlackScholesProcess> process_;
+    PathSpec spec_;
+    int num_;
+    PathOutputs out_;
+    bool column_contiguous_;
+    std::vector<Real> drift_shift_;
+    std::vector<Real> curve_discount_;      // for deterministic rates
+    ext::shared_ptr<PcaConstruction> pca_;  // shared by all run() calls
+};
+
+inline PathRun::PathRun(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                        const PathSpec& spec, int num, const PathOutputs& outputs)
+    : process_(process), spec_(spec), num_(num), out_(outputs), column_contiguous_(false)
+{
+    int steps = spec.steps;
+    QL_REQUIRE(steps > 0 && num >= 0, "steps must be positive and num non-negative");
+    // the process sets up its local vol on first use; do it here, not in a worker
+    process_->evolve(0.0, 1.0, spec.tenor / steps, 0.0);
+
+    bool use_normals = !out_.normals.empty();
+    if (use_normals)
+    {
+        QL_REQUIRE(out_.normals.shape(1) == steps + 1, "normals must have shape (rows, steps+1)");
+        QL_REQUIRE(out_.normals.shape(0) >= (ssize_t)spec.skip + num,
+            "normals has " << out_.normals.shape(0) << " rows, "
+            << spec.skip + num << " are needed");
+    }
+    QL_REQUIRE(spec.strata == 1 || !use_normals, "strata cannot be used with cached normals");
+    QL_REQUIRE(_BaseProcess(spec.proc_type) == spec.proc_type || !use_normals,
+        "cached normals cannot be used with jump or stochastic rate processes");
+    drift_shift_ = _DriftShift(steps, spec.tenor, spec.is_shift);
+    _CheckConstruction(spec.construction);
+    _CheckStrata(spec.strata, spec.rng, _UseBridge(spec.construction, spec.bb));
+    if (spec.construction == PcaPath)
+    {
+        QL_REQUIRE(_BaseProcess(spec.proc_type) == spec.proc_type,
+            "PCA construction cannot be used with jump or stochastic rate processes");
+        pca_ = _MakePca(process_, spec.tenor, steps, spec.pca_nodes);
+    }
+
+    if (!out_.discounts.empty())
+    {
+        QL_REQUIRE(out_.discounts.shape(0) >= num && out_.discounts.shape(1) == steps + 1,
+            "discounts must have shape (num, steps+1)");
+        TimeGrid grid((Time)spec.tenor, (Size)steps);
+        curve_discount_.resize(steps + 1);
+        for (int i = 0; i <= steps; i++)
+            curve_discount_[i] = process_->riskFreeRate()->discount(grid[i]);
+    }
+
+    if (spec.row_mode != NoRow)
+    {
+        QL_REQUIRE(!out_.paths.empty() || num == 0, "paths output is needed unless row_mode=NoRow");
+        _CheckLayout(out_.paths.shape(0), out_.paths.shape(1), spec.layout, num, steps);
+        column_contiguous_ = out_.paths.columnContiguous();
+    }
+}
+
+template <class Stop>
+Size PathRun::run(ssize_t first, ssize_t count, PathProfiler& path_profiler, Stop stop) const
+{
+    const PathSpec& s = spec_;
+    StridedArray<double, 2> arr(out_.paths);
+    const StridedArray<const double, 2>& arr_normals = out_.normals;
+    bool use_normals = !arr_normals.empty();
+    int steps = s.steps;
+    Size done = 0;
+
+    _WithSequenceGenerator(s.rng, _PathDimension(s.proc_type, steps), s.seed, s.skip + first, [&](auto& rsg) {
+    _WithPathGenerator(process_, s.proc_type, s.jumps, s.heston, s.hull_white, s.tenor, steps, rsg,
+                       _UseBridge(s.construction, s.bb), [&](auto& generator) {
+    _WithProfiler(s.profile, path_profiler, [&](auto& profiler) {
+        generator.set_drift_shift(drift_shift_);
+        if (pca_)
+            _SetConstruction(generator, pca_);
+
+        //Up Out and Down Out Stop Barriers and Down In, NoBarrier sides compile to nothing
+        _WithBarrierLevel<UpSide>(s.upout_type, steps, s.upout_ob, s.upout_barrier, [&](auto up) {
+        _WithBarrierLevel<DownSide>(s.downout_type, steps, s.downout_ob, s.downout_barrier, [&](auto down) {
+        _WithBarrierLevel<DownSide>(s.ki_type, steps, s.ki_ob, s.ki_barrier, [&](auto ki) {
+        _WithRowWriter(s.row_mode, s.layout, column_contiguous_, arr, steps, [&](auto& writer) {
+            auto observer = both(both(KnockOut<decltype(up)>(up), KnockOut<decltype(down)>(down)),
+                                 KnockIn<decltype(ki)>(ki));
+            for (ssize_t row = first; row < first + count; row++)
+            {
+                if (stop(row))
+                    break;
+                if (s.strata > 1)
+                    generator.set_stratum((Size)((s.skip + row) % s.strata), (Size)s.strata);
+                if (use_normals)
+                {
+                    std::uint64_t tick = profiler.start();
+                    generator.load_bm(arr_normals, s.skip + row);
+                    profiler.lap(SequencePhase, tick);
+                }
+                else
+                    generator.gen_bm(profiler);
+                writer.row((Size)row);
+                PathEnd end = generator.write_next(writer, observer, profiler);
+                profiler.path(end.step > 0 ? end.step : (Size)steps);
+                if (end.step > 0)
+                    profiler.stopped(end.step, up.hit(end.step, end.value));
+                Size first_ki = observer.second().knockInStep();
+                if (first_ki > 0)
+                    profiler.knockedIn(first_ki);
+                if (out_.weights)
+                    out_.weights[row] = generator.weight();
+                if (out_.koStep)
+                    out_.koStep[row] = (long long)end.step;
+                if (out_.koLevel)
+                    out_.koLevel[row] = end.step > 0 ? end.value : std::numeric_limits<double>::quiet_NaN();
+                if (out_.kiFlag)
+                    out_.kiFlag[row] = first_ki > 0;
+                if (out_.kiStep)
+                    out_.kiStep[row] = (long long)first_ki;
+                if (!out_.discounts.empty())
+                {
+                    const std::vector<Real>* path = _PathDiscount(generator);
+                    const std::vector<Real>& discount = path ? *path : curve_discount_;
+                    Size last = path && end.step > 0 ? end.step : (Size)steps;
+                    for (Size i = 0; i <= (Size)steps; i++)
+                        out_.discounts(row, i) = i <= last ? discount[i] : std::numeric_limits<double>::quiet_NaN();
+                }
+                done++;
+            }
+            writer.flush();
+        });
+        });
+        });
+        });
+    });
+    });
+    });
+    return done;
+}
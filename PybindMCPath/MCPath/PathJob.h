@@ -0,0 +1,164 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/errors.hpp>
+#include <ql/types.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Chunked Jobs
+//===================
+
+//! rows [0, rows) worked off in chunks by background threads
+/*! Workers take the next chunk from a shared counter and call
+    work(first, count, worker, cancel), which returns how many rows of
+    the chunk it completed, in order from first. The work polls cancel
+    as often as it likes: it is a relaxed atomic load, and progress is
+    one counter per worker on its own cache line, so neither makes the
+    workers wait on each other. Only wait() and the end of the last
+    worker take the mutex.
+
+    An exception in a worker cancels the job and is kept for error().
+    The destructor cancels and joins.
+*/
+class ChunkedJob {
+public:
+    typedef std::function<Size(Size first, Size count, Size worker,
+                               const std::atomic<bool>& cancel)> Work;
+
+    ChunkedJob(Size rows, Size threads, Size chunk, const Work& work);
+    ~ChunkedJob();
+
+    void cancel() { cancel_.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return cancel_.load(std::memory_order_relaxed); }
+    //! true once every worker has returned
+    bool finished() const { return running_.load(std::memory_order_acquire) == 0; }
+    //! waits up to seconds (forever if negative), true if finished
+    bool wait(double seconds);
+    void join();
+
+    Size rows() const { return rows_; }
+    Size threads() const { return threads_.size(); }
+    //! rows completed so far
+    Size completed() const;
+    //! chunks handed out so far
+    Size started() const { return std::min(next_.load(std::memory_order_relaxed), chunks_); }
+
+    //! \name after join()
+    //@{
+    //! rows [0, validRows()) are all complete
+    Size validRows() const;
+    //! rows completed of each chunk, from its first row
+    const std::vector<Size>& chunkRows() const { return chunkRows_; }
+    Size chunk() const { return chunk_; }
+    std::exception_ptr error() const { return error_; }
+    //@}
+private:
+    void run(Size worker);
+    struct alignas(64) Counter {
+        std::atomic<Size> value;
+    };
+    Size rows_, chunk_, chunks_;
+    Work work_;
+    std::atomic<bool> cancel_;
+    std::atomic<Size> next_, running_;
+    std::vector<Counter> done_;
+    std::vector<Size> chunkRows_;   // written only by the worker that owns the chunk
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable finished_;
+    std::vector<std::thread> threads_;
+};
+
+inline ChunkedJob::ChunkedJob(Size rows, Size threads, Size chunk, const Work& work)
+    : rows_(rows), chunk_(std::max<Size>(chunk, 1)), chunks_((rows + chunk_ - 1) / chunk_),
+    work_(work), cancel_(false), next_(0), running_(0), done_(std::max<Size>(threads, 1)),
+    chunkRows_(chunks_, 0) {
+    threads = std::max<Size>(1, std::min(threads, chunks_));
+    for (Size t = 0; t < done_.size(); t++)
+        done_[t].value.store(0, std::memory_order_relaxed);
+    running_.store(threads, std::memory_order_release);
+    for (Size t = 0; t < threads; t++)
+        threads_.push_back(std::thread(&ChunkedJob::run, this, t));
+}
+
+inline ChunkedJob::~ChunkedJob()
+{
+    cancel();
+    join();
+}
+
+inline void ChunkedJob::run(Size worker)
+{
+    try {
+        while (!cancelled()) {
+            Size c = next_.fetch_add(1, std::memory_order_relaxed);
+            if (c >= chunks_)
+                break;
+            Size first = c * chunk_, count = std::min(chunk_, rows_ - first);
+            Size done = work_(first, count, worker, cancel_);
+            chunkRows_[c] = done;
+            done_[worker].value.fetch_add(done, std::memory_order_relaxed);
+            if (done < count)
+                break;
+        }
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+            error_ = std::current_exception();
+        cancel();
+    }
+    if (running_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_.notify_all();
+    }
+}
+
+inline bool ChunkedJob::wait(double seconds)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (seconds < 0.0) {
+        finished_.wait(lock, [this]() { return finished(); });
+        return true;
+    }
+    return finished_.wait_for(lock, std::chrono::duration<double>(seconds),
+                              [this]() { return finished(); });
+}
+
+inline void ChunkedJob::join()
+{
+    for (Size t = 0; t < threads_.size(); t++)
+        if (threads_[t].joinable())
+            threads_[t].join();
+}
+
+inline Size ChunkedJob::completed() const
+{
+    Size total = 0;
+    for (Size t = 0; t < done_.size(); t++)
+        total += done_[t].value.load(std::memory_order_relaxed);
+    return total;
+}
+
+inline Size ChunkedJob::validRows() const
+{
+    Size rows = 0;
+    for (Size c = 0; c < chunks_; c++) {
+        rows += chunkRows_[c];
+        if (chunkRows_[c] < std::min(chunk_, rows_ - c * chunk_))
+            break;
+    }
+    return rows;
+}
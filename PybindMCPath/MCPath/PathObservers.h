@@ -0,0 +1,133 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/types.hpp>
+
+using namespace QuantLib;
+
+//===================
+// Barrier Levels
+//===================
+
+// A level answers hit(i, x) for step i of the path. Sides decide what
+// crossing means; the observation flags and levels are plain arrays with
+// steps+1 entries, indexed like the path.
+
+struct UpSide {
+    static bool crossed(Real x, Real level) { return x >= level; }
+};
+struct DownSide {
+    static bool crossed(Real x, Real level) { return x < level; }
+};
+
+//! never observed: hit() is a constant and the check is compiled away
+struct NoLevel {
+    bool hit(Size, Real) const { return false; }
+};
+
+//! one level for every observation date
+template <class Side>
+struct ConstLevel {
+    ConstLevel(const char* ob, Real level) : ob_(ob), level_(level) {}
+    bool hit(Size i, Real x) const { return ob_[i] && Side::crossed(x, level_); }
+    const char* ob_;
+    Real level_;
+};
+
+//! one level per step
+template <class Side>
+struct StepLevel {
+    StepLevel(const char* ob, const Real* level) : ob_(ob), level_(level) {}
+    bool hit(Size i, Real x) const { return ob_[i] && Side::crossed(x, level_[i]); }
+    const char* ob_;
+    const Real* level_;
+};
+
+//===================
+// Path Observers
+//===================
+
+// An observer is fed every simulated step by MyPathGenerator::copy_next:
+// reset() before the path, observe(i, x) after step i is written, and a
+// true return ends the path there.
+
+//! ends the path at the first hit
+template <class Level>
+class KnockOut {
+public:
+    explicit KnockOut(const Level& level) : level_(level) {}
+    void reset() {}
+    bool observe(Size i, Real x) { return level_.hit(i, x); }
+private:
+    Level level_;
+};
+
+//! records the first hit, the path goes on
+template <class Level>
+class KnockIn {
+public:
+    explicit KnockIn(const Level& level) : level_(level), step_(0) {}
+    void reset() { step_ = 0; }
+    bool observe(Size i, Real x) {
+        if (step_ == 0 && level_.hit(i, x))
+            step_ = i;
+        return false;
+    }
+    //! first knock-in step, 0 if never knocked in
+    Size knockInStep() const { return step_; }
+private:
+    Level level_;
+    Size step_;
+};
+
+//! counts the observation dates where the level is hit (range accrual)
+template <class Level>
+class Accrual {
+public:
+    explicit Accrual(const Level& level) : level_(level), count_(0) {}
+    void reset() { count_ = 0; }
+    bool observe(Size i, Real x) {
+        count_ += level_.hit(i, x) ? 1 : 0;
+        return false;
+    }
+    Size count() const { return count_; }
+private:
+    Level level_;
+    Size count_;
+};
+
+//! runs two observers on every step; the path ends if either ends it
+template <class First, class Second>
+class BothObservers {
+public:
+    BothObservers(const First& first, const Second& second) : first_(first), second_(second) {}
+    void reset() { first_.reset(); second_.reset(); }
+    bool observe(Size i, Real x) {
+        bool stop_first = first_.observe(i, x);
+        bool stop_second = second_.observe(i, x);
+        return stop_first || stop_second;
+    }
+    const First& first() const { return first_; }
+    const Second& second() const { return second_; }
+private:
+    First first_;
+    Second second_;
+};
+
+//! where a path ended: the stopping step (0 if it ran to maturity) and its last value
+struct PathEnd {
+    Size step;
+    Real value;
+};
+
+//! observes nothing, copy_next then writes the full path
+struct NoObserver {
+    void reset() {}
+    bool observe(Size, Real) const { return false; }
+};
+
+template <class First, class Second>
+BothObservers<First, Second> both(const First& first, const Second& second) {
+    return BothObservers<First, Second>(first, second);
+}
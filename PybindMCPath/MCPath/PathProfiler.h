@@ -0,0 +1,187 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/errors.hpp>
+#include <ql/types.hpp>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define MCPATH_HAS_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MCPATH_HAS_RDTSC
+#endif
+
+using namespace QuantLib;
+
+//===================
+// Profile Phases
+//===================
+
+enum ProfilePhase {
+    MarketPhase,        // curves and process
+    SequencePhase,      // nextSequence() or cached normals
+    BridgePhase,        // Brownian bridge, strata and drift shift
+    EvolvePhase,        // process evolve
+    WritePhase,         // path writer
+    ObservePhase,       // barrier observers
+    PhaseCount
+};
+
+inline const char* ProfilePhaseName(Size phase)
+{
+    static const char* names[PhaseCount] = { "market", "sequence", "bridge", "evolve", "write", "observe" };
+    return names[phase];
+}
+
+//===================
+// Profilers
+//===================
+
+// A profiler is a compile-time policy of the path loops: start() reads
+// the clock, lap(phase, t) charges the time since t to phase and returns
+// the new reading, path()/stopped() count. NoProfiler does nothing, so
+// the loops instantiated with it are the unprofiled ones.
+
+//! profiling switched off
+struct NoProfiler {
+    std::uint64_t start() const { return 0; }
+    std::uint64_t lap(Size, std::uint64_t) const { return 0; }
+    void path(Size) const {}
+    void stopped(Size, bool) const {}
+    void knockedIn(Size) const {}
+};
+
+//! per-phase time and path counters of one thread
+/*! Time is read with rdtsc where available (a few ns per read) and
+    converted to seconds by calibrating against steady_clock over the
+    profiler's lifetime, elsewhere with steady_clock itself. Evolve,
+    write and observe are timed on every step, which adds the cost of
+    three clock reads per step to the profiled run. Profilers of several
+    threads are combined with merge().
+*/
+class PathProfiler {
+public:
+    explicit PathProfiler(Size steps = 0)
+        : ticks_(PhaseCount, 0), paths_(0), steps_(0),
+        upOut_(steps + 1, 0), downOut_(steps + 1, 0), knockIn_(steps + 1, 0),
+        wallStart_(std::chrono::steady_clock::now()), tickStart_(now()) {}
+
+    std::uint64_t start() const { return now(); }
+    std::uint64_t lap(Size phase, std::uint64_t since) {
+        std::uint64_t t = now();
+        ticks_[phase] += t - since;
+        return t;
+    }
+    //! a path of evolved steps has ended
+    void path(Size steps) {
+        paths_++;
+        steps_ += steps;
+    }
+    //! a path was knocked out at step, by the up side or the down side
+    void stopped(Size step, bool up) {
+        (up ? upOut_ : downOut_)[step]++;
+    }
+    void knockedIn(Size step) { knockIn_[step]++; }
+
+    void merge(const PathProfiler& other);
+
+    Real seconds(Size phase) const { return ticks_[phase] * secondsPerTick(); }
+    std::uint64_t paths() const { return paths_; }
+    std::uint64_t steps() const { return steps_; }
+    const std::vector<std::uint64_t>& upOutHistogram() const { return upOut_; }
+    const std::vector<std::uint64_t>& downOutHistogram() const { return downOut_; }
+    const std::vector<std::uint64_t>& knockInHistogram() const { return knockIn_; }
+    const char* clock() const {
+#ifdef MCPATH_HAS_RDTSC
+        return "rdtsc";
+#else
+        return "steady_clock";
+#endif
+    }
+
+    std::string json() const;
+    void writeJson(const std::string& file) const;
+private:
+    static std::uint64_t now() {
+#ifdef MCPATH_HAS_RDTSC
+        return (std::uint64_t)__rdtsc();
+#else
+        return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+    Real secondsPerTick() const;
+    std::vector<std::uint64_t> ticks_;
+    std::uint64_t paths_, steps_;
+    std::vector<std::uint64_t> upOut_, downOut_, knockIn_;
+    std::chrono::steady_clock::time_point wallStart_;
+    std::uint64_t tickStart_;
+};
+
+inline Real PathProfiler::secondsPerTick() const
+{
+#ifdef MCPATH_HAS_RDTSC
+    Real wall = std::chrono::duration<Real>(std::chrono::steady_clock::now() - wallStart_).count();
+    std::uint64_t ticks = now() - tickStart_;
+    return ticks > 0 ? wall / ticks : 0.0;
+#else
+    return 1.0e-9;
+#endif
+}
+
+inline void PathProfiler::merge(const PathProfiler& other)
+{
+    QL_REQUIRE(upOut_.size() == other.upOut_.size(), "profilers of different step counts");
+    // convert the other thread's ticks with its own calibration
+    Real scale = other.secondsPerTick() / secondsPerTick();
+    for (Size k = 0; k < PhaseCount; k++)
+        ticks_[k] += (std::uint64_t)(other.ticks_[k] * scale);
+    paths_ += other.paths_;
+    steps_ += other.steps_;
+    for (Size i = 0; i < upOut_.size(); i++) {
+        upOut_[i] += other.upOut_[i];
+        downOut_[i] += other.downOut_[i];
+        knockIn_[i] += other.knockIn_[i];
+    }
+}
+
+namespace profiler_detail {
+    inline void putHistogram(std::ostringstream& out, const std::vector<std::uint64_t>& h) {
+        out << "[";
+        for (Size i = 0; i < h.size(); i++)
+            out << (i ? ", " : "") << h[i];
+        out << "]";
+    }
+}
+
+inline std::string PathProfiler::json() const
+{
+    std::ostringstream out;
+    out.precision(9);
+    out << "{\n  \"clock\": \"" << clock() << "\",\n  \"seconds\": {";
+    for (Size k = 0; k < PhaseCount; k++)
+        out << (k ? ", " : "") << "\"" << ProfilePhaseName(k) << "\": " << seconds(k);
+    out << "},\n  \"paths\": " << paths_ << ",\n  \"steps\": " << steps_ << ",\n";
+    out << "  \"up_out\": ";
+    profiler_detail::putHistogram(out, upOut_);
+    out << ",\n  \"down_out\": ";
+    profiler_detail::putHistogram(out, downOut_);
+    out << ",\n  \"knock_in\": ";
+    profiler_detail::putHistogram(out, knockIn_);
+    out << "\n}\n";
+    return out.str();
+}
+
+inline void PathProfiler::writeJson(const std::string& file) const
+{
+    std::ofstream out(file.c_str());
+    QL_REQUIRE(out, "cannot open trace file " << file);
+    out << json();
+}
@@ -0,0 +1,108 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/types.hpp>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Path Writers
+//===================
+
+// A writer receives the simulated values of one path from
+// MyPathGenerator::write_next: row(r) selects the path, write(i, x) step
+// i, and stop(i) is called when an observer ended the path at step i.
+// flush() is called once after the last path.
+
+//! writes arr(row, i); steps after a stop keep their previous content
+template <class Array>
+class RowWriter {
+public:
+    explicit RowWriter(Array& arr) : arr_(arr), row_(0) {}
+    void row(Size r) { row_ = r; }
+    void write(Size i, Real x) { arr_(row_, i) = x; }
+    void stop(Size) {}
+    void flush() {}
+protected:
+    Array& arr_;
+    Size row_;
+};
+
+//! like RowWriter, but marks the end of valid data with a NaN after a stop
+template <class Array>
+class TruncatedRowWriter : public RowWriter<Array> {
+public:
+    TruncatedRowWriter(Array& arr, Size steps) : RowWriter<Array>(arr), steps_(steps) {}
+    void stop(Size i) {
+        if (i < steps_)
+            this->arr_(this->row_, i + 1) = std::numeric_limits<Real>::quiet_NaN();
+    }
+private:
+    Size steps_;
+};
+
+//! writes nothing, for runs that only need the path events
+struct NullWriter {
+    void row(Size) {}
+    void write(Size, Real) {}
+    void stop(Size) {}
+    void flush() {}
+};
+
+//! cache-blocked writer for column-contiguous outputs
+/*! Collects a tile of consecutive paths in a step-major buffer and
+    stores it one step at a time, so each store is a contiguous run of
+    tile values instead of one strided value per path. Transposed selects
+    arr(i, row) for (steps+1, num) outputs; otherwise arr(row, i) is
+    used, which is contiguous along the paths for Fortran-ordered
+    (num, steps+1) outputs. Rows must come in increasing order, without
+    gaps. Steps after a stop are not stored (or get a NaN marker right
+    after the stop if truncate is set), as in RowWriter.
+*/
+template <class Array, bool Transposed>
+class TileWriter {
+public:
+    TileWriter(Array& arr, Size steps, bool truncate, Size tile = 64)
+        : arr_(arr), steps_(steps), truncate_(truncate), tile_(tile),
+        row0_(0), count_(0), buffer_((steps + 1) * tile), end_(tile) {}
+    void row(Size r) {
+        if (count_ == tile_)
+            flush();
+        if (count_ == 0)
+            row0_ = r;
+        end_[count_] = steps_;
+        count_++;
+    }
+    void write(Size i, Real x) { buffer_[i * tile_ + count_ - 1] = x; }
+    void stop(Size i) { end_[count_ - 1] = i; }
+    void flush() {
+        const Real nan = std::numeric_limits<Real>::quiet_NaN();
+        for (Size i = 0; i <= steps_; i++) {
+            const Real* values = &buffer_[i * tile_];
+            for (Size b = 0; b < count_; b++) {
+                if (i <= end_[b])
+                    put(i, row0_ + b, values[b]);
+                else if (truncate_ && i == end_[b] + 1)
+                    put(i, row0_ + b, nan);
+            }
+        }
+        count_ = 0;
+    }
+private:
+    void put(Size i, Size r, Real x) {
+        if (Transposed)
+            arr_(i, r) = x;
+        else
+            arr_(r, i) = x;
+    }
+    Array& arr_;
+    Size steps_;
+    bool truncate_;
+    Size tile_, row0_, count_;
+    std::vector<Real> buffer_;  // [i * tile_ + b]
+    std::vector<Size> end_;
+};
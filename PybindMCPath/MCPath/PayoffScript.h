@@ -0,0 +1,544 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/types.hpp>
+#include <ql/errors.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Payoff Program
+//===================
+
+//! payoff description compiled to stack bytecode
+/*! A script is a list of variable declarations and event blocks:
+
+        var ki = 0                      # state, reset on every path
+        on ki_ob:                       # steps where array ki_ob is not 0
+            if S < ki_barrier then ki = 1 end
+        end
+        on call_ob:
+            if S >= call_barrier then pay coupon stop end
+        end
+        final:                          # maturity, if the path was not stopped
+            if ki then pay min(max(S, 0.01), 1) - 1 else pay coupon end
+        end
+
+    Arrays (length steps+1) are supplied by name; inside a block an
+    array name is its value at the current step, S is the normalized
+    level and t the step index. Blocks of the same step run in script
+    order. Statements are assignments, if/then/else/end, pay (adds the
+    amount discounted from the current step) and stop (ends the path).
+    Expressions have + - * /, comparisons, and/or/not and min, max, abs.
+    Comments start with #.
+*/
+class PayoffProgram {
+public:
+    enum OpCode {
+        Push, Load, Store, LoadArray, LoadSpot, LoadStep,
+        Add, Sub, Mul, Div, Neg,
+        Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual,
+        And, Or, Not, Min, Max, Abs,
+        Jump, JumpIfFalse, Pay, Stop, End
+    };
+    struct Instruction {
+        OpCode op;
+        int arg;
+    };
+    //! an on-block: runs at the steps where array is not 0
+    struct Block {
+        Size array;
+        Size entry;
+    };
+
+    PayoffProgram(const std::string& source, const std::vector<std::string>& arrays);
+
+    const std::vector<Instruction>& code() const { return code_; }
+    const std::vector<Real>& constants() const { return constants_; }
+    const std::vector<std::string>& arrays() const { return arrays_; }
+    const std::vector<std::string>& variables() const { return variables_; }
+    const std::vector<Real>& initialValues() const { return initialValues_; }
+    const std::vector<Block>& blocks() const { return blocks_; }
+    bool hasFinal() const { return hasFinal_; }
+    Size finalEntry() const { return finalEntry_; }
+    Size stackSize() const { return stackSize_; }
+    std::string disassemble() const;
+private:
+    friend class PayoffCompiler;
+    std::vector<Instruction> code_;
+    std::vector<Real> constants_;
+    std::vector<std::string> arrays_, variables_;
+    std::vector<Real> initialValues_;
+    std::vector<Block> blocks_;
+    bool hasFinal_;
+    Size finalEntry_, stackSize_;
+};
+
+//===================
+// Payoff Compiler
+//===================
+
+// Tokenizer and recursive-descent parser emitting PayoffProgram code.
+class PayoffCompiler {
+public:
+    PayoffCompiler(const std::string& source, PayoffProgram& program)
+        : src_(source), pos_(0), line_(1), program_(program), depth_(0) {
+        next();
+    }
+    void compile() {
+        while (kind_ != EndOfInput) {
+            if (accept("var"))
+                declaration();
+            else if (accept("on")) {
+                PayoffProgram::Block block;
+                block.array = arrayIndex(expectIdentifier());
+                expect(":");
+                block.entry = program_.code_.size();
+                statements();
+                expect("end");
+                emit(PayoffProgram::End);
+                program_.blocks_.push_back(block);
+            }
+            else if (accept("final")) {
+                QL_REQUIRE(!program_.hasFinal_, error("final block defined twice"));
+                expect(":");
+                program_.hasFinal_ = true;
+                program_.finalEntry_ = program_.code_.size();
+                statements();
+                expect("end");
+                emit(PayoffProgram::End);
+            }
+            else
+                QL_FAIL(error("expected var, on or final"));
+        }
+    }
+private:
+    enum Kind { Identifier, Number, Symbol, EndOfInput };
+
+    //--- tokens
+    void next() {
+        for (;;) {
+            while (pos_ < src_.size() && std::isspace((unsigned char)src_[pos_])) {
+                if (src_[pos_] == '\n')
+                    line_++;
+                pos_++;
+            }
+            if (pos_ < src_.size() && src_[pos_] == '#') {
+                while (pos_ < src_.size() && src_[pos_] != '\n')
+                    pos_++;
+                continue;
+            }
+            break;
+        }
+        if (pos_ >= src_.size()) {
+            kind_ = EndOfInput;
+            token_ = "end of script";
+            return;
+        }
+        char c = src_[pos_];
+        Size start = pos_;
+        if (std::isalpha((unsigned char)c) || c == '_') {
+            while (pos_ < src_.size() && (std::isalnum((unsigned char)src_[pos_]) || src_[pos_] == '_'))
+                pos_++;
+            kind_ = Identifier;
+        }
+        else if (std::isdigit((unsigned char)c) || c == '.') {
+            const char* begin = src_.c_str() + pos_;
+            char* end;
+            number_ = std::strtod(begin, &end);
+            QL_REQUIRE(end != begin, error("bad number"));
+            pos_ += end - begin;
+            kind_ = Number;
+        }
+        else {
+            static const char* pairs[] = { "==", "!=", "<=", ">=" };
+            kind_ = Symbol;
+            pos_++;
+            for (Size k = 0; k < 4; k++)
+                if (src_.compare(start, 2, pairs[k]) == 0)
+                    pos_ = start + 2;
+            QL_REQUIRE(std::string("+-*/(),:=<>!;").find(c) != std::string::npos,
+                error(std::string("unexpected character '") + c + "'"));
+        }
+        token_ = src_.substr(start, pos_ - start);
+    }
+    bool peek(const char* s) const { return kind_ != EndOfInput && kind_ != Number && token_ == s; }
+    bool accept(const char* s) {
+        if (!peek(s))
+            return false;
+        next();
+        return true;
+    }
+    void expect(const char* s) {
+        QL_REQUIRE(accept(s), error(std::string("expected '") + s + "'"));
+    }
+    std::string expectIdentifier() {
+        QL_REQUIRE(kind_ == Identifier && !keyword(token_), error("expected a name"));
+        std::string name = token_;
+        next();
+        return name;
+    }
+    static bool keyword(const std::string& s) {
+        static const char* words[] = { "var", "on", "final", "end", "if", "then", "else",
+            "pay", "stop", "and", "or", "not", "min", "max", "abs", "S", "t" };
+        for (Size k = 0; k < sizeof(words) / sizeof(words[0]); k++)
+            if (s == words[k])
+                return true;
+        return false;
+    }
+    std::string error(const std::string& what) const {
+        std::ostringstream out;
+        out << "payoff script, line " << line_ << " near '" << token_ << "': " << what;
+        return out.str();
+    }
+
+    //--- symbols
+    int find(const std::vector<std::string>& names, const std::string& name) const {
+        for (Size k = 0; k < names.size(); k++)
+            if (names[k] == name)
+                return (int)k;
+        return -1;
+    }
+    Size arrayIndex(const std::string& name) const {
+        int k = find(program_.arrays_, name);
+        QL_REQUIRE(k >= 0, error("unknown array " + name));
+        return (Size)k;
+    }
+    void declaration() {
+        std::string name = expectIdentifier();
+        QL_REQUIRE(find(program_.variables_, name) < 0 && find(program_.arrays_, name) < 0,
+            error(name + " is already defined"));
+        expect("=");
+        Real sign = accept("-") ? -1.0 : 1.0;
+        QL_REQUIRE(kind_ == Number, error("variables start from a number"));
+        program_.variables_.push_back(name);
+        program_.initialValues_.push_back(sign * number_);
+        next();
+    }
+
+    //--- code
+    Size emit(PayoffProgram::OpCode op, int arg = 0) {
+        // stack effect of each opcode
+        switch (op) {
+        case PayoffProgram::Push: case PayoffProgram::Load: case PayoffProgram::LoadArray:
+        case PayoffProgram::LoadSpot: case PayoffProgram::LoadStep:
+            depth_++;
+            break;
+        case PayoffProgram::Neg: case PayoffProgram::Not: case PayoffProgram::Abs:
+        case PayoffProgram::Jump: case PayoffProgram::Stop: case PayoffProgram::End:
+            break;
+        default:
+            depth_--;
+        }
+        program_.stackSize_ = std::max(program_.stackSize_, depth_);
+        PayoffProgram::Instruction instruction = { op, arg };
+        program_.code_.push_back(instruction);
+        return program_.code_.size() - 1;
+    }
+    void patch(Size at) { program_.code_[at].arg = (int)program_.code_.size(); }
+
+    void statements() {
+        while (!peek("end") && !peek("else") && kind_ != EndOfInput)
+            statement();
+    }
+    void statement() {
+        if (accept(";"))
+            return;
+        if (accept("pay")) {
+            expression();
+            emit(PayoffProgram::Pay);
+        }
+        else if (accept("stop"))
+            emit(PayoffProgram::Stop);
+        else if (accept("if")) {
+            expression();
+            expect("then");
+            Size jump_else = emit(PayoffProgram::JumpIfFalse);
+            statements();
+            if (accept("else")) {
+                Size jump_end = emit(PayoffProgram::Jump);
+                patch(jump_else);
+                statements();
+                patch(jump_end);
+            }
+            else
+                patch(jump_else);
+            expect("end");
+        }
+        else {
+            std::string name = expectIdentifier();
+            int k = find(program_.variables_, name);
+            QL_REQUIRE(k >= 0, error("assignment to undeclared variable " + name));
+            expect("=");
+            expression();
+            emit(PayoffProgram::Store, k);
+        }
+    }
+    void expression() {
+        conjunction();
+        while (accept("or")) {
+            conjunction();
+            emit(PayoffProgram::Or);
+        }
+    }
+    void conjunction() {
+        negation();
+        while (accept("and")) {
+            negation();
+            emit(PayoffProgram::And);
+        }
+    }
+    void negation() {
+        if (accept("not")) {
+            negation();
+            emit(PayoffProgram::Not);
+        }
+        else
+            comparison();
+    }
+    void comparison() {
+        sum();
+        static const char* ops[] = { "<", "<=", ">", ">=", "==", "!=" };
+        static const PayoffProgram::OpCode codes[] = {
+            PayoffProgram::Less, PayoffProgram::LessEqual, PayoffProgram::Greater,
+            PayoffProgram::GreaterEqual, PayoffProgram::Equal, PayoffProgram::NotEqual };
+        for (Size k = 0; k < 6; k++)
+            if (accept(ops[k])) {
+                sum();
+                emit(codes[k]);
+                return;
+            }
+    }
+    void sum() {
+        term();
+        for (;;) {
+            if (accept("+")) { term(); emit(PayoffProgram::Add); }
+            else if (accept("-")) { term(); emit(PayoffProgram::Sub); }
+            else return;
+        }
+    }
+    void term() {
+        unary();
+        for (;;) {
+            if (accept("*")) { unary(); emit(PayoffProgram::Mul); }
+            else if (accept("/")) { unary(); emit(PayoffProgram::Div); }
+            else return;
+        }
+    }
+    void unary() {
+        if (accept("-")) {
+            unary();
+            emit(PayoffProgram::Neg);
+        }
+        else
+            primary();
+    }
+    void primary() {
+        if (kind_ == Number) {
+            program_.constants_.push_back(number_);
+            emit(PayoffProgram::Push, (int)program_.constants_.size() - 1);
+            next();
+        }
+        else if (accept("(")) {
+            expression();
+            expect(")");
+        }
+        else if (accept("S"))
+            emit(PayoffProgram::LoadSpot);
+        else if (accept("t"))
+            emit(PayoffProgram::LoadStep);
+        else if (peek("min") || peek("max")) {
+            PayoffProgram::OpCode op = peek("min") ? PayoffProgram::Min : PayoffProgram::Max;
+            next();
+            binaryCall(op);
+        }
+        else if (accept("abs")) {
+            expect("(");
+            expression();
+            expect(")");
+            emit(PayoffProgram::Abs);
+        }
+        else {
+            std::string name = expectIdentifier();
+            int k = find(program_.variables_, name);
+            if (k >= 0)
+                emit(PayoffProgram::Load, k);
+            else
+                emit(PayoffProgram::LoadArray, (int)arrayIndex(name));
+        }
+    }
+    void binaryCall(PayoffProgram::OpCode op) {
+        expect("(");
+        expression();
+        expect(",");
+        expression();
+        expect(")");
+        emit(op);
+    }
+
+    std::string src_;
+    Size pos_, line_;
+    Kind kind_;
+    std::string token_;
+    Real number_;
+    PayoffProgram& program_;
+    Size depth_;
+};
+
+inline PayoffProgram::PayoffProgram(const std::string& source, const std::vector<std::string>& arrays)
+    : arrays_(arrays), hasFinal_(false), finalEntry_(0), stackSize_(0) {
+    PayoffCompiler(source, *this).compile();
+    QL_REQUIRE(!blocks_.empty() || hasFinal_, "payoff script has no on or final block");
+}
+
+inline std::string PayoffProgram::disassemble() const
+{
+    static const char* names[] = {
+        "push", "load", "store", "array", "spot", "step",
+        "add", "sub", "mul", "div", "neg",
+        "lt", "le", "gt", "ge", "eq", "ne",
+        "and", "or", "not", "min", "max", "abs",
+        "jump", "jump_if_false", "pay", "stop", "end" };
+    std::ostringstream out;
+    for (Size k = 0; k < blocks_.size(); k++)
+        out << "on " << arrays_[blocks_[k].array] << ": " << blocks_[k].entry << "\n";
+    if (hasFinal_)
+        out << "final: " << finalEntry_ << "\n";
+    for (Size k = 0; k < code_.size(); k++) {
+        out << k << "\t" << names[code_[k].op];
+        switch (code_[k].op) {
+        case Push:      out << "\t" << constants_[code_[k].arg]; break;
+        case Load:
+        case Store:     out << "\t" << variables_[code_[k].arg]; break;
+        case LoadArray: out << "\t" << arrays_[code_[k].arg]; break;
+        case Jump:
+        case JumpIfFalse: out << "\t" << code_[k].arg; break;
+        default: break;
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+//===================
+// Payoff Script Pricer
+//===================
+
+//! runs a PayoffProgram per path, fed by MyPathGenerator::price_next
+class PayoffScriptPricer {
+public:
+    //! arrays[k] are the values of program.arrays()[k], steps+1 each
+    PayoffScriptPricer(const PayoffProgram& program,
+        const std::vector<std::vector<Real> >& arrays,
+        const std::vector<Real>& discount);
+
+    void reset() {
+        std::copy(program_.initialValues().begin(), program_.initialValues().end(), vars_.begin());
+        value_ = 0.0;
+        stopStep_ = 0;
+    }
+    bool observed(Size i) const { return stepOffset_[i + 1] > stepOffset_[i]; }
+    bool observe(Size i, Real x) {
+        for (Size k = stepOffset_[i]; k < stepOffset_[i + 1]; k++)
+            if (run(stepEntry_[k], i, x)) {
+                stopStep_ = i;
+                return true;
+            }
+        return false;
+    }
+    void finish(Real x) {
+        if (program_.hasFinal())
+            run(program_.finalEntry(), size_ - 1, x);
+    }
+    Real value() const { return value_; }
+    //! step where the script stopped the path, 0 if it ran to maturity
+    Size stopStep() const { return stopStep_; }
+    Size size() const { return size_; }
+private:
+    bool run(Size pc, Size i, Real x);
+    PayoffProgram program_;
+    Size size_;
+    std::vector<Real> arrays_;              // [k * size_ + i]
+    std::vector<Real> discount_;
+    std::vector<Size> stepOffset_, stepEntry_;
+    std::vector<Real> vars_, stack_;
+    Real value_;
+    Size stopStep_;
+};
+
+inline PayoffScriptPricer::PayoffScriptPricer(const PayoffProgram& program,
+    const std::vector<std::vector<Real> >& arrays,
+    const std::vector<Real>& discount)
+    : program_(program), size_(discount.size()), discount_(discount),
+    stepOffset_(discount.size() + 1, 0),
+    vars_(program.variables().size()), stack_(std::max<Size>(program.stackSize(), 1)),
+    value_(0.0), stopStep_(0) {
+    QL_REQUIRE(arrays.size() == program_.arrays().size(),
+        arrays.size() << " arrays given, the program has " << program_.arrays().size());
+    arrays_.reserve(arrays.size() * size_);
+    for (Size k = 0; k < arrays.size(); k++) {
+        QL_REQUIRE(arrays[k].size() == size_,
+            "array " << program_.arrays()[k] << " has " << arrays[k].size()
+            << " entries, steps+1 (" << size_ << ") are needed");
+        arrays_.insert(arrays_.end(), arrays[k].begin(), arrays[k].end());
+    }
+    // blocks to run at each step, in script order; step 0 is never observed
+    for (Size i = 1; i < size_; i++) {
+        for (Size b = 0; b < program_.blocks().size(); b++)
+            if (arrays_[program_.blocks()[b].array * size_ + i] != 0.0)
+                stepEntry_.push_back(program_.blocks()[b].entry);
+        stepOffset_[i + 1] = stepEntry_.size();
+    }
+}
+
+inline bool PayoffScriptPricer::run(Size pc, Size i, Real x)
+{
+    typedef PayoffProgram P;
+    const P::Instruction* code = &program_.code()[0];
+    const Real* constants = program_.constants().empty() ? 0 : &program_.constants()[0];
+    Real* sp = &stack_[0];      // next free slot
+    for (;;) {
+        const P::Instruction& in = code[pc++];
+        switch (in.op) {
+        case P::Push:       *sp++ = constants[in.arg]; break;
+        case P::Load:       *sp++ = vars_[in.arg]; break;
+        case P::Store:      vars_[in.arg] = *--sp; break;
+        case P::LoadArray:  *sp++ = arrays_[in.arg * size_ + i]; break;
+        case P::LoadSpot:   *sp++ = x; break;
+        case P::LoadStep:   *sp++ = (Real)i; break;
+        case P::Add:        sp--; sp[-1] += sp[0]; break;
+        case P::Sub:        sp--; sp[-1] -= sp[0]; break;
+        case P::Mul:        sp--; sp[-1] *= sp[0]; break;
+        case P::Div:        sp--; sp[-1] /= sp[0]; break;
+        case P::Neg:        sp[-1] = -sp[-1]; break;
+        case P::Less:       sp--; sp[-1] = sp[-1] < sp[0]; break;
+        case P::LessEqual:  sp--; sp[-1] = sp[-1] <= sp[0]; break;
+        case P::Greater:    sp--; sp[-1] = sp[-1] > sp[0]; break;
+        case P::GreaterEqual: sp--; sp[-1] = sp[-1] >= sp[0]; break;
+        case P::Equal:      sp--; sp[-1] = sp[-1] == sp[0]; break;
+        case P::NotEqual:   sp--; sp[-1] = sp[-1] != sp[0]; break;
+        case P::And:        sp--; sp[-1] = (sp[-1] != 0.0) && (sp[0] != 0.0); break;
+        case P::Or:         sp--; sp[-1] = (sp[-1] != 0.0) || (sp[0] != 0.0); break;
+        case P::Not:        sp[-1] = sp[-1] == 0.0; break;
+        case P::Min:        sp--; sp[-1] = std::min(sp[-1], sp[0]); break;
+        case P::Max:        sp--; sp[-1] = std::max(sp[-1], sp[0]); break;
+        case P::Abs:        sp[-1] = std::fabs(sp[-1]); break;
+        case P::Jump:       pc = in.arg; break;
+        case P::JumpIfFalse:
+            if (*--sp == 0.0)
+                pc = in.arg;
+            break;
+        case P::Pay:        value_ += *--sp * discount_[i]; break;
+        case P::Stop:       return true;
+        case P::End:        return false;
+        }
+    }
+}
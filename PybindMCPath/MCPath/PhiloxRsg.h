@@ -0,0 +1,134 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/methods/montecarlo/sample.hpp>
+#include <ql/math/distributions/normaldistribution.hpp>
+#include <cstdint>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Philox4x32-10
+//===================
+
+//! counter-based generator of Salmon et al. (2011), 10 rounds
+/*! The output block is a pure function of (counter, key), so any
+    block can be computed without touching the previous ones.
+*/
+class Philox4x32 {
+public:
+    typedef std::uint32_t word_type;
+    struct block_type { word_type v[4]; };
+
+    static block_type block(const word_type counter[4], const word_type key[2]) {
+        word_type c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        word_type k0 = key[0], k1 = key[1];
+        for (int r = 0; r < 10; r++) {
+            std::uint64_t p0 = (std::uint64_t)0xD2511F53u * c0;
+            std::uint64_t p1 = (std::uint64_t)0xCD9E8D57u * c2;
+            word_type n0 = (word_type)(p1 >> 32) ^ c1 ^ k0;
+            word_type n2 = (word_type)(p0 >> 32) ^ c3 ^ k1;
+            c1 = (word_type)p1;
+            c3 = (word_type)p0;
+            c0 = n0;
+            c2 = n2;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        block_type out = { { c0, c1, c2, c3 } };
+        return out;
+    }
+};
+
+//===================
+// Counter-based RSG
+//===================
+
+//! Gaussian sequence generator on top of Philox4x32-10
+/*! Sequence n (the n-th path) dimension d is a function of
+    (seed, stream, n, d) only: one Philox block gives two 53-bit
+    uniforms, i.e. dimensions 2k and 2k+1, which are mapped through
+    the inverse cumulative normal like InverseCumulativeRsg does.
+    Disjoint path ranges can therefore be drawn on separate threads,
+    processes or machines and concatenated into the same run.
+
+    The interface follows the QuantLib sequence generators, so the
+    class can be used as the GSG argument of MyPathGenerator and
+    MyRandomSequenceGenerator.
+*/
+class PhiloxRsg {
+public:
+    typedef Sample<std::vector<Real> > sample_type;
+    PhiloxRsg(Size dimensionality, BigNatural seed = 0, BigNatural stream = 0);
+    const sample_type& nextSequence() const;
+    const sample_type& lastSequence() const { return sequence_; }
+    Size dimension() const { return dimensionality_; }
+    //! the next call to nextSequence() returns sequence \p n
+    void skipTo(std::uint64_t n) { counter_ = n; }
+    //! number of sequences drawn so far (or the last skipTo target)
+    std::uint64_t index() const { return counter_; }
+    //! random access to a single variate
+    Real normal(std::uint64_t n, Size d) const;
+private:
+    void fill(std::uint64_t n, Size d, Real* out) const;
+    Size dimensionality_;
+    Philox4x32::word_type key_[2];
+    Philox4x32::word_type stream_;
+    mutable std::uint64_t counter_;
+    mutable sample_type sequence_;
+    InverseCumulativeNormal icn_;
+};
+
+inline PhiloxRsg::PhiloxRsg(Size dimensionality, BigNatural seed, BigNatural stream)
+    : dimensionality_(dimensionality), stream_((Philox4x32::word_type)stream),
+    counter_(0), sequence_(std::vector<Real>(dimensionality), 1.0) {
+    std::uint64_t s = (std::uint64_t)seed;
+    key_[0] = (Philox4x32::word_type)s;
+    key_[1] = (Philox4x32::word_type)(s >> 32);
+}
+
+inline void PhiloxRsg::fill(std::uint64_t n, Size d, Real* out) const
+{
+    Philox4x32::word_type counter[4] = {
+        (Philox4x32::word_type)(d / 2), stream_,
+        (Philox4x32::word_type)n, (Philox4x32::word_type)(n >> 32) };
+    Philox4x32::block_type b = Philox4x32::block(counter, key_);
+    // 53-bit uniforms strictly inside (0,1)
+    const Real scale = 1.0 / 9007199254740992.0;
+    Real u0 = (((std::uint64_t)(b.v[0] >> 5) << 26) + (b.v[1] >> 6) + 0.5) * scale;
+    Real u1 = (((std::uint64_t)(b.v[2] >> 5) << 26) + (b.v[3] >> 6) + 0.5) * scale;
+    out[0] = icn_(u0);
+    out[1] = icn_(u1);
+}
+
+inline Real PhiloxRsg::normal(std::uint64_t n, Size d) const
+{
+    Real pair[2];
+    fill(n, d & ~(Size)1, pair);
+    return pair[d & 1];
+}
+
+inline const PhiloxRsg::sample_type& PhiloxRsg::nextSequence() const
+{
+    std::vector<Real>& v = sequence_.value;
+    Real pair[2];
+    for (Size d = 0; d < dimensionality_; d += 2) {
+        fill(counter_, d, pair);
+        v[d] = pair[0];
+        if (d + 1 < dimensionality_)
+            v[d + 1] = pair[1];
+    }
+    counter_++;
+    return sequence_;
+}
+
+//! RNG policy, usable wherever QuantLib expects PseudoRandom/LowDiscrepancy
+struct CounterBasedRandom {
+    typedef PhiloxRsg rsg_type;
+    enum { allowsErrorEstimate = 1 };
+    static rsg_type make_sequence_generator(Size dimension, BigNatural seed) {
+        return rsg_type(dimension, seed);
+    }
+};
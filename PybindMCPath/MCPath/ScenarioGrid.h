@@ -0,0 +1,143 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/stochasticprocess.hpp>
+#include <ql/timegrid.hpp>
+#include <cmath>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Term Table
+//===================
+
+// Per-step coefficients of a log-affine 1-D process (Black-Scholes with a
+// strike-independent vol curve):  log(S[i+1]/S[i]) = drift[i] + diffusion[i]*z[i].
+// They are read off process->evolve, so they match MyPathGenerator exactly.
+inline void TermTable(const ext::shared_ptr<StochasticProcess1D>& process, const TimeGrid& grid,
+    std::vector<Real>& drift, std::vector<Real>& diffusion)
+{
+    Size steps = grid.size() - 1;
+    drift.resize(steps);
+    diffusion.resize(steps);
+    for (Size i = 0; i < steps; i++) {
+        Time t = grid[i];
+        Time dt = grid.dt(i);
+        drift[i] = std::log(process->evolve(t, 1.0, dt, 0.0));
+        diffusion[i] = std::log(process->evolve(t, 1.0, dt, 1.0)) - drift[i];
+    }
+}
+
+//===================
+// Scenario Grid
+//===================
+
+//! evolves many market scenarios from one set of bridged normals
+/*! Under deterministic coefficients the scenarios of a risk ladder only
+    differ by their spot and their drift/diffusion tables, so one draw of
+    z drives all of them. Tables are stored step-major with the scenario
+    as the inner, contiguous lane and paths are kept in log space, so the
+    update loop is a plain vectorizable multiply-add; exp is only taken
+    where a value is written out or observed.
+*/
+class ScenarioGrid {
+public:
+    ScenarioGrid(const TimeGrid& grid,
+        const std::vector<ext::shared_ptr<StochasticProcess1D> >& processes,
+        const std::vector<Real>& spots);
+
+    Size scenarios() const { return scenarios_; }
+    Size steps() const { return steps_; }
+
+    //! writes arr(k, row, 0..steps) for every scenario k
+    template <class Array3>
+    void copy_paths(const std::vector<Real>& z, Array3& arr, Size row) const;
+
+    //! feeds every scenario to its own pricer; values[k] gets the payoff
+    /*! Pricer needs reset(), observed(i), observe(i, x), finish(x), value(). */
+    template <class Pricer>
+    void price(const std::vector<Real>& z, std::vector<Pricer>& pricers, std::vector<Real>& values) const;
+private:
+    Size steps_, scenarios_;
+    std::vector<Real> drift_, diffusion_;   // [i * scenarios_ + k]
+    std::vector<Real> logSpot_;
+    mutable std::vector<Real> state_;       // [i * scenarios_ + k], log levels
+    mutable std::vector<char> alive_;
+};
+
+inline ScenarioGrid::ScenarioGrid(const TimeGrid& grid,
+    const std::vector<ext::shared_ptr<StochasticProcess1D> >& processes,
+    const std::vector<Real>& spots)
+    : steps_(grid.size() - 1), scenarios_(processes.size()),
+    drift_(steps_ * scenarios_), diffusion_(steps_ * scenarios_),
+    logSpot_(scenarios_), state_((steps_ + 1) * scenarios_), alive_(scenarios_) {
+    QL_REQUIRE(scenarios_ > 0, "no scenarios given");
+    QL_REQUIRE(spots.size() == scenarios_,
+        spots.size() << " spots given for " << scenarios_ << " scenarios");
+    std::vector<Real> drift, diffusion;
+    for (Size k = 0; k < scenarios_; k++) {
+        QL_REQUIRE(spots[k] > 0.0, "non-positive spot in scenario " << k);
+        TermTable(processes[k], grid, drift, diffusion);
+        for (Size i = 0; i < steps_; i++) {
+            drift_[i * scenarios_ + k] = drift[i];
+            diffusion_[i * scenarios_ + k] = diffusion[i];
+        }
+        logSpot_[k] = std::log(spots[k]);
+    }
+}
+
+template <class Array3>
+void ScenarioGrid::copy_paths(const std::vector<Real>& z, Array3& arr, Size row) const
+{
+    const Size S = scenarios_;
+    Real* x = &state_[0];
+    for (Size k = 0; k < S; k++)
+        x[k] = logSpot_[k];
+    for (Size i = 0; i < steps_; i++) {
+        const Real* m = &drift_[i * S];
+        const Real* s = &diffusion_[i * S];
+        const Real* prev = x + i * S;
+        Real* next = x + (i + 1) * S;
+        const Real zi = z[i];
+        for (Size k = 0; k < S; k++)
+            next[k] = prev[k] + m[k] + s[k] * zi;
+    }
+    // one contiguous row per scenario
+    for (Size k = 0; k < S; k++)
+        for (Size i = 0; i <= steps_; i++)
+            arr(k, row, i) = std::exp(x[i * S + k]);
+}
+
+template <class Pricer>
+void ScenarioGrid::price(const std::vector<Real>& z, std::vector<Pricer>& pricers, std::vector<Real>& values) const
+{
+    const Size S = scenarios_;
+    Real* x = &state_[0];
+    Size alive = S;
+    for (Size k = 0; k < S; k++) {
+        x[k] = logSpot_[k];
+        alive_[k] = 1;
+        pricers[k].reset();
+    }
+    for (Size i = 0; i < steps_ && alive > 0; i++) {
+        const Real* m = &drift_[i * S];
+        const Real* s = &diffusion_[i * S];
+        const Real zi = z[i];
+        for (Size k = 0; k < S; k++)
+            x[k] += m[k] + s[k] * zi;
+        if (!pricers[0].observed(i + 1))
+            continue;
+        for (Size k = 0; k < S; k++)
+            if (alive_[k] && pricers[k].observe(i + 1, std::exp(x[k]))) {
+                alive_[k] = 0;
+                alive--;
+            }
+    }
+    for (Size k = 0; k < S; k++) {
+        if (alive_[k])
+            pricers[k].finish(std::exp(x[k]));
+        values[k] = pricers[k].value();
+    }
+}
@@ -0,0 +1,355 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/types.hpp>
+#include <ql/errors.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Exact Sum
+//===================
+
+//! order-independent sum
+/*! Every input is rounded once to a multiple of 2^-32 and accumulated as
+    a 128-bit integer, so sums of the same values agree bit for bit no
+    matter how the inputs are split across shards or in which order the
+    shards are merged. Inputs must stay below 2^31 in absolute value.
+*/
+class ExactSum {
+public:
+    ExactSum() : hi_(0), lo_(0) {}
+    void add(Real x) {
+        add128((std::int64_t)std::llround(std::ldexp(x, 32)));
+    }
+    void merge(const ExactSum& other) {
+        std::uint64_t lo = lo_ + other.lo_;
+        hi_ += other.hi_ + (lo < lo_ ? 1 : 0);
+        lo_ = lo;
+    }
+    Real value() const {
+        return std::ldexp(std::ldexp((Real)hi_, 64) + (Real)lo_, -32);
+    }
+    std::int64_t hi() const { return hi_; }
+    std::uint64_t lo() const { return lo_; }
+    void set(std::int64_t hi, std::uint64_t lo) { hi_ = hi; lo_ = lo; }
+private:
+    void add128(std::int64_t q) {
+        std::uint64_t lo = lo_ + (std::uint64_t)q;
+        hi_ += (q < 0 ? -1 : 0) + (lo < lo_ ? 1 : 0);
+        lo_ = lo;
+    }
+    std::int64_t hi_;
+    std::uint64_t lo_;
+};
+
+//===================
+// Fingerprint
+//===================
+
+//! FNV-1a hash of a run configuration, so mismatched shards are refused
+class Fingerprint {
+public:
+    Fingerprint() : hash_(14695981039346656037ULL) {}
+    void add(const void* data, Size bytes) {
+        const unsigned char* p = (const unsigned char*)data;
+        for (Size i = 0; i < bytes; i++) {
+            hash_ ^= p[i];
+            hash_ *= 1099511628211ULL;
+        }
+    }
+    template <class T>
+    void add(const T& value) { add(&value, sizeof(T)); }
+    std::uint64_t value() const { return hash_; }
+private:
+    std::uint64_t hash_;
+};
+
+//===================
+// Shard Statistics
+//===================
+
+//! mergeable partial result of a Monte Carlo run over a range of paths
+/*! Holds the path ranges it covers, exact sums and sums of squares of
+    the (weighted) path values, and per-step histograms: stop_histogram
+    counts where the fused pricer ended a path (bin 0 = never stopped)
+    and event_histogram counts the first step of a secondary event such
+    as a knock-in (bin 0 = never happened). Merging any partition of
+    [0, num) gives the same bytes as a single run over [0, num).
+
+    With strata > 1, path p belongs to stratum p % strata and the strata
+    are equiprobable: sums are also kept per stratum and the mean and
+    error are those of the stratified estimator.
+*/
+class ShardStatistics {
+public:
+    typedef std::pair<std::uint64_t, std::uint64_t> range_type;
+
+    ShardStatistics() : fingerprint_(0) {}
+    ShardStatistics(std::uint64_t fingerprint, Size bins, Size strata = 1)
+        : fingerprint_(fingerprint), stopHistogram_(bins, 0), eventHistogram_(bins, 0),
+        stratumSum_(strata > 1 ? strata : 0), stratumSumSquares_(strata > 1 ? strata : 0) {}
+
+    void add(Real value, Size stop_step, Size event_step, Size stratum = 0) {
+        sum_.add(value);
+        sumSquares_.add(value * value);
+        if (!stratumSum_.empty()) {
+            stratumSum_[stratum].add(value);
+            stratumSumSquares_[stratum].add(value * value);
+        }
+        stopHistogram_[stop_step]++;
+        eventHistogram_[event_step]++;
+    }
+    //! record that paths [first, first+count) have been added
+    void cover(std::uint64_t first, std::uint64_t count);
+    void merge(const ShardStatistics& other);
+
+    std::uint64_t fingerprint() const { return fingerprint_; }
+    const std::vector<range_type>& ranges() const { return ranges_; }
+    std::uint64_t count() const;
+    Real sum() const { return sum_.value(); }
+    Real sumSquares() const { return sumSquares_.value(); }
+    Real mean() const;
+    Real errorEstimate() const;
+    Size strata() const { return std::max<Size>(stratumSum_.size(), 1); }
+    //! number of covered paths in stratum k
+    std::uint64_t count(Size k) const;
+    const std::vector<std::uint64_t>& stopHistogram() const { return stopHistogram_; }
+    const std::vector<std::uint64_t>& eventHistogram() const { return eventHistogram_; }
+
+    std::string serialize() const;
+    static ShardStatistics deserialize(const std::string& bytes);
+private:
+    static void normalize(std::vector<range_type>& ranges);
+    std::uint64_t fingerprint_;
+    std::vector<range_type> ranges_;
+    ExactSum sum_, sumSquares_;
+    std::vector<std::uint64_t> stopHistogram_, eventHistogram_;
+    std::vector<ExactSum> stratumSum_, stratumSumSquares_;
+};
+
+inline void ShardStatistics::cover(std::uint64_t first, std::uint64_t count)
+{
+    if (count == 0)
+        return;
+    std::vector<range_type> ranges(ranges_);
+    ranges.push_back(range_type(first, count));
+    normalize(ranges);
+    ranges_.swap(ranges);
+}
+
+// sorts the ranges and coalesces adjacent ones, refusing overlaps
+inline void ShardStatistics::normalize(std::vector<range_type>& ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<range_type> merged;
+    for (Size i = 0; i < ranges.size(); i++) {
+        if (!merged.empty()) {
+            range_type& last = merged.back();
+            QL_REQUIRE(ranges[i].first >= last.first + last.second,
+                "overlapping shards: paths from " << ranges[i].first
+                << " are already covered");
+            if (ranges[i].first == last.first + last.second) {
+                last.second += ranges[i].second;
+                continue;
+            }
+        }
+        merged.push_back(ranges[i]);
+    }
+    ranges.swap(merged);
+}
+
+inline void ShardStatistics::merge(const ShardStatistics& other)
+{
+    QL_REQUIRE(fingerprint_ == other.fingerprint_,
+        "shards come from different configurations");
+    QL_REQUIRE(stopHistogram_.size() == other.stopHistogram_.size(),
+        "shards have different histogram sizes");
+    QL_REQUIRE(stratumSum_.size() == other.stratumSum_.size(),
+        "shards have different strata");
+    std::vector<range_type> ranges(ranges_);
+    ranges.insert(ranges.end(), other.ranges_.begin(), other.ranges_.end());
+    normalize(ranges);
+    ranges_.swap(ranges);
+    sum_.merge(other.sum_);
+    sumSquares_.merge(other.sumSquares_);
+    for (Size k = 0; k < stratumSum_.size(); k++) {
+        stratumSum_[k].merge(other.stratumSum_[k]);
+        stratumSumSquares_[k].merge(other.stratumSumSquares_[k]);
+    }
+    for (Size i = 0; i < stopHistogram_.size(); i++) {
+        stopHistogram_[i] += other.stopHistogram_[i];
+        eventHistogram_[i] += other.eventHistogram_[i];
+    }
+}
+
+inline std::uint64_t ShardStatistics::count() const
+{
+    std::uint64_t n = 0;
+    for (Size i = 0; i < ranges_.size(); i++)
+        n += ranges_[i].second;
+    return n;
+}
+
+inline std::uint64_t ShardStatistics::count(Size k) const
+{
+    std::uint64_t K = strata(), n = 0;
+    for (Size i = 0; i < ranges_.size(); i++) {
+        // paths p in [first, first+count) with p % K == k
+        std::uint64_t first = ranges_[i].first, end = first + ranges_[i].second;
+        std::uint64_t p = first + (k + K - first % K) % K;
+        if (p < end)
+            n += (end - 1 - p) / K + 1;
+    }
+    return n;
+}
+
+inline Real ShardStatistics::mean() const
+{
+    Size K = stratumSum_.size();
+    for (Size k = 0; k < K; k++)
+        if (count(k) == 0)
+            K = 0;  // an empty stratum: fall back to the plain mean
+    if (K == 0)
+        return count() > 0 ? sum() / count() : 0.0;
+    Real m = 0.0;
+    for (Size k = 0; k < K; k++)
+        m += stratumSum_[k].value() / count(k);
+    return m / K;
+}
+
+inline Real ShardStatistics::errorEstimate() const
+{
+    Size K = stratumSum_.size();
+    for (Size k = 0; k < K; k++)
+        if (count(k) < 2)
+            K = 0;
+    if (K > 0) {
+        // sum over strata of (1/K)^2 * s_k^2 / n_k
+        Real v = 0.0;
+        for (Size k = 0; k < K; k++) {
+            Real n = (Real)count(k);
+            Real m = stratumSum_[k].value() / n;
+            v += std::max(stratumSumSquares_[k].value() / n - m * m, 0.0) / (n - 1.0);
+        }
+        return std::sqrt(v) / K;
+    }
+    std::uint64_t n = count();
+    if (n < 2)
+        return 0.0;
+    Real m = sum() / n;
+    Real v = (sumSquares() / n - m * m) * n / (n - 1.0);
+    return std::sqrt(std::max(v, 0.0) / n);
+}
+
+namespace shard_detail {
+    template <class T>
+    inline void put(std::string& out, const T& value) {
+        out.append((const char*)&value, sizeof(T));
+    }
+    template <class T>
+    inline T get(const std::string& in, Size& pos) {
+        QL_REQUIRE(pos + sizeof(T) <= in.size(), "truncated shard");
+        T value;
+        std::memcpy(&value, in.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+    // histograms are mostly empty: store (bin, count) pairs only
+    inline void putHistogram(std::string& out, const std::vector<std::uint64_t>& h) {
+        std::uint32_t nonzero = 0;
+        for (Size i = 0; i < h.size(); i++)
+            nonzero += (h[i] != 0);
+        put<std::uint32_t>(out, nonzero);
+        for (Size i = 0; i < h.size(); i++)
+            if (h[i] != 0) {
+                put<std::uint32_t>(out, (std::uint32_t)i);
+                put<std::uint64_t>(out, h[i]);
+            }
+    }
+    inline void getHistogram(const std::string& in, Size& pos, std::vector<std::uint64_t>& h) {
+        std::uint32_t nonzero = get<std::uint32_t>(in, pos);
+        for (std::uint32_t k = 0; k < nonzero; k++) {
+            std::uint32_t i = get<std::uint32_t>(in, pos);
+            QL_REQUIRE(i < h.size(), "corrupted shard histogram");
+            h[i] = get<std::uint64_t>(in, pos);
+        }
+    }
+    const std::uint32_t magic = 0x4853434d; // "MCSH"
+    const std::uint32_t version = 1;
+}
+
+inline std::string ShardStatistics::serialize() const
+{
+    using namespace shard_detail;
+    std::string out;
+    put(out, magic);
+    put(out, version);
+    put(out, fingerprint_);
+    put<std::uint32_t>(out, (std::uint32_t)stopHistogram_.size());
+    put<std::uint32_t>(out, (std::uint32_t)ranges_.size());
+    for (Size i = 0; i < ranges_.size(); i++) {
+        put(out, ranges_[i].first);
+        put(out, ranges_[i].second);
+    }
+    put(out, sum_.hi());
+    put(out, sum_.lo());
+    put(out, sumSquares_.hi());
+    put(out, sumSquares_.lo());
+    putHistogram(out, stopHistogram_);
+    putHistogram(out, eventHistogram_);
+    put<std::uint32_t>(out, (std::uint32_t)stratumSum_.size());
+    for (Size k = 0; k < stratumSum_.size(); k++) {
+        put(out, stratumSum_[k].hi());
+        put(out, stratumSum_[k].lo());
+        put(out, stratumSumSquares_[k].hi());
+        put(out, stratumSumSquares_[k].lo());
+    }
+    return out;
+}
+
+inline ShardStatistics ShardStatistics::deserialize(const std::string& in)
+{
+    using namespace shard_detail;
+    Size pos = 0;
+    QL_REQUIRE(get<std::uint32_t>(in, pos) == magic, "not a shard");
+    QL_REQUIRE(get<std::uint32_t>(in, pos) == version, "unsupported shard version");
+    std::uint64_t fingerprint = get<std::uint64_t>(in, pos);
+    std::uint32_t bins = get<std::uint32_t>(in, pos);
+    ShardStatistics result(fingerprint, bins);
+    std::uint32_t n_ranges = get<std::uint32_t>(in, pos);
+    for (std::uint32_t i = 0; i < n_ranges; i++) {
+        std::uint64_t first = get<std::uint64_t>(in, pos);
+        std::uint64_t count = get<std::uint64_t>(in, pos);
+        result.ranges_.push_back(range_type(first, count));
+    }
+    std::int64_t hi = get<std::int64_t>(in, pos);
+    std::uint64_t lo = get<std::uint64_t>(in, pos);
+    result.sum_.set(hi, lo);
+    hi = get<std::int64_t>(in, pos);
+    lo = get<std::uint64_t>(in, pos);
+    result.sumSquares_.set(hi, lo);
+    getHistogram(in, pos, result.stopHistogram_);
+    getHistogram(in, pos, result.eventHistogram_);
+    std::uint32_t strata = get<std::uint32_t>(in, pos);
+    result.stratumSum_.resize(strata);
+    result.stratumSumSquares_.resize(strata);
+    for (std::uint32_t k = 0; k < strata; k++) {
+        hi = get<std::int64_t>(in, pos);
+        lo = get<std::uint64_t>(in, pos);
+        result.stratumSum_[k].set(hi, lo);
+        hi = get<std::int64_t>(in, pos);
+        lo = get<std::uint64_t>(in, pos);
+        result.stratumSumSquares_[k].set(hi, lo);
+    }
+    QL_REQUIRE(pos == in.size(), "trailing bytes in shard");
+    return result;
+}
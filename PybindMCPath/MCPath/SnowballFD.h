@@ -0,0 +1,295 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/processes/blackscholesprocess.hpp>
+#include <ql/timegrid.hpp>
+#include <SnowballPricer.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Forward Terms
+//===================
+
+//! piecewise-constant coefficients of a Black-Scholes process on a time grid
+/*! rate[i], dividend[i] and variance[i] are the forward short rate,
+    dividend yield and variance rate over [grid[i], grid[i+1]], read off
+    the discount and Black variance curves at the ATM strike.
+*/
+struct ForwardTerms {
+    std::vector<Real> rate, dividend, variance;
+};
+
+inline ForwardTerms MakeForwardTerms(const ext::shared_ptr<GeneralizedBlackScholesProcess>& process,
+    const TimeGrid& grid)
+{
+    Size steps = grid.size() - 1;
+    ForwardTerms terms;
+    terms.rate.resize(steps);
+    terms.dividend.resize(steps);
+    terms.variance.resize(steps);
+    for (Size i = 0; i < steps; i++) {
+        Time t0 = grid[i], t1 = grid[i + 1], dt = grid.dt(i);
+        terms.rate[i] = std::log(process->riskFreeRate()->discount(t0)
+            / process->riskFreeRate()->discount(t1)) / dt;
+        terms.dividend[i] = std::log(process->dividendYield()->discount(t0)
+            / process->dividendYield()->discount(t1)) / dt;
+        terms.variance[i] = (process->blackVolatility()->blackVariance(t1, 1.0, true)
+            - process->blackVolatility()->blackVariance(t0, 1.0, true)) / dt;
+    }
+    return terms;
+}
+
+//===================
+// Tridiagonal System
+//===================
+
+//! Thomas solver whose work arrays are allocated once and reused
+class TridiagonalSystem {
+public:
+    explicit TridiagonalSystem(Size n) : lower_(n), diag_(n), upper_(n), scratch_(n) {}
+    Size size() const { return diag_.size(); }
+    //! row i is lower[i] x[i-1] + diag[i] x[i] + upper[i] x[i+1]
+    std::vector<Real>& lower() { return lower_; }
+    std::vector<Real>& diag() { return diag_; }
+    std::vector<Real>& upper() { return upper_; }
+    //! solves in place; rhs holds the solution on return
+    void solve(std::vector<Real>& rhs) {
+        Size n = diag_.size();
+        Real beta = diag_[0];
+        rhs[0] /= beta;
+        for (Size j = 1; j < n; j++) {
+            scratch_[j] = upper_[j - 1] / beta;
+            beta = diag_[j] - lower_[j] * scratch_[j];
+            rhs[j] = (rhs[j] - lower_[j] * rhs[j - 1]) / beta;
+        }
+        for (Size j = n - 1; j > 0; j--)
+            rhs[j - 1] -= scratch_[j] * rhs[j];
+    }
+private:
+    std::vector<Real> lower_, diag_, upper_, scratch_;
+};
+
+//===================
+// Snowball FD Engine
+//===================
+
+//! Crank-Nicolson/Rannacher engine for the snowball of SnowballPathPricer
+/*! Solves the Black-Scholes PDE backward in x = log(S) on a uniform grid
+    with a node on the spot. Two value layers are carried: knocked-in and
+    not yet knocked in. Observation steps of the product are applied
+    between time steps as the path pricer does: at a call date, nodes
+    with S >= call_barrier get the coupon in both layers; at a knock-in
+    date, nodes with S < ki_barrier take the knocked-in value. The node
+    whose cell contains a barrier gets the cell average of both sides.
+
+    Each step of the observation grid is split into substeps
+    Crank-Nicolson steps; after maturity and after every observation the
+    first dampingSteps of them are replaced by two implicit half steps
+    (Rannacher), since every projection puts a kink or jump back into
+    the layers. Both layers share the matrix, which is built once per
+    substep, and the solver workspaces are allocated once.
+*/
+class SnowballFiniteDifference {
+public:
+    SnowballFiniteDifference(const SnowballPathPricer& product,
+        const TimeGrid& grid, const ForwardTerms& terms,
+        Size xNodes = 801, Size substeps = 4, Size dampingSteps = 1, Real stdDevs = 5.0);
+
+    void calculate();
+    Real value() const { return value_; }
+    //! derivatives with respect to the normalized spot
+    Real delta() const { return delta_; }
+    Real gamma() const { return gamma_; }
+    const std::vector<Real>& locations() const { return x_; }
+    //! today's values of the not-yet-knocked-in layer on the grid
+    const std::vector<Real>& values() const { return notIn_; }
+private:
+    void step(Size i, Real dt, Real theta);
+    void observe(Size i);
+    void terminal();
+    Real above(Size j, Real level) const;
+    SnowballPathPricer product_;
+    TimeGrid grid_;
+    ForwardTerms terms_;
+    Size substeps_, dampingSteps_;
+    Real dx_;
+    Size spot_;
+    std::vector<Real> x_, s_;
+    std::vector<Real> knockedIn_, notIn_;
+    std::vector<Real> rhsIn_, rhsNotIn_;
+    TridiagonalSystem system_;
+    Real value_, delta_, gamma_;
+};
+
+inline SnowballFiniteDifference::SnowballFiniteDifference(const SnowballPathPricer& product,
+    const TimeGrid& grid, const ForwardTerms& terms,
+    Size xNodes, Size substeps, Size dampingSteps, Real stdDevs)
+    : product_(product), grid_(grid), terms_(terms),
+    substeps_(substeps), dampingSteps_(dampingSteps), system_(1),
+    value_(0.0), delta_(0.0), gamma_(0.0) {
+    Size steps = grid_.size() - 1;
+    QL_REQUIRE(product_.size() == steps + 1,
+        "snowball has " << product_.size() << " dates, the grid " << steps + 1);
+    QL_REQUIRE(terms_.rate.size() == steps && terms_.dividend.size() == steps
+        && terms_.variance.size() == steps, "forward terms do not match the grid");
+    QL_REQUIRE(xNodes >= 11, "at least 11 space nodes are needed");
+    QL_REQUIRE(substeps_ >= 1, "at least one substep is needed");
+
+    // domain: stdDevs total standard deviations around the spot, widened
+    // to contain every observed barrier
+    Real variance = 0.0, drift = 0.0;
+    for (Size i = 0; i < steps; i++) {
+        variance += terms_.variance[i] * grid_.dt(i);
+        drift += (terms_.rate[i] - terms_.dividend[i]) * grid_.dt(i);
+    }
+    Real width = stdDevs * std::sqrt(std::max(variance, 1e-8));
+    Real x_min = std::min(0.0, drift) - width, x_max = std::max(0.0, drift) + width;
+    for (Size i = 1; i <= steps; i++) {
+        if (product_.kiOb()[i])
+            x_min = std::min(x_min, std::log(product_.kiBarrier()[i]) - 0.5 * width);
+        if (product_.callOb()[i])
+            x_max = std::max(x_max, std::log(product_.callBarrier()[i]) + 0.5 * width);
+    }
+
+    // uniform spacing with a node on the spot
+    dx_ = (x_max - x_min) / (xNodes - 1);
+    spot_ = (Size)std::ceil(-x_min / dx_);
+    Size n = spot_ + (Size)std::ceil(x_max / dx_) + 1;
+    x_.resize(n);
+    s_.resize(n);
+    for (Size j = 0; j < n; j++) {
+        x_[j] = ((Real)j - (Real)spot_) * dx_;
+        s_[j] = std::exp(x_[j]);
+    }
+    knockedIn_.resize(n);
+    notIn_.resize(n);
+    rhsIn_.resize(n);
+    rhsNotIn_.resize(n);
+    system_ = TridiagonalSystem(n);
+}
+
+// Share of the cell [x - dx/2, x + dx/2] of node j lying above level.
+// Projections are averaged over the cell that contains a barrier, which
+// keeps second order in dx for barriers between nodes.
+inline Real SnowballFiniteDifference::above(Size j, Real level) const
+{
+    Real f = (x_[j] + 0.5 * dx_ - std::log(level)) / dx_;
+    return std::min(std::max(f, 0.0), 1.0);
+}
+
+inline void SnowballFiniteDifference::terminal()
+{
+    Size last = grid_.size() - 1;
+    for (Size j = 0; j < x_.size(); j++) {
+        knockedIn_[j] = std::min(std::max(s_[j], product_.minValue()), product_.maxValue()) - 1.0;
+        notIn_[j] = product_.coupon()[last];
+    }
+    observe(last);
+}
+
+// applies the call and knock-in observations of step i to both layers
+inline void SnowballFiniteDifference::observe(Size i)
+{
+    if (product_.callOb()[i]) {
+        Real barrier = product_.callBarrier()[i], coupon = product_.coupon()[i];
+        for (Size j = x_.size(); j-- > 0; ) {
+            Real w = above(j, barrier);
+            if (w == 0.0)
+                break;
+            knockedIn_[j] = w * coupon + (1.0 - w) * knockedIn_[j];
+            notIn_[j] = w * coupon + (1.0 - w) * notIn_[j];
+        }
+    }
+    if (product_.kiOb()[i]) {
+        // called nodes already hold the coupon in both layers
+        Real barrier = product_.kiBarrier()[i];
+        for (Size j = 0; j < x_.size(); j++) {
+            Real w = 1.0 - above(j, barrier);
+            if (w == 0.0)
+                break;
+            notIn_[j] = w * knockedIn_[j] + (1.0 - w) * notIn_[j];
+        }
+    }
+}
+
+// one theta step of length dt backward over interval i, for both layers
+inline void SnowballFiniteDifference::step(Size i, Real dt, Real theta)
+{
+    Real r = terms_.rate[i];
+    Real v = terms_.variance[i];
+    Real mu = r - terms_.dividend[i] - 0.5 * v;
+    Real a = 0.5 * v / (dx_ * dx_) - 0.5 * mu / dx_;
+    Real b = -v / (dx_ * dx_) - r;
+    Real c = 0.5 * v / (dx_ * dx_) + 0.5 * mu / dx_;
+    Size n = x_.size();
+
+    // boundaries: no curvature, one-sided drift
+    Real bl = -mu / dx_ - r, cl = mu / dx_;
+    Real an = -mu / dx_, bn = mu / dx_ - r;
+
+    // rhs = (I + (1-theta) dt L) V
+    Real e = (1.0 - theta) * dt;
+    rhsIn_[0] = knockedIn_[0] + e * (bl * knockedIn_[0] + cl * knockedIn_[1]);
+    rhsNotIn_[0] = notIn_[0] + e * (bl * notIn_[0] + cl * notIn_[1]);
+    for (Size j = 1; j < n - 1; j++) {
+        rhsIn_[j] = knockedIn_[j] + e * (a * knockedIn_[j - 1] + b * knockedIn_[j] + c * knockedIn_[j + 1]);
+        rhsNotIn_[j] = notIn_[j] + e * (a * notIn_[j - 1] + b * notIn_[j] + c * notIn_[j + 1]);
+    }
+    rhsIn_[n - 1] = knockedIn_[n - 1] + e * (an * knockedIn_[n - 2] + bn * knockedIn_[n - 1]);
+    rhsNotIn_[n - 1] = notIn_[n - 1] + e * (an * notIn_[n - 2] + bn * notIn_[n - 1]);
+
+    // (I - theta dt L) V_new = rhs
+    Real f = theta * dt;
+    std::vector<Real>& lower = system_.lower();
+    std::vector<Real>& diag = system_.diag();
+    std::vector<Real>& upper = system_.upper();
+    diag[0] = 1.0 - f * bl;
+    upper[0] = -f * cl;
+    for (Size j = 1; j < n - 1; j++) {
+        lower[j] = -f * a;
+        diag[j] = 1.0 - f * b;
+        upper[j] = -f * c;
+    }
+    lower[n - 1] = -f * an;
+    diag[n - 1] = 1.0 - f * bn;
+    system_.solve(rhsIn_);
+    system_.solve(rhsNotIn_);
+    knockedIn_.swap(rhsIn_);
+    notIn_.swap(rhsNotIn_);
+}
+
+inline void SnowballFiniteDifference::calculate()
+{
+    Size steps = grid_.size() - 1;
+    terminal();
+    Size damping = dampingSteps_;
+    for (Size i = steps; i-- > 0; ) {
+        Real dt = grid_.dt(i) / substeps_;
+        for (Size k = 0; k < substeps_; k++) {
+            if (damping > 0) {
+                step(i, 0.5 * dt, 1.0);
+                step(i, 0.5 * dt, 1.0);
+                damping--;
+            }
+            else
+                step(i, dt, 0.5);
+        }
+        if (i > 0) {
+            observe(i);
+            if (product_.callOb()[i] || product_.kiOb()[i])
+                damping = dampingSteps_;
+        }
+    }
+
+    Size j = spot_;
+    value_ = notIn_[j];
+    Real dv = (notIn_[j + 1] - notIn_[j - 1]) / (2.0 * dx_);
+    Real d2v = (notIn_[j + 1] - 2.0 * notIn_[j] + notIn_[j - 1]) / (dx_ * dx_);
+    delta_ = dv;
+    gamma_ = d2v - dv;
+}
@@ -0,0 +1,111 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <ql/types.hpp>
+#include <ql/errors.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Snowball Pricer
+//===================
+
+//! fused snowball (autocall with knock-in) payoff on a normalized path
+/*! Same product as the CUDA kernel in CUDAMC.ipynb, but indexed like
+    GeneratePath: every schedule has steps+1 entries and entry i refers
+    to the path value at step i.
+
+    - on a call date, S >= call_barrier: pays coupon[i], path stops;
+    - on a knock-in date, S < ki_barrier: the note is knocked in;
+    - at maturity, knocked in: pays clamp(S, min_value, max_value) - 1;
+    - at maturity, not knocked in: pays coupon[steps].
+
+    Payments are discounted with discount[i]. The pricer is fed one step
+    at a time by MyPathGenerator::price_next.
+*/
+class SnowballPathPricer {
+public:
+    SnowballPathPricer(const std::vector<Real>& coupon,
+        const std::vector<char>& call_ob, const std::vector<Real>& call_barrier,
+        const std::vector<char>& ki_ob, const std::vector<Real>& ki_barrier,
+        Real min_value, Real max_value,
+        const std::vector<Real>& discount);
+
+    void reset() {
+        callStep_ = 0;
+        kiStep_ = 0;
+        value_ = 0.0;
+    }
+    //! whether step i is a call or knock-in date
+    bool observed(Size i) const { return callOb_[i] || kiOb_[i]; }
+    //! returns true when the path is terminated at step i
+    bool observe(Size i, Real x) {
+        if (callOb_[i] && x >= callBarrier_[i]) {
+            callStep_ = i;
+            value_ = coupon_[i] * df(i);
+            return true;
+        }
+        if (kiStep_ == 0 && kiOb_[i] && x < kiBarrier_[i])
+            kiStep_ = i;
+        return false;
+    }
+    //! called with the terminal value when the path was not stopped
+    void finish(Real x) {
+        Size n = coupon_.size() - 1;
+        if (kiStep_ != 0)
+            value_ = (std::min(std::max(x, minValue_), maxValue_) - 1.0) * df(n);
+        else
+            value_ = coupon_[n] * df(n);
+    }
+
+    Real value() const { return value_; }
+    //! reads discount factors from path, the current path's column kept by a
+    //! stochastic-rate generator, instead of discount(); 0 goes back
+    void setPathDiscount(const Real* path) { pathDiscount_ = path; }
+    //! step of the autocall, 0 if not called
+    Size callStep() const { return callStep_; }
+    //! first knock-in step, 0 if never knocked in
+    Size knockInStep() const { return kiStep_; }
+    Size size() const { return coupon_.size(); }
+
+    const std::vector<Real>& coupon() const { return coupon_; }
+    const std::vector<char>& callOb() const { return callOb_; }
+    const std::vector<Real>& callBarrier() const { return callBarrier_; }
+    const std::vector<char>& kiOb() const { return kiOb_; }
+    const std::vector<Real>& kiBarrier() const { return kiBarrier_; }
+    Real minValue() const { return minValue_; }
+    Real maxValue() const { return maxValue_; }
+    const std::vector<Real>& discount() const { return discount_; }
+private:
+    Real df(Size i) const { return pathDiscount_ ? pathDiscount_[i] : discount_[i]; }
+    std::vector<Real> coupon_;
+    std::vector<char> callOb_;
+    std::vector<Real> callBarrier_;
+    std::vector<char> kiOb_;
+    std::vector<Real> kiBarrier_;
+    Real minValue_, maxValue_;
+    std::vector<Real> discount_;
+    const Real* pathDiscount_;
+    Size callStep_, kiStep_;
+    Real value_;
+};
+
+inline SnowballPathPricer::SnowballPathPricer(const std::vector<Real>& coupon,
+    const std::vector<char>& call_ob, const std::vector<Real>& call_barrier,
+    const std::vector<char>& ki_ob, const std::vector<Real>& ki_barrier,
+    Real min_value, Real max_value,
+    const std::vector<Real>& discount)
+    : coupon_(coupon), callOb_(call_ob), callBarrier_(call_barrier),
+    kiOb_(ki_ob), kiBarrier_(ki_barrier),
+    minValue_(min_value), maxValue_(max_value), discount_(discount), pathDiscount_(0),
+    callStep_(0), kiStep_(0), value_(0.0) {
+    Size n = coupon_.size();
+    QL_REQUIRE(n > 1, "empty snowball schedule");
+    QL_REQUIRE(callOb_.size() == n && callBarrier_.size() == n
+        && kiOb_.size() == n && kiBarrier_.size() == n && discount_.size() == n,
+        "snowball schedules must all have steps+1 (" << n << ") entries");
+    QL_REQUIRE(minValue_ <= maxValue_, "min_value > max_value");
+}
@@ -0,0 +1,252 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <SnowballPricer.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+using namespace QuantLib;
+
+//===================
+// Snowball Summary
+//===================
+
+//! per-path summaries of normalized paths, repriced under spot moves
+/*! Under BS/BSM dynamics a path started from r*S0 is r times the path
+    started from S0, so instead of rescaling paths the barriers are
+    divided by r. For each path only three things are kept:
+
+    - the call records: along the call dates, the running minimum of
+      call_barrier[i]/S[i] and the step where it was reached. A ratio r
+      calls the path at the first record with threshold <= r;
+    - the knock-in ratio max(ki_barrier[i]/S[i]) over the knock-in dates:
+      a path that is never called is knocked in iff r is below it;
+    - the terminal value S[steps].
+
+    Repricing is a single pass over these arrays, without touching the
+    random numbers or the process. The summary is fed like a pricer by
+    MyPathGenerator::price_next and value() gives the payoff at r = 1.
+
+    The same arrays price the snowball with its coupons multiplied by k
+    (the price is linear in k) and its knock-in barriers multiplied by m
+    (a path knocks in iff r < m * ratio), so the coupon or the knock-in
+    level that gives a target price is solved without new paths.
+*/
+class SnowballSummary {
+public:
+    explicit SnowballSummary(const SnowballPathPricer& product);
+
+    //! \name pricer interface used while building
+    //@{
+    void reset();
+    bool observed(Size i) const { return product_.observed(i); }
+    bool observe(Size i, Real x);
+    void finish(Real x);
+    Real value() const { return value_; }
+    //@}
+
+    //! average discounted payoff with the spot multiplied by \p spot_ratio
+    /*! and, optionally, the coupons by \p coupon_scale and the knock-in
+        barriers by \p ki_scale */
+    Real reprice(Real spot_ratio, Real coupon_scale = 1.0, Real ki_scale = 1.0) const;
+    //! standard error of reprice(spot_ratio, coupon_scale, ki_scale)
+    Real errorEstimate(Real spot_ratio, Real coupon_scale = 1.0, Real ki_scale = 1.0) const;
+    //! probability of an autocall with the spot multiplied by \p spot_ratio
+    Real callProbability(Real spot_ratio) const;
+    //! coupon_scale at which reprice(spot_ratio, coupon_scale) is \p target
+    /*! One pass: the price is A*k + B, A from the coupons paid, B from
+        the knocked-in paths. */
+    Real solveCoupon(Real target, Real spot_ratio = 1.0) const;
+    //! ki_scale at which reprice(spot_ratio, 1, ki_scale) crosses \p target
+    /*! Paths not called knock in from the scale r/ratio on, so the price
+        is a step function of the scale, moving by one path's change at
+        each such threshold: the thresholds are sorted, and the scale
+        returned lies strictly between the one where the running price
+        passes the target and the next, so that the repriced value is on
+        the target's side. */
+    Real solveKnockIn(Real target, Real spot_ratio = 1.0) const;
+    Size samples() const { return terminal_.size(); }
+    Size records() const { return threshold_.size(); }
+private:
+    Real pathValue(Size p, Real r, Size& call_step, Real coupon_scale = 1.0, Real ki_scale = 1.0) const;
+    Real loss(Size p, Real r) const {
+        return (std::min(std::max(r * terminal_[p], product_.minValue()), product_.maxValue()) - 1.0)
+            * product_.discount()[n_];
+    }
+    //! index of the first call record of path p at ratio r, offset_[p+1] if not called
+    Size callRecord(Size p, Real r) const {
+        Size j = offset_[p];
+        while (j < offset_[p + 1] && threshold_[j] > r)
+            j++;
+        return j;
+    }
+    SnowballPathPricer product_;
+    Size n_;
+    // current path
+    Real runningMin_, kiRatio_;
+    Real value_;
+    // summaries, call records in CSR layout
+    std::vector<Size> offset_;
+    std::vector<Real> threshold_;
+    std::vector<Size> step_;
+    std::vector<Real> knockIn_;
+    std::vector<Real> terminal_;
+};
+
+inline SnowballSummary::SnowballSummary(const SnowballPathPricer& product)
+    : product_(product), n_(product.size() - 1),
+    runningMin_(0.0), kiRatio_(0.0), value_(0.0), offset_(1, 0) {}
+
+inline void SnowballSummary::reset()
+{
+    runningMin_ = std::numeric_limits<Real>::max();
+    kiRatio_ = 0.0;
+    product_.reset();
+}
+
+// never stops the path: later call dates matter for smaller spot ratios
+inline bool SnowballSummary::observe(Size i, Real x)
+{
+    if (product_.callOb()[i]) {
+        Real c = product_.callBarrier()[i] / x;
+        if (c < runningMin_) {
+            runningMin_ = c;
+            threshold_.push_back(c);
+            step_.push_back(i);
+        }
+    }
+    if (product_.kiOb()[i])
+        kiRatio_ = std::max(kiRatio_, product_.kiBarrier()[i] / x);
+    return false;
+}
+
+inline void SnowballSummary::finish(Real x)
+{
+    offset_.push_back(threshold_.size());
+    knockIn_.push_back(kiRatio_);
+    terminal_.push_back(x);
+    Size call_step;
+    value_ = pathValue(terminal_.size() - 1, 1.0, call_step);
+}
+
+inline Real SnowballSummary::pathValue(Size p, Real r, Size& call_step,
+                                       Real coupon_scale, Real ki_scale) const
+{
+    const std::vector<Real>& coupon = product_.coupon();
+    const std::vector<Real>& discount = product_.discount();
+    Size j = callRecord(p, r);
+    if (j < offset_[p + 1]) {
+        call_step = step_[j];
+        return coupon_scale * coupon[call_step] * discount[call_step];
+    }
+    call_step = 0;
+    if (r < ki_scale * knockIn_[p])
+        return loss(p, r);
+    return coupon_scale * coupon[n_] * discount[n_];
+}
+
+inline Real SnowballSummary::reprice(Real spot_ratio, Real coupon_scale, Real ki_scale) const
+{
+    QL_REQUIRE(spot_ratio > 0.0, "non-positive spot ratio");
+    Size n = samples();
+    if (n == 0)
+        return 0.0;
+    Real sum = 0.0;
+    Size call_step;
+    for (Size p = 0; p < n; p++)
+        sum += pathValue(p, spot_ratio, call_step, coupon_scale, ki_scale);
+    return sum / n;
+}
+
+inline Real SnowballSummary::errorEstimate(Real spot_ratio, Real coupon_scale, Real ki_scale) const
+{
+    QL_REQUIRE(spot_ratio > 0.0, "non-positive spot ratio");
+    Size n = samples();
+    if (n < 2)
+        return 0.0;
+    Real sum = 0.0, sum_sq = 0.0;
+    Size call_step;
+    for (Size p = 0; p < n; p++) {
+        Real v = pathValue(p, spot_ratio, call_step, coupon_scale, ki_scale);
+        sum += v;
+        sum_sq += v * v;
+    }
+    Real m = sum / n;
+    Real v = (sum_sq / n - m * m) * n / (n - 1.0);
+    return std::sqrt(std::max(v, 0.0) / n);
+}
+
+inline Real SnowballSummary::callProbability(Real spot_ratio) const
+{
+    Size n = samples();
+    if (n == 0)
+        return 0.0;
+    Size called = 0;
+    for (Size p = 0; p < n; p++)
+        // records decrease, the last one is the smallest ratio that calls
+        if (offset_[p + 1] > offset_[p] && threshold_[offset_[p + 1] - 1] <= spot_ratio)
+            called++;
+    return (Real)called / n;
+}
+
+inline Real SnowballSummary::solveCoupon(Real target, Real spot_ratio) const
+{
+    QL_REQUIRE(spot_ratio > 0.0, "non-positive spot ratio");
+    Size n = samples();
+    QL_REQUIRE(n > 0, "no paths summarized");
+    const std::vector<Real>& coupon = product_.coupon();
+    const std::vector<Real>& discount = product_.discount();
+    Real paid = 0.0, lost = 0.0;
+    for (Size p = 0; p < n; p++) {
+        Size j = callRecord(p, spot_ratio);
+        if (j < offset_[p + 1])
+            paid += coupon[step_[j]] * discount[step_[j]];
+        else if (spot_ratio < knockIn_[p])
+            lost += loss(p, spot_ratio);
+        else
+            paid += coupon[n_] * discount[n_];
+    }
+    QL_REQUIRE(paid != 0.0, "no path is paid a coupon, the price does not depend on it");
+    return (target * n - lost) / paid;
+}
+
+inline Real SnowballSummary::solveKnockIn(Real target, Real spot_ratio) const
+{
+    QL_REQUIRE(spot_ratio > 0.0, "non-positive spot ratio");
+    Size n = samples();
+    QL_REQUIRE(n > 0, "no paths summarized");
+    const std::vector<Real>& coupon = product_.coupon();
+    const std::vector<Real>& discount = product_.discount();
+    // price with no knock-in, and the scale and price change of every path that can knock in
+    Real sum = 0.0;
+    std::vector<std::pair<Real, Real> > jumps;
+    for (Size p = 0; p < n; p++) {
+        Size j = callRecord(p, spot_ratio);
+        if (j < offset_[p + 1]) {
+            sum += coupon[step_[j]] * discount[step_[j]];
+            continue;
+        }
+        Real survived = coupon[n_] * discount[n_];
+        sum += survived;
+        if (knockIn_[p] > 0.0)
+            jumps.push_back(std::make_pair(spot_ratio / knockIn_[p], loss(p, spot_ratio) - survived));
+    }
+    std::sort(jumps.begin(), jumps.end());
+    Real unknocked = sum / n;
+    target *= n;
+    bool above = sum > target;
+    for (Size k = 0; k < jumps.size();) {
+        // a path knocks in once the scale exceeds its threshold, together with any of equal threshold
+        Real threshold = jumps[k].first;
+        for (; k < jumps.size() && jumps[k].first == threshold; k++)
+            sum += jumps[k].second;
+        if ((sum > target) != above)
+            return k < jumps.size() ? 0.5 * (threshold + jumps[k].first) : threshold * (1.0 + 1.0e-10);
+    }
+    QL_FAIL("no knock-in level gives the target price " << target / n << ": the price goes from "
+        << unknocked << " without knock-in to " << sum / n << " with every path knocked in");
+}
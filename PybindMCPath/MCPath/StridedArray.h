@@ -0,0 +1,79 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#pragma once
+
+#include <cstddef>
+#if !defined(_MSC_VER)
+#include <sys/types.h>
+#endif
+
+// MSVC has no ssize_t; Python's pyconfig.h typedefs the same type
+#if defined(_MSC_VER) && !defined(HAVE_SSIZE_T)
+typedef std::ptrdiff_t ssize_t;
+#define HAVE_SSIZE_T 1
+#endif
+
+//===================
+// Strided Arrays
+//===================
+
+//! non-owning view of a 1-d or 2-d array of T with element strides
+/*! The path loops only call arr(i) or arr(i, j), so they take these
+    views and pybind11's unchecked references alike. A C++ caller wraps
+    its own buffer, e.g. a std::vector<double> of rows * cols values is
+    StridedArray<double, 2>::rowMajor(&v[0], rows, cols).
+*/
+template <class T, int N>
+class StridedArray;
+
+template <class T>
+class StridedArray<T, 1> {
+public:
+    StridedArray() : data_(0), size_(0), stride_(1) {}
+    StridedArray(T* data, ssize_t size, ssize_t stride = 1)
+        : data_(data), size_(size), stride_(stride) {}
+
+    T& operator()(ssize_t i) const { return data_[i * stride_]; }
+    ssize_t shape(int) const { return size_; }
+    ssize_t stride(int) const { return stride_; }
+    T* data() const { return data_; }
+    bool empty() const { return data_ == 0; }
+private:
+    T* data_;
+    ssize_t size_, stride_;
+};
+
+template <class T>
+class StridedArray<T, 2> {
+public:
+    StridedArray() : data_(0) {
+        shape_[0] = shape_[1] = 0;
+        stride_[0] = stride_[1] = 0;
+    }
+    StridedArray(T* data, ssize_t rows, ssize_t cols, ssize_t rowStride, ssize_t colStride)
+        : data_(data) {
+        shape_[0] = rows;
+        shape_[1] = cols;
+        stride_[0] = rowStride;
+        stride_[1] = colStride;
+    }
+    //! C order, rows contiguous
+    static StridedArray rowMajor(T* data, ssize_t rows, ssize_t cols) {
+        return StridedArray(data, rows, cols, cols, 1);
+    }
+    //! Fortran order, columns contiguous
+    static StridedArray columnMajor(T* data, ssize_t rows, ssize_t cols) {
+        return StridedArray(data, rows, cols, 1, rows);
+    }
+
+    T& operator()(ssize_t i, ssize_t j) const { return data_[i * stride_[0] + j * stride_[1]]; }
+    ssize_t shape(int dim) const { return shape_[dim]; }
+    ssize_t stride(int dim) const { return stride_[dim]; }
+    T* data() const { return data_; }
+    bool empty() const { return data_ == 0; }
+    //! true if stored column by column, which the tile writers prefer
+    bool columnContiguous() const { return stride_[0] == 1 && stride_[1] != 1; }
+private:
+    T* data_;
+    ssize_t shape_[2], stride_[2];
+};
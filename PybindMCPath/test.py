@@ -3,10 +3,13 @@ import numpy as np
 from datetime import datetime as dtm
 from datetime import timedelta as td
 
+import math
 import time
 import os
+import shutil
 import sys
-from multiprocessing import Pool
+import tempfile
+from multiprocessing import Pool, Process
 
 sys.path.append("bin")
 import MCPath 
@@ -54,6 +57,69 @@ def MPMC(task):
                                task[2],downout_obidx,downout_barrier,
                                proc_type, array,
                                True,0,42)
+coupon = np.zeros(steps+1)
+coupon[upout_obidx] = 0.05*np.arange(0,steps+1)[upout_obidx]/365
+ki_barrier = np.full(steps+1,0.7)
+
+def Shard(task):
+    return MCPath.PriceSnowballShard(today,steps,tenor,
+                                     ir_type,ir_term,ir_data,ir_dc,
+                                     d_type,d_term,d_data,d_dc,
+                                     v_type,v_term,v_data,v_dc,
+                                     proc_type,coupon,
+                                     upout_obidx,upout_barrier,
+                                     downout_obidx,ki_barrier,
+                                     0.01,1.0,
+                                     task[0],task[1],
+                                     True,42,task[2])
+
+
+def CheckpointedPaths(task):
+    out = np.lib.format.open_memmap(task[0],mode="r+")
+    MCPath.GeneratePath(today,out.shape[0],steps,tenor,
+                        ir_type,ir_term,ir_data,ir_dc,
+                        d_type,d_term,d_data,d_dc,
+                        v_type,v_term,v_data,v_dc,
+                        0,upout_obidx,upout_barrier,
+                        0,downout_obidx,downout_barrier,
+                        proc_type,out,True,0,42,1,
+                        checkpoint=task[1],checkpoint_every=task[2])
+    out.flush()
+
+def CheckpointedEvents(task):
+    out = np.lib.format.open_memmap(task[0],mode="r+")
+    events = {}
+    MCPath.GeneratePath(today,out.shape[0],steps,tenor,
+                        ir_type,ir_term,ir_data,ir_dc,
+                        d_type,d_term,d_data,d_dc,
+                        v_type,v_term,v_data,v_dc,
+                        upout_type,upout_obidx,upout_barrier,
+                        downout_type,downout_obidx,downout_barrier,
+                        proc_type,out,True,0,42,1,events=events,
+                        checkpoint=task[1],checkpoint_every=task[2])
+    out.flush()
+    return events
+
+def CheckpointedSnowball(task):
+    return MCPath.PriceSnowballCheckpointed(today,steps,tenor,
+                                            ir_type,ir_term,ir_data,ir_dc,
+                                            d_type,d_term,d_data,d_dc,
+                                            v_type,v_term,v_data,v_dc,
+                                            proc_type,coupon,
+                                            upout_obidx,upout_barrier,
+                                            downout_obidx,ki_barrier,
+                                            0.01,1.0,
+                                            task[0],task[1],task[2],rng=1)
+
+def Interrupted(target,task,checkpoint):
+    # kills the run once it has saved a checkpoint, as a crash would
+    child = Process(target=target,args=(task,))
+    child.start()
+    while child.is_alive() and not os.path.exists(checkpoint):
+        time.sleep(0.001)
+    child.terminate()
+    child.join()
+    return os.path.exists(checkpoint)
 
 if __name__ == '__main__':
     proc_type = 0
@@ -110,4 +176,656 @@ if __name__ == '__main__':
     res = np.concatenate(res_list,axis=0)
     print(" [Result]: ",time.time()-t5)
     print(res[:,-1].mean())
+
+    #=========================
+    #  Sharded Pricing Test
+    #=========================
+
+    for rng in (0,1):
+        print(f"Test snowball pricing in {n_proc} shards (rng={rng})...")
+        t6 = time.time()
+        with Pool(n_proc) as p:
+            shards = p.map(Shard, [(x*num//n_proc,(x+1)*num//n_proc-x*num//n_proc,rng) for x in range(n_proc)])
+        merged = MCPath.MergeShards(shards[::-1])
+        print(" [Result]: ",time.time()-t6)
+        single = Shard((0,num,rng))
+        print(" Price:",MCPath.ShardSummary(merged)["price"],"Identical to single run:",merged == single)
+        assert merged == single
+
+    #=========================
+    #  Output Layout Test
+    #=========================
+
+    upout_type,downout_type = 0,0
+    layout0 = None
+    for layout,array in ((0,np.zeros((num,steps+1))),(1,np.zeros((steps+1,num))),(0,np.zeros((num,steps+1),order="F"))):
+        print(f"Test generating MC paths with layout={layout}, order={'F' if array.flags.f_contiguous else 'C'}...")
+        t7 = time.time()
+        res=MCPath.GeneratePath(today,num,steps,tenor,
+                                ir_type,ir_term,ir_data,ir_dc,
+                                d_type,d_term,d_data,d_dc,
+                                v_type,v_term,v_data,v_dc,
+                                upout_type,upout_obidx,upout_barrier,
+                                downout_type,downout_obidx,downout_barrier,
+                                proc_type,array,
+                                True,0,42,layout=layout)
+        t8 = time.time()
+        obs = res[:,upout_obidx] if layout==0 else res[upout_obidx,:]
+        hit = (obs.T if layout==0 else obs) >= upout_barrier[upout_obidx][:,None]
+        print(" [Result]: ",t8-t7," column reads:",time.time()-t8,hit.mean())
+        # every layout holds the same paths
+        if layout0 is None:
+            layout0 = res
+        else:
+            assert np.array_equal(res.T if layout==1 else res,layout0)
+    del layout0
+
+    #=========================
+    #  Finite Difference Test
+    #=========================
+
+    print("Test snowball pricing by finite differences...")
+    t9 = time.time()
+    fd = MCPath.PriceSnowballFD(today,steps,tenor,
+                                ir_type,ir_term,ir_data,ir_dc,
+                                d_type,d_term,d_data,d_dc,
+                                v_type,v_term,v_data,v_dc,
+                                proc_type,coupon,
+                                upout_obidx,upout_barrier,
+                                downout_obidx,ki_barrier,
+                                0.01,1.0)
+    print(" [Result]: ",time.time()-t9)
+    mc = MCPath.ShardSummary(Shard((0,num,0)))
+    print(" FD:",fd["price"],"MC:",mc["price"],"+-",mc["error"])
+    # flat 30% vol: the default grid against a fine one and against MC
+    flat_term,flat_data = np.array([0]),np.array([0.30])
+    for x_nodes,substeps in ((801,4),(3201,32)):
+        t9 = time.time()
+        flat = MCPath.PriceSnowballFD(today,steps,tenor,
+                                      ir_type,ir_term,ir_data,ir_dc,
+                                      d_type,d_term,d_data,d_dc,
+                                      0,flat_term,flat_data,v_dc,
+                                      proc_type,coupon,
+                                      upout_obidx,upout_barrier,
+                                      downout_obidx,ki_barrier,
+                                      0.01,1.0,x_nodes,substeps)
+        print(" [Result]: ",time.time()-t9,"x_nodes:",x_nodes,"substeps:",substeps,"FD:",flat["price"])
+    flat_mc = MCPath.ShardSummary(MCPath.PriceSnowballShard(today,steps,tenor,
+                                                            ir_type,ir_term,ir_data,ir_dc,
+                                                            d_type,d_term,d_data,d_dc,
+                                                            0,flat_term,flat_data,v_dc,
+                                                            proc_type,coupon,
+                                                            upout_obidx,upout_barrier,
+                                                            downout_obidx,ki_barrier,
+                                                            0.01,1.0,0,num))
+    print(" flat vol MC:",flat_mc["price"],"+-",flat_mc["error"])
+
+    #=========================
+    #  Multilevel MC Test
+    #=========================
+
+    print("Test snowball pricing by multilevel Monte Carlo...")
+    t10 = time.time()
+    ml = MCPath.PriceSnowballMLMC(today,steps,tenor,
+                                  ir_type,ir_term,ir_data,ir_dc,
+                                  d_type,d_term,d_data,d_dc,
+                                  v_type,v_term,v_data,v_dc,
+                                  proc_type,coupon,
+                                  upout_obidx,upout_barrier,
+                                  downout_obidx,ki_barrier,
+                                  0.01,1.0,1e-4)
+    print(" [Result]: ",time.time()-t10)
+    print(" MLMC:",ml["price"],"+-",ml["error"],"FD:",fd["price"])
+    print(" samples:",ml["samples"],"speedup:",ml["speedup"])
+    # single-level MC on the same daily grid
+    daily = MCPath.ShardSummary(Shard((0,num,1)))
+    print(" daily grid MC:",daily["price"],"+-",daily["error"])
+    assert abs(ml["price"]-daily["price"]) < 4*math.hypot(ml["error"],daily["error"])
+    assert ml["speedup"] > 1
+
+    #=========================
+    #  Importance Sampling Test
+    #=========================
+
+    for is_shift,strata in ((0.0,1),(-0.5,1),(-0.5,64)):
+        print(f"Test snowball pricing with is_shift={is_shift}, strata={strata}...")
+        t11 = time.time()
+        shard = MCPath.PriceSnowballShard(today,steps,tenor,
+                                          ir_type,ir_term,ir_data,ir_dc,
+                                          d_type,d_term,d_data,d_dc,
+                                          v_type,v_term,v_data,v_dc,
+                                          proc_type,coupon,
+                                          upout_obidx,upout_barrier,
+                                          downout_obidx,ki_barrier,
+                                          0.01,1.0,0,num,
+                                          True,42,1,is_shift,strata)
+        summary = MCPath.ShardSummary(shard)
+        print(" [Result]: ",time.time()-t11)
+        print(" Price:",summary["price"],"+-",summary["error"])
+
+    #=========================
+    #  Jump Diffusion Test
+    #=========================
+
+    upout_type,downout_type = 2,1
+    jumps = np.array([0.5,-0.1,0.15])
+    heston = np.array([0.04,1.5,0.04,0.3,-0.6])
+    for jump_proc,name in ((proc_type,"BS"),(2,"Merton"),(3,"Bates")):
+        print(f"Test generating {name} paths with early stop barrier...")
+        t12 = time.time()
+        res=MCPath.GeneratePath(today,num,steps,tenor,
+                                ir_type,ir_term,ir_data,ir_dc,
+                                d_type,d_term,d_data,d_dc,
+                                v_type,v_term,v_data,v_dc,
+                                upout_type,upout_obidx,upout_barrier,
+                                downout_type,downout_obidx,downout_barrier,
+                                jump_proc,np.zeros((num,steps+1)),
+                                True,0,42,1,row_mode=1,jumps=jumps,heston=heston)
+        print(" [Result]: ",time.time()-t12)
+        print(" knocked out:",np.isnan(res).any(axis=1).mean())
+
+    #=========================
+    #  Profiling Test
+    #=========================
+
+    upout_type,downout_type = 2,1
+    prof,ev = {},{}
+    trace_fd,trace = tempfile.mkstemp(suffix=".json")
+    os.close(trace_fd)
+    print("Test generating MC paths with profiling...")
+    t13 = time.time()
+    res=MCPath.GeneratePath(today,num,steps,tenor,
+                            ir_type,ir_term,ir_data,ir_dc,
+                            d_type,d_term,d_data,d_dc,
+                            v_type,v_term,v_data,v_dc,
+                            upout_type,upout_obidx,upout_barrier,
+                            downout_type,downout_obidx,downout_barrier,
+                            proc_type,input_array,
+                            True,0,42,events=ev,profile=prof,trace_file=trace)
+    print(" [Result]: ",time.time()-t13)
+    print(" seconds:",prof["seconds"])
+    print(" up out:",prof["up_out"].sum(),"down out:",prof["down_out"].sum(),"of",prof["paths"])
+    assert prof["paths"] == num
+    # a knock-out at the last step leaves no NaN in a row, so count the events
+    assert prof["up_out"].sum()+prof["down_out"].sum() == (ev["ko_step"] > 0).sum()
+    print(" trace bytes:",os.path.getsize(trace))
+    os.remove(trace)
+
+    #=========================
+    #  Async Test
+    #=========================
+
+    upout_type,downout_type = 2,1
+    print("Test generating MC paths in the background...")
+    sync=MCPath.GeneratePath(today,num,steps,tenor,
+                             ir_type,ir_term,ir_data,ir_dc,
+                             d_type,d_term,d_data,d_dc,
+                             v_type,v_term,v_data,v_dc,
+                             upout_type,upout_obidx,upout_barrier,
+                             downout_type,downout_obidx,downout_barrier,
+                             proc_type,np.zeros((num,steps+1)),
+                             True,0,42)
+    t14 = time.time()
+    job=MCPath.GeneratePathAsync(today,num,steps,tenor,
+                                 ir_type,ir_term,ir_data,ir_dc,
+                                 d_type,d_term,d_data,d_dc,
+                                 v_type,v_term,v_data,v_dc,
+                                 upout_type,upout_obidx,upout_barrier,
+                                 downout_type,downout_obidx,downout_barrier,
+                                 proc_type,np.zeros((num,steps+1)),
+                                 True,0,42,threads=0)
+    while not job.wait(0.5):
+        print(" progress:",job.progress()["fraction"])
+    out=job.result()
+    print(" [Result]: ",time.time()-t14)
+    print(" rows:",out["rows"],"same as sync:",np.array_equal(out["paths"],sync,equal_nan=True))
+    assert out["rows"] == num and np.array_equal(out["paths"],sync,equal_nan=True)
+    del sync
+
+    #=========================
+    #  Archive Test
+    #=========================
+
+    print("Test archiving MC paths...")
+    paths=MCPath.GeneratePath(today,num,steps,tenor,
+                              ir_type,ir_term,ir_data,ir_dc,
+                              d_type,d_term,d_data,d_dc,
+                              v_type,v_term,v_data,v_dc,
+                              upout_type,upout_obidx,upout_barrier,
+                              downout_type,downout_obidx,downout_barrier,
+                              proc_type,np.zeros((num,steps+1)),
+                              True,0,42,row_mode=1)
+    archive_fd,archive = tempfile.mkstemp(suffix=".mcpa")
+    os.close(archive_fd)
+    t15 = time.time()
+    info=MCPath.ArchivePaths(paths,archive,tolerance=1e-4)
+    print(" [Result]: ",time.time()-t15)
+    print(" ratio:",info["ratio"],"max error:",info["max_error"])
+    t16 = time.time()
+    back=MCPath.LoadPaths(archive)
+    print(" [Load]: ",time.time()-t16)
+    print(" max log error:",np.nanmax(np.abs(np.log(back/paths))))
+    assert np.nanmax(np.abs(np.log(back/paths))) <= 1e-4
+    # a truncated row reads NaN from its first NaN on; the cells after it were never written
+    assert np.array_equal(np.isnan(back),np.cumsum(np.isnan(paths),axis=1) > 0)
+    # about 7.5x at 20% vol, less at the higher vols here
+    assert info["ratio"] > 4
+    os.remove(archive)
+
+    #=========================
+    #  Callable Snowball Test
+    #=========================
+
+    print("Test issuer-callable snowball by least squares MC...")
+    exercise_ob = upout_obidx.copy()
+    exercise_ob[-1] = False
+    t17 = time.time()
+    lsmc = MCPath.PriceCallableSnowball(today,num,steps,tenor,
+                                        ir_type,ir_term,ir_data,ir_dc,
+                                        d_type,d_term,d_data,d_dc,
+                                        v_type,v_term,v_data,v_dc,
+                                        proc_type,coupon,
+                                        upout_obidx,upout_barrier,
+                                        downout_obidx,ki_barrier,
+                                        0.01,1.0,
+                                        exercise_ob,coupon,
+                                        True,num)
+    print(" [Result]: ",time.time()-t17)
+    # the same snowball without calls, on the pricing paths [num, 2*num)
+    plain = MCPath.ShardSummary(Shard((num,num,0)))
+    print(" callable:",lsmc["price"],"+-",lsmc["error"],"in sample:",lsmc["in_sample"],"not callable:",plain["price"],"+-",plain["error"])
+    # the issuer calls only when that lowers the value, and the rule fitted on
+    # its own paths calls with foresight, so in sample sits below the price
+    assert lsmc["price"] <= plain["price"] + 3*math.hypot(lsmc["error"],plain["error"])
+    assert lsmc["in_sample"] <= lsmc["price"] + 3*math.sqrt(2)*lsmc["error"]
+
+    #=========================
+    #  Hull-White Hybrid Test
+    #=========================
+
+    print("Test snowball under Hull-White rates against deterministic rates...")
+    # BSM carries the same dividend curve as the hybrid
+    bsm = MCPath.ShardSummary(MCPath.PriceSnowballShard(today,steps,tenor,
+                                                        ir_type,ir_term,ir_data,ir_dc,
+                                                        d_type,d_term,d_data,d_dc,
+                                                        v_type,v_term,v_data,v_dc,
+                                                        1,coupon,
+                                                        upout_obidx,upout_barrier,
+                                                        downout_obidx,ki_barrier,
+                                                        0.01,1.0,0,num,
+                                                        rng=1))
+    for hw in ([0.1,0.0,0.0],[0.1,0.01,0.5],[0.1,0.01,-0.5]):
+        t18 = time.time()
+        shard = MCPath.PriceSnowballShard(today,steps,tenor,
+                                          ir_type,ir_term,ir_data,ir_dc,
+                                          d_type,d_term,d_data,d_dc,
+                                          v_type,v_term,v_data,v_dc,
+                                          4,coupon,
+                                          upout_obidx,upout_barrier,
+                                          downout_obidx,ki_barrier,
+                                          0.01,1.0,0,num,
+                                          rng=1,hull_white=np.array(hw))
+        res = MCPath.ShardSummary(shard)
+        print(" [Result]: ",time.time()-t18)
+        print(" a, sigma, rho:",hw,"price:",res["price"],"+-",res["error"],"BSM:",bsm["price"],"+-",bsm["error"])
+        if hw[1] == 0.0:
+            # the draws differ in dimension, so the two errors add
+            assert abs(res["price"]-bsm["price"]) < 4*math.hypot(res["error"],bsm["error"])
+    discounts = np.zeros((num,steps+1))
+    paths = np.zeros((num,steps+1))
+    MCPath.GeneratePath(today,num,steps,tenor,
+                        ir_type,ir_term,ir_data,ir_dc,
+                        d_type,d_term,d_data,d_dc,
+                        v_type,v_term,v_data,v_dc,
+                        0,upout_obidx,upout_barrier,
+                        0,downout_obidx,downout_barrier,
+                        4,paths,True,0,42,1,
+                        hull_white=np.array([0.1,0.01,0.5]),discounts=discounts)
+    print(" mean discount at maturity:",discounts[:,-1].mean(),"mean discounted spot:",(paths[:,-1]*discounts[:,-1]).mean())
+    # the model is fitted to the curve and the discounted spot is a martingale
+    # net of the flat dividend yield
+    curve = np.zeros((1,steps+1))
+    MCPath.GeneratePath(today,1,steps,tenor,
+                        ir_type,ir_term,ir_data,ir_dc,
+                        d_type,d_term,d_data,d_dc,
+                        v_type,v_term,v_data,v_dc,
+                        0,upout_obidx,upout_barrier,
+                        0,downout_obidx,downout_barrier,
+                        1,np.zeros((1,steps+1)),True,0,42,1,discounts=curve)
+    discounted = paths[:,-1]*discounts[:,-1]
+    assert abs(discounted.mean()-paths[0,0]*math.exp(-d_data[0]*tenor)) < 4*discounted.std()/math.sqrt(num)
+    assert abs(discounts[:,-1].mean()-curve[0,-1]) < 4*discounts[:,-1].std()/math.sqrt(num)
+
+    #=========================
+    #  Geometric Asian Test
+    #=========================
+
+    print("Test analytic geometric Asians in a batch...")
+    fixings = np.arange(1,11)*0.1
+    ap = MCPath.PriceGeometricAsian(100.0,100.0,0.06,0.03,0.2,1.0,1,fixings)
+    ast = MCPath.PriceGeometricAsian(100.0,100.0,0.06,0.03,0.2,1.0,1,fixings,average_strike=True)
+    print(" average price:",ap[0],"QuantLib test: 5.3425606635")
+    print(" average strike:",ast[0],"QuantLib test: 4.97109")
+    assert abs(ap[0]-5.3425606635) < 1e-8
+    assert abs(ast[0]-4.97109) < 1e-5
+    # a fixing today is a past fixing of the spot
+    today_fixed = MCPath.PriceGeometricAsian(100.0,100.0,0.06,0.03,0.2,1.0,1,np.append(0.0,fixings))
+    spot_past = MCPath.PriceGeometricAsian(100.0,100.0,0.06,0.03,0.2,1.0,1,fixings,
+                                           past_fixings=1,running_accumulator=100.0)
+    # three fixings made, against the log-normal average written out
+    past_spots = np.array([95.0,102.0,98.0])
+    past = MCPath.PriceGeometricAsian(100.0,100.0,0.06,0.03,0.2,1.0,1,fixings,
+                                      past_fixings=3,running_accumulator=np.prod(past_spots))
+    n = len(fixings)+3
+    mu = (np.log(past_spots).sum()+len(fixings)*math.log(100.0)+(0.06-0.03-0.02)*fixings.sum())/n
+    v = 0.04*np.minimum.outer(fixings,fixings).sum()/n**2
+    d1 = (mu+v-math.log(100.0))/math.sqrt(v)
+    cdf = lambda x: 0.5*math.erfc(-x/math.sqrt(2))
+    closed = math.exp(-0.06)*(math.exp(mu+v/2)*cdf(d1)-100.0*cdf(d1-math.sqrt(v)))
+    print(" fixing today:",today_fixed[0],"as past fixing:",spot_past[0],"three past fixings:",past[0],"closed form:",closed)
+    assert abs(today_fixed[0]-spot_past[0]) < 1e-10
+    assert abs(past[0]-closed) < 1e-10
+    spots = np.random.uniform(80.0,120.0,num*10)
+    t19 = time.time()
+    batch = MCPath.PriceGeometricAsian(spots,100.0,0.06,0.03,0.2,1.0,1,fixings)
+    print(" [Result]: ",time.time()-t19,"for",len(spots),"options")
+
+    #=========================
+    #  Par Solver Test
+    #=========================
+
+    print("Test solving the par coupon and knock-in level on one path set...")
+    t20 = time.time()
+    snow = MCPath.SummarizeSnowball(today,num,steps,tenor,
+                                    ir_type,ir_term,ir_data,ir_dc,
+                                    d_type,d_term,d_data,d_dc,
+                                    v_type,v_term,v_data,v_dc,
+                                    proc_type,coupon,
+                                    upout_obidx,upout_barrier,
+                                    downout_obidx,ki_barrier,
+                                    0.01,1.0)
+    print(" [Summary]: ",time.time()-t20)
+    t21 = time.time()
+    k = snow.solve_coupon(0.0)
+    m = snow.solve_knock_in(0.0)
+    print(" [Solve]: ",time.time()-t21)
+    print(" par coupon scale:",k,"price:",snow.reprice(1.0,k),"+-",snow.error(1.0,k))
+    print(" par knock-in scale:",m,"price:",snow.reprice(1.0,1.0,m))
+    # no path knocks in at scale 0; at m the price has crossed the target
+    assert (snow.reprice(1.0,1.0,m) > 0.0) != (snow.reprice(1.0,1.0,0.0) > 0.0)
+
+    #=========================
+    #  Path Construction Test
+    #=========================
+
+    print("Test PCA against Brownian bridge construction on a geometric Asian call...")
+    # flat inputs, so the analytic price is a reference from neither construction
+    flat_r,flat_q,flat_vol = 0.03,0.01,0.2
+    fixings = np.arange(1,steps+1)*tenor/steps
+    ref = MCPath.PriceGeometricAsian(1.0,1.0,flat_r,flat_q,flat_vol,tenor,1,fixings)[0]
+    def asian(n,construction):
+        paths = np.zeros((n,steps+1))
+        MCPath.GeneratePath(today,n,steps,tenor,
+                            0,np.array([0]),np.array([flat_r]),ir_dc,
+                            0,np.array([0]),np.array([flat_q]),d_dc,
+                            0,np.array([0]),np.array([flat_vol]),v_dc,
+                            0,upout_obidx,upout_barrier,
+                            0,downout_obidx,downout_barrier,
+                            1,paths,True,0,42,0,
+                            construction=construction)
+        average = np.exp(np.log(paths[:,1:]).mean(axis=1))
+        payoff = np.maximum(average-1.0,0.0)*math.exp(-flat_r*tenor)
+        return payoff.mean(),payoff.std()
+    for n in (1024,4096,16384):
+        for construction,name in ((2,"bridge"),(3,"pca")):
+            t22 = time.time()
+            value,std = asian(n,construction)
+            print(" [Result]: ",time.time()-t22,name,n,"error:",value-ref)
+            # Sobol points do better than the pseudo-random error, which bounds them
+            assert abs(value-ref) < 4*std/math.sqrt(n)
+
+    #=========================
+    #  Cached Normals Test
+    #=========================
+
+    print("Test generating MC paths from cached normals...")
+    n = 4096
+    normals = np.zeros((n,steps+1))
+    MCPath.GenerateRS(n,steps,tenor,normals,True,0,42)
+    drawn = MCPath.GeneratePath(today,n,steps,tenor,
+                                ir_type,ir_term,ir_data,ir_dc,
+                                d_type,d_term,d_data,d_dc,
+                                v_type,v_term,v_data,v_dc,
+                                0,upout_obidx,upout_barrier,
+                                0,downout_obidx,downout_barrier,
+                                proc_type,np.zeros((n,steps+1)),
+                                True,0,42)
+    t23 = time.time()
+    cached = MCPath.GeneratePath(today,n,steps,tenor,
+                                 ir_type,ir_term,ir_data,ir_dc,
+                                 d_type,d_term,d_data,d_dc,
+                                 v_type,v_term,v_data,v_dc,
+                                 0,upout_obidx,upout_barrier,
+                                 0,downout_obidx,downout_barrier,
+                                 proc_type,np.zeros((n,steps+1)),
+                                 True,0,42,normals=normals)
+    print(" [Result]: ",time.time()-t23)
+    print(" same as RNG run:",np.array_equal(cached,drawn))
+    assert np.array_equal(cached,drawn)
+
+    #=========================
+    #  Scenario Ladder Test
+    #=========================
+
+    print("Test a spot/vol/rate ladder against plain paths...")
+    n = 4096
+    spot_shift = np.array([0.0,-0.05,0.05,0.0,0.0])
+    vol_shift = np.array([0.0,0.0,0.0,0.01,0.0])
+    rate_shift = np.array([0.0,0.0,0.0,0.0,0.0001])
+    t24 = time.time()
+    ladder = MCPath.GenerateScenarios(today,n,steps,tenor,
+                                      ir_type,ir_term,ir_data,ir_dc,
+                                      d_type,d_term,d_data,d_dc,
+                                      v_type,v_term,v_data,v_dc,
+                                      proc_type,spot_shift,vol_shift,rate_shift,
+                                      np.zeros((len(spot_shift),n,steps+1)))
+    print(" [Result]: ",time.time()-t24)
+    plain = MCPath.GeneratePath(today,n,steps,tenor,
+                                ir_type,ir_term,ir_data,ir_dc,
+                                d_type,d_term,d_data,d_dc,
+                                v_type,v_term,v_data,v_dc,
+                                0,upout_obidx,upout_barrier,
+                                0,downout_obidx,downout_barrier,
+                                proc_type,np.zeros((n,steps+1)),
+                                True,0,42)
+    # log-space tables against the process's evolve, equal up to rounding
+    print(" scenario 0 max relative difference:",np.abs(ladder[0]/plain-1.0).max())
+    assert np.allclose(ladder[0],plain,rtol=1e-10,atol=0.0)
+    print(" ladder terminal means:",ladder[:,:,-1].mean(axis=1))
+
+    #=========================
+    #  Spot Repricing Test
+    #=========================
+
+    print("Test spot-only repricing against re-simulation...")
+    n = 65536
+    snow = MCPath.SummarizeSnowball(today,n,steps,tenor,
+                                    ir_type,ir_term,ir_data,ir_dc,
+                                    d_type,d_term,d_data,d_dc,
+                                    v_type,v_term,v_data,v_dc,
+                                    proc_type,coupon,
+                                    upout_obidx,upout_barrier,
+                                    downout_obidx,ki_barrier,
+                                    0.01,1.0)
+    ratios = np.array([0.95,1.0,1.05])
+    t25 = time.time()
+    repriced = snow.reprice_ladder(ratios)
+    print(" [Result]: ",time.time()-t25)
+    # a move of the spot by r is the same as the barriers divided by r
+    for r in ratios:
+        moved = MCPath.ShardSummary(MCPath.PriceSnowballShard(today,steps,tenor,
+                                                              ir_type,ir_term,ir_data,ir_dc,
+                                                              d_type,d_term,d_data,d_dc,
+                                                              v_type,v_term,v_data,v_dc,
+                                                              proc_type,coupon,
+                                                              upout_obidx,upout_barrier/r,
+                                                              downout_obidx,ki_barrier/r,
+                                                              0.01,1.0,0,n))
+        called = moved["stop_probability"][1:].sum()
+        print(" ratio:",r,"call probability:",snow.call_probability(r),"re-simulated:",called)
+        assert abs(snow.call_probability(r)-called) <= 2.0/n
+        if r == 1.0:
+            assert abs(snow.reprice(1.0)-moved["price"]) < 1e-12
+    # with the knock-in loss measured from the moved spot, against paths started there
+    ladder = MCPath.PriceSnowballScenarios(today,n,steps,tenor,
+                                           ir_type,ir_term,ir_data,ir_dc,
+                                           d_type,d_term,d_data,d_dc,
+                                           v_type,v_term,v_data,v_dc,
+                                           proc_type,ratios-1.0,np.zeros(3),np.zeros(3),
+                                           coupon,
+                                           upout_obidx,upout_barrier,
+                                           downout_obidx,ki_barrier,
+                                           0.01,1.0)
+    print(" repriced:",repriced,"re-simulated:",ladder["price"])
+    assert np.allclose(repriced,ladder["price"],rtol=0.0,atol=2.0/n)
+
+    #=========================
+    #  Payoff Script Test
+    #=========================
+
+    print("Test a scripted snowball against the built-in pricer...")
+    n = 65536
+    snowball = """
+var ki = 0
+on ki_ob:
+    if S < ki_barrier then ki = 1 end
+end
+on call_ob:
+    if S >= call_barrier then pay coupon stop end
+end
+final:
+    if ki then pay min(max(S, 0.01), 1) - 1 else pay coupon end
+end
+"""
+    arrays = {"ki_ob":downout_obidx,"ki_barrier":ki_barrier,"call_ob":upout_obidx,"call_barrier":upout_barrier,"coupon":coupon}
+    print(MCPath.DisassemblePayoff(snowball,arrays))
+    t26 = time.time()
+    scripted = MCPath.PricePayoffScript(today,n,steps,tenor,
+                                        ir_type,ir_term,ir_data,ir_dc,
+                                        d_type,d_term,d_data,d_dc,
+                                        v_type,v_term,v_data,v_dc,
+                                        proc_type,snowball,arrays)
+    print(" [Result]: ",time.time()-t26)
+    builtin = MCPath.ShardSummary(MCPath.PriceSnowballShard(today,steps,tenor,
+                                                            ir_type,ir_term,ir_data,ir_dc,
+                                                            d_type,d_term,d_data,d_dc,
+                                                            v_type,v_term,v_data,v_dc,
+                                                            proc_type,coupon,
+                                                            upout_obidx,upout_barrier,
+                                                            downout_obidx,ki_barrier,
+                                                            0.01,1.0,0,n))
+    print(" script:",scripted["price"],"+-",scripted["error"],"built-in:",builtin["price"])
+    assert abs(scripted["price"]-builtin["price"]) < 1e-12
+    assert np.allclose(scripted["stop_probability"],builtin["stop_probability"],rtol=0.0,atol=1e-12)
+
+    #=========================
+    #  Merton Series Test
+    #=========================
+
+    print("Test Merton call prices against the series formula...")
+    def black_call(s,k,r,q,vol,t):
+        sd = vol*math.sqrt(t)
+        d1 = (math.log(s/k)+(r-q)*t)/sd+0.5*sd
+        cdf = lambda x: 0.5*math.erfc(-x/math.sqrt(2.0))
+        return s*math.exp(-q*t)*cdf(d1)-k*math.exp(-r*t)*cdf(d1-sd)
+    def merton_call(s,k,r,q,vol,t,intensity,mean,std):
+        kappa = math.exp(mean+0.5*std*std)-1.0
+        lt = intensity*(1.0+kappa)*t
+        price,weight = 0.0,math.exp(-lt)
+        for n_jumps in range(60):
+            vol_n = math.sqrt(vol*vol+n_jumps*std*std/t)
+            r_n = r-intensity*kappa+n_jumps*math.log(1.0+kappa)/t
+            price += weight*black_call(s,k,r_n,q,vol_n,t)
+            weight *= lt/(n_jumps+1)
+        return price
+    flat_r,flat_q,flat_vol = 0.03,0.01,0.2
+    n = 262144
+    t27 = time.time()
+    merton = MCPath.GeneratePath(today,n,steps,tenor,
+                                 0,np.array([0]),np.array([flat_r]),ir_dc,
+                                 0,np.array([0]),np.array([flat_q]),d_dc,
+                                 0,np.array([0]),np.array([flat_vol]),v_dc,
+                                 0,upout_obidx,upout_barrier,
+                                 0,downout_obidx,downout_barrier,
+                                 2,np.zeros((n,steps+1)),
+                                 True,0,42,1,jumps=jumps)
+    print(" [Result]: ",time.time()-t27)
+    for k in (0.8,1.0,1.2):
+        payoff = np.maximum(merton[:,-1]-k,0.0)*math.exp(-flat_r*tenor)
+        mc,err = payoff.mean(),payoff.std()/math.sqrt(n)
+        series = merton_call(1.0,k,flat_r,flat_q,flat_vol,tenor,*jumps)
+        print(" strike:",k,"MC:",mc,"+-",err,"series:",series)
+        assert abs(mc-series) < 4.0*err
+
+    #=========================
+    #  Checkpoint Test
+    #=========================
+
+    print("Test resuming killed runs from their checkpoints...")
+    folder = tempfile.mkdtemp()
+    n = 65536
+    paths_file,paths_ckpt = os.path.join(folder,"paths.npy"),os.path.join(folder,"paths.ckpt")
+    out = np.lib.format.open_memmap(paths_file,mode="w+",shape=(n,steps+1))
+    del out
+    assert Interrupted(CheckpointedPaths,(paths_file,paths_ckpt,1024),paths_ckpt)
+    t28 = time.time()
+    CheckpointedPaths((paths_file,paths_ckpt,1024))
+    print(" [Result]: ",time.time()-t28)
+    resumed = np.load(paths_file,mmap_mode="r")
+    oneshot = MCPath.GeneratePath(today,n,steps,tenor,
+                                  ir_type,ir_term,ir_data,ir_dc,
+                                  d_type,d_term,d_data,d_dc,
+                                  v_type,v_term,v_data,v_dc,
+                                  0,upout_obidx,upout_barrier,
+                                  0,downout_obidx,downout_barrier,
+                                  proc_type,np.zeros((n,steps+1)),
+                                  True,0,42,1)
+    print(" resumed paths same as one run:",np.array_equal(resumed,oneshot),"checkpoint removed:",not os.path.exists(paths_ckpt))
+    assert np.array_equal(resumed,oneshot)
+    assert not os.path.exists(paths_ckpt)
+    del resumed
+
+    # the events of the rows made before the kill come back from the checkpoint
+    out = np.lib.format.open_memmap(paths_file,mode="w+",shape=(n,steps+1))
+    del out
+    assert Interrupted(CheckpointedEvents,(paths_file,paths_ckpt,1024),paths_ckpt)
+    resumed_ev = CheckpointedEvents((paths_file,paths_ckpt,1024))
+    resumed = np.load(paths_file,mmap_mode="r")
+    oneshot_ev = {}
+    oneshot = MCPath.GeneratePath(today,n,steps,tenor,
+                                  ir_type,ir_term,ir_data,ir_dc,
+                                  d_type,d_term,d_data,d_dc,
+                                  v_type,v_term,v_data,v_dc,
+                                  upout_type,upout_obidx,upout_barrier,
+                                  downout_type,downout_obidx,downout_barrier,
+                                  proc_type,np.zeros((n,steps+1)),
+                                  True,0,42,1,events=oneshot_ev)
+    same = all(np.array_equal(resumed_ev[k],oneshot_ev[k],equal_nan=(k=="ko_level")) for k in oneshot_ev)
+    print(" resumed events same as one run:",same,"knocked out:",(oneshot_ev["ko_step"] > 0).sum())
+    assert same and (oneshot_ev["ko_step"] > 0).any()
+    assert np.array_equal(resumed,oneshot,equal_nan=True)
+    assert not os.path.exists(paths_ckpt)
+    del resumed
+
+    n = 262144
+    shard_ckpt = os.path.join(folder,"snowball.ckpt")
+    assert Interrupted(CheckpointedSnowball,(n,shard_ckpt,8192),shard_ckpt)
+    t29 = time.time()
+    resumed = CheckpointedSnowball((n,shard_ckpt,8192))
+    print(" [Result]: ",time.time()-t29)
+    oneshot = Shard((0,n,1))
+    print(" resumed shard same bytes as one run:",resumed == oneshot,"checkpoint removed:",not os.path.exists(shard_ckpt))
+    assert resumed == oneshot
+    assert not os.path.exists(shard_ckpt)
+    shutil.rmtree(folder)
     os.system("pause")
\ No newline at end of file